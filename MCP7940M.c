@@ -1,363 +1,539 @@
 #include <stdio.h>
+#include <string.h>
 #include <avr/io.h>
-#include <util/twi.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 #include "MCP7940M.h"
+#include "power.h"
+#include "hal.h"
+#include "instr.h"
+
+#define TWI_BITRATE		12						/* 400kHz SCL */
 
 volatile static int master_mode_active = 0;		/* Needs to be set to 1, if the MCU is in master mode */
+volatile static uint8_t twi_timeout;			/* Set by the watchdog while twi_wait() waits */
+
+static twi_trans_t* volatile twi_queue[TWI_QUEUE_SIZE];	/* Pending transactions, head is on the bus */
+volatile static uint8_t twi_q_head;
+volatile static uint8_t twi_q_tail;
+static uint8_t twi_tx_pos;						/* Bytes of the active transaction already sent */
+static uint8_t twi_rx_pos;						/* Bytes of the active transaction already received */
+#ifdef INSTR_ENABLE
+	static uint16_t twi_started;				/* Timer1 count at the start of the active transaction */
+#endif
 
 
 void twi_init() 
 {
-	TWBR = 12; 									/* Division factor for SCL frequency */		
+	hal_twi_init(TWI_BITRATE);
 }
 
-uint8_t twi_tx_start()
+/**
+ * @brief Resets the positions and sends a start condition for the transaction at the head of the queue.
+ * @param stop 1 to send a stop before the start
+ */
+static void twi_begin(uint8_t stop)
 {
-	uint8_t ERR_CODE = TWI_SUCCESS;
-	
-	TWCR = (1<<TWINT)|(1<<TWSTA)|(1<<TWEN);		/* Clear TWINT flag, enable TWI and send start */
-	while(!(TWCR & (1<<TWINT)));				/* Wait for flag */
-	
-	if(TW_STATUS != TW_START) {					/* Check for errors */
-		ERR_CODE = TW_STATUS;
-	}
-	
-	return ERR_CODE;
+	twi_tx_pos = 0;
+	twi_rx_pos = 0;
+	hal_twi_start(stop);
 }
 
-uint8_t twi_tx_rep_start()
+/**
+ * @brief Finishes the active transaction with the given status, releases the bus
+ * and starts the next queued transaction.
+ * @param status TWI_SUCCESS or the TWI status code which caused the failure
+ */
+static void twi_complete(uint8_t status)
 {
-	uint8_t ERR_CODE = TWI_SUCCESS;
-	
-	TWCR = (1<<TWINT)|(1<<TWSTA)|(1<<TWEN);		/* Clear TWINT flag, enable TWI and send start */	
-	while(!(TWCR & (1<<TWINT)));				/* Wait for flag */	
+	twi_trans_t* trans = twi_queue[twi_q_head];
 	
-	if(TW_STATUS != TW_REP_START) {				/* Check for errors */
-		ERR_CODE = TW_STATUS;
+	INSTR_SINCE(INSTR_RTCC, twi_started);
+	if(status != TWI_SUCCESS) {
+		hal_gpio_set(HAL_PIN_ERROR);
+		INSTR_COUNT(INSTR_TWI_ERROR);
 	}
 	
-	return ERR_CODE;
-}
-
-uint8_t twi_tx_stop()
-{
-	uint8_t ERR_CODE = TWI_SUCCESS;
+	twi_q_head = (twi_q_head + 1) & (TWI_QUEUE_SIZE - 1);
 	
-	TWCR = (1<<TWINT)|(1<<TWEN)|(1<<TWSTO);		/* Clear TWINT flag, enable TWI and send stop */
-	
-	return ERR_CODE;
-}
-
-uint8_t twi_tx_sla_r(uint8_t sla_addr)
-{
-	uint8_t ERR_CODE = TWI_SUCCESS;
-	
-	TWDR = (sla_addr << 1)|TW_READ;				/* Load data into data register of the TWI */								
-	TWCR = (1<<TWINT)|(1<<TWEN);				/* Clear TWINT flag, enable TWI */		
-	while(!(TWCR & (1<<TWINT)));				/* Wait for flag */	
-	
-	if(TW_STATUS != TW_MR_SLA_ACK) {			/* Check for errors */
-		ERR_CODE = TW_STATUS;
+	if(twi_q_head != twi_q_tail) {
+		INSTR_MARK(twi_started);
+		twi_begin(1);							/* Stop followed by start of the next transaction */
+	}
+	else {
+		hal_twi_stop();							/* Send stop condition, bus is idle afterwards */
+		power_release(POWER_HOLD_TWI);
 	}
 	
-	return ERR_CODE;
+	trans->status = status;
+	POWER_WAKE(POWER_WAKE_TWI);
+	if(trans->callback)
+		trans->callback(trans);
 }
 
-uint8_t twi_tx_sla_w(uint8_t sla_addr)
+uint8_t twi_submit(twi_trans_t* trans)
 {
+	uint8_t sreg_tmp, next;
 	uint8_t ERR_CODE = TWI_SUCCESS;
 	
-	TWDR = (sla_addr << 1)|TW_WRITE;			/* Load data into data register of the TWI */								
-	TWCR = (1<<TWINT)|(1<<TWEN);				/* Clear TWINT flag, enable TWI */		
-	while(!(TWCR & (1<<TWINT)));				/* Wait for flag */	
+	sreg_tmp = SREG;
+	cli();
 	
-	if(TW_STATUS != TW_MT_SLA_ACK) {			/* Check for errors */
-		ERR_CODE = TW_STATUS;
+	next = (twi_q_tail + 1) & (TWI_QUEUE_SIZE - 1);
+	if(next == twi_q_head) {					/* Queue full */
+		ERR_CODE = TWI_QUEUE_FULL;
+		INSTR_COUNT(INSTR_TWI_QUEUE_FULL);
+	}
+	else {
+		trans->status = TWI_PENDING;
+		twi_queue[twi_q_tail] = trans;
+		if(twi_q_head == twi_q_tail) {			/* Bus idle -> start right away */
+			power_hold(POWER_HOLD_TWI);
+			INSTR_MARK(twi_started);
+			twi_begin(0);
+		}
+		twi_q_tail = next;
 	}
 	
+	SREG = sreg_tmp;
+	
 	return ERR_CODE;
 }
 
-uint8_t twi_tx_data(uint8_t* data)
+/**
+ * @brief Aborts the active transaction after a timeout. The TWI is switched off,
+ * a slave holding SDA is clocked free and the TWI is started again.
+ * Call with interrupts disabled, returns with interrupts disabled.
+ */
+static void twi_abort(void)
 {
-	uint8_t ERR_CODE = TWI_SUCCESS;
-	
-	TWDR = *data;								/* Load data into data register of the TWI */									
-	TWCR = (1<<TWINT)|(1<<TWEN);				/* Clear TWINT flag, enable TWI */	
-	while(!(TWCR & (1<<TWINT)));				/* Wait for flag */			
-	
-	if(TW_STATUS != TW_MT_DATA_ACK) {			/* Check for errors */
-		ERR_CODE = TW_STATUS;
-	}
-	
-	return ERR_CODE;
+	hal_twi_disable();							/* No TWI interrupt any more, the queue is ours */
+	sei();
+	hal_twi_recover();
+	cli();
+	hal_twi_init(TWI_BITRATE);
+	
+	INSTR_COUNT(INSTR_TWI_TIMEOUT);
+	twi_complete(TWI_TIMEOUT);					/* Starts the next queued transaction */
 }
 
-uint8_t twi_rx_data(uint8_t* data)
+uint8_t twi_wait(twi_trans_t* trans)
 {
-	uint8_t ERR_CODE = TWI_SUCCESS;
-	
-	TWCR = (1<<TWINT)|(1<<TWEN);				/* Clear TWINT flag, enable TWI */	
-	while(!(TWCR & (1<<TWINT)));				/* Wait for flag */
-	
-	if(TW_STATUS != TW_MR_DATA_NACK) {			/* Check for errors */
-		ERR_CODE = TW_STATUS;
-	}
-	else {
-		*data = TWDR;							/* On success get data from the data register of the TWI */
+	twi_timeout = 0;
+	hal_wdt_timeout_start();
+	
+	cli();
+	while(trans->status == TWI_PENDING) {		/* Sleep until the TWI interrupt finished the transaction */
+		if(twi_timeout) {						/* The transaction ahead (or this one) hangs */
+			twi_timeout = 0;
+			twi_abort();
+			continue;
+		}
+		power_idle();
+		cli();
 	}
+	sei();
 	
-	return ERR_CODE;
+	hal_wdt_timeout_stop();
+	
+	return trans->status;
 }
 
-uint8_t rtcc_byte_read(uint8_t mem_address, uint8_t* data)
+/**
+ * @brief Interrupt service for the watchdog, a transaction waited for a full period.
+ */
+ISR(WDT_vect)
 {
-	uint8_t ERR_CODE;
-	
-	//if(!master_mode_active) {					/* Send start condition or repeated start condition */
-	//	ERR_CODE = twi_tx_start();
-	//	master_mode_active = 1;					/* MCU is now in master mode */
-	//}
-	//else 
-	ERR_CODE = twi_tx_start();
-	
-	if(ERR_CODE != TWI_SUCCESS) {				/* Check for errors */
-		PORTD |= (1<<PD6);
-		return ERR_CODE;
-	}
-	
-	ERR_CODE = twi_tx_sla_w(SLA_ADDRESS);		/* Send SLA+W */
-	if(ERR_CODE != TWI_SUCCESS) {				/* Check for errors */
-		PORTD |= (1<<PD6);
-		return ERR_CODE;
-	}
-	
-	ERR_CODE = twi_tx_data(&mem_address);		/* Send memory address */
-	if(ERR_CODE != TWI_SUCCESS) {				/* Check for errors */
-		PORTD |= (1<<PD6);
-		return ERR_CODE;
-	}
-	
-	ERR_CODE = twi_tx_rep_start();				/* Send repeated start */
-	if(ERR_CODE != TWI_SUCCESS) {				/* Check for errors */
-		PORTD |= (1<<PD6);
-		return ERR_CODE;
-	}
-	
-	ERR_CODE = twi_tx_sla_r(SLA_ADDRESS);		/* Send SLA+R */
-	if(ERR_CODE != TWI_SUCCESS) {				/* Check for errors */
-		PORTD |= (1<<PD6);
-		return ERR_CODE;
-	}
-	
-	ERR_CODE = twi_rx_data(data);				/* Receive data byte */
-	if(ERR_CODE != TWI_SUCCESS) {				/* Check for errors */
-		PORTD |= (1<<PD6);
-		return ERR_CODE;
-	}
-	
-	ERR_CODE = twi_tx_stop();					/* Send stop condition */
-		if(ERR_CODE != TWI_SUCCESS) {			/* Check for errors */
-		PORTD |= (1<<PD6);
-		return ERR_CODE;
-	}
-	
-	return ERR_CODE;
+	twi_timeout = 1;
 }
 
-uint8_t rtcc_byte_write(uint8_t mem_address, uint8_t* data)
+/**
+ * @brief Queues a prepared transaction and waits for it. A failed transaction
+ * is repeated up to TWI_RETRIES times. If the queue is full, the transaction
+ * on the bus is waited for, a hung one is aborted after the watchdog period.
+ * @param trans Transaction descriptor
+ * @return Error code of the last attempt
+ */
+static uint8_t twi_transfer(twi_trans_t* trans)
 {
 	uint8_t ERR_CODE;
 	
-	//if(!master_mode_active) {					/* Send start condition or repeated start condition */
-	//	ERR_CODE = twi_tx_start();
-	//	master_mode_active = 1;					/* MCU is now in master mode */
-	//}
-	//else 
-	ERR_CODE = twi_tx_start();
-	
-	if(ERR_CODE != TWI_SUCCESS) {				/* Check for errors */
-		PORTD |= (1<<PD6);
-		return ERR_CODE;
-	}
-	
-	ERR_CODE = twi_tx_sla_w(SLA_ADDRESS);		/* Send SLA+W */
-	if(ERR_CODE != TWI_SUCCESS) {				/* Check for errors */
-		PORTD |= (1<<PD6);
-		return ERR_CODE;
-	}
-	
-	ERR_CODE = twi_tx_data(&mem_address);		/* Send memory address */
-	if(ERR_CODE != TWI_SUCCESS) {				/* Check for errors */
-		PORTD |= (1<<PD6);
-		return ERR_CODE;
-	}
-	
-	ERR_CODE = twi_tx_data(data);				/* Send data byte */
-	if(ERR_CODE != TWI_SUCCESS) {				/* Check for errors */
-		PORTD |= (1<<PD6);
-		return ERR_CODE;
-	}
-	
-	ERR_CODE = twi_tx_stop();					/* Send stop condition */
-	if(ERR_CODE != TWI_SUCCESS) {				/* Check for errors */
-		PORTD |= (1<<PD6);
-		return ERR_CODE;
+	for(uint8_t retries = TWI_RETRIES; ; retries--) {
+		while(twi_submit(trans) == TWI_QUEUE_FULL)	/* A full queue is never empty, the head stays valid */
+			twi_wait(twi_queue[twi_q_head]);
+		
+		ERR_CODE = twi_wait(trans);
+		if(ERR_CODE == TWI_SUCCESS || !retries)
+			return ERR_CODE;
+		
+		INSTR_COUNT(INSTR_TWI_RETRY);
 	}
-	
-	return ERR_CODE;
 }
 
-void rtcc_start_osc()
+/**
+ * @brief Interrupt service for the TWI. Steps the active transaction through
+ * START, SLA+W, write bytes, repeated START, SLA+R, read bytes and STOP.
+ */
+ISR(TWI_vect)
 {
-	uint8_t data;
-	
-	rtcc_byte_read(OSCON_REG, &data);			/* Read OSCON */
-	
-	if(!((data & OSCON_MASK) >> OSCON)) {		/* Check if oscillator is on */
-		data = ST_OSC_MASK;
-		rtcc_byte_write(ST_OSC_REG, &data);		/* Start oscillator */
+	twi_trans_t* trans = twi_queue[twi_q_head];
+	
+	switch(hal_twi_status()) {
+		case TW_START:
+		case TW_REP_START:
+			if(twi_tx_pos < trans->tx_len)		/* Write phase pending -> SLA+W, otherwise SLA+R */
+				hal_twi_write((trans->sla << 1)|TW_WRITE);
+			else
+				hal_twi_write((trans->sla << 1)|TW_READ);
+			break;
+			
+		case TW_MT_SLA_ACK:
+		case TW_MT_DATA_ACK:
+			if(twi_tx_pos < trans->tx_len)		/* Send next data byte */
+				hal_twi_write(trans->tx_buf[twi_tx_pos++]);
+			else if(trans->rx_len)				/* Switch to read phase */
+				hal_twi_start(0);
+			else
+				twi_complete(TWI_SUCCESS);
+			break;
+			
+		case TW_MR_DATA_ACK:
+			trans->rx_buf[twi_rx_pos++] = hal_twi_data();
+			/* no break */
+		case TW_MR_SLA_ACK:
+			hal_twi_read(twi_rx_pos + 1 < trans->rx_len);	/* ACK all bytes but the last */
+			break;
+			
+		case TW_MR_DATA_NACK:
+			trans->rx_buf[twi_rx_pos++] = hal_twi_data();
+			twi_complete(TWI_SUCCESS);
+			break;
+			
+		case TW_MT_ARB_LOST:					/* Also TW_MR_ARB_LOST, restart once the bus is free */
+			INSTR_COUNT(INSTR_TWI_ARB_LOST);
+			twi_begin(0);
+			break;
+			
+		default:								/* NACK or bus error */
+			twi_complete(hal_twi_status());
+			break;
 	}
-	rtcc_oscon_flag = 1;						/* Set flag */
 }
 
-void rtcc_get_time(rtcc_time_t* data)
+/**
+ * @brief Fills the descriptor of a sequential read.
+ */
+static void rtcc_read_prepare(twi_trans_t* trans, uint8_t mem_address, uint8_t* buf, uint8_t len)
 {
-	data->seconds 	= rtcc_get_seconds();
-	data->minutes 	= rtcc_get_minutes();
-	data->hours 	= rtcc_get_hours();
-	data->day		= rtcc_get_day();
-	data->date		= rtcc_get_date();
-	data->month		= rtcc_get_month();
-	data->year		= rtcc_get_year();
+	trans->sla = SLA_ADDRESS;
+	trans->tx_buf[0] = mem_address;
+	trans->tx_len = 1;
+	trans->rx_buf = buf;
+	trans->rx_len = len;
 }
 
-unsigned int rtcc_get_seconds()
+/**
+ * @brief Fills the descriptor of a sequential write.
+ */
+static void rtcc_write_prepare(twi_trans_t* trans, uint8_t mem_address, uint8_t* data, uint8_t len)
 {
-	 return get_decimal(SEC_REG, SEC_MASK, SEC10_MASK);
+	trans->sla = SLA_ADDRESS;
+	trans->tx_buf[0] = mem_address;
+	for(uint8_t i=0; i<len; i++)
+		trans->tx_buf[i+1] = data[i];
+	trans->tx_len = len + 1;
+	trans->rx_len = 0;
 }
 
-unsigned int rtcc_get_minutes()
+uint8_t rtcc_read_async(twi_trans_t* trans, uint8_t mem_address, uint8_t* buf, uint8_t len)
 {
-	return get_decimal(MIN_REG, MIN_MASK, MIN10_MASK);
+	rtcc_read_prepare(trans, mem_address, buf, len);
+	
+	return twi_submit(trans);
 }
 
-unsigned int rtcc_get_hours()
+uint8_t rtcc_byte_read(uint8_t mem_address, uint8_t* data)
 {
-	return get_decimal(HOUR_REG, HOUR_MASK, HOUR10_MASK);
+	return rtcc_block_read(mem_address, data, 1);
 }
 
-unsigned int rtcc_get_day()
+uint8_t rtcc_block_read(uint8_t start_address, uint8_t* buf, uint8_t len)
 {
-	return get_decimal(DAY_REG, DAY_MASK, DAY10_MASK);
+	twi_trans_t trans;
+	
+	trans.callback = 0;
+	rtcc_read_prepare(&trans, start_address, buf, len);
+	
+	return twi_transfer(&trans);
 }
 
-unsigned int rtcc_get_date()
+uint8_t rtcc_byte_write(uint8_t mem_address, uint8_t* data)
 {
-	return get_decimal(DATE_REG, DATE_MASK, DATE10_MASK);
+	return rtcc_block_write(mem_address, data, 1);
 }
 
-unsigned int rtcc_get_month()
+uint8_t rtcc_block_write(uint8_t start_address, uint8_t* data, uint8_t len)
 {
-	return get_decimal(MONTH_REG, MONTH_MASK, MONTH10_MASK);
+	twi_trans_t trans;
+	
+	trans.callback = 0;
+	rtcc_write_prepare(&trans, start_address, data, len);
+	
+	return twi_transfer(&trans);
 }
 
-unsigned int rtcc_get_year()
+uint8_t rtcc_start_osc()
 {
-	return get_decimal(YEAR_REG, YEAR_MASK, YEAR10_MASK);
+	uint8_t ERR_CODE;
+	uint8_t data;
+	
+	ERR_CODE = rtcc_byte_read(OSCON_REG, &data);	/* Read OSCON */
+	if(ERR_CODE != TWI_SUCCESS)
+		return ERR_CODE;
+	
+	if(!((data & OSCON_MASK) >> OSCON)) {		/* Check if oscillator is on */
+		data = ST_OSC_MASK;
+		ERR_CODE = rtcc_byte_write(ST_OSC_REG, &data);	/* Start oscillator */
+		if(ERR_CODE != TWI_SUCCESS)
+			return ERR_CODE;
+	}
+	rtcc_oscon_flag = 1;						/* Set flag */
+	
+	return TWI_SUCCESS;
 }
 
-unsigned int get_decimal(uint8_t reg, uint8_t _mask, uint8_t _10_mask)
+uint8_t rtcc_get_time(rtcc_time_t* data)
 {
-	uint8_t data;
-	unsigned value;
+	uint8_t ERR_CODE;
+	uint8_t buf[RTCC_TIME_LEN];
+	rtcc_time_t time;
 	
-	rtcc_byte_read(reg, &data);
-	value = data & _mask;
-	value += ((data & _10_mask)>>4) * 10;
+	ERR_CODE = rtcc_block_read(SEC_REG, buf, RTCC_TIME_LEN);	/* SEC_REG..YEAR_REG in one transaction */
+	if(ERR_CODE != TWI_SUCCESS)
+		return ERR_CODE;
 	
-	return value;
+	if(!rtcc_decode_time(buf, &time))						/* Time never set or corrupted read */
+		return RTCC_DATA_ERROR;
+	*data = time;
+	
+	return TWI_SUCCESS;
 }
 
-void rtcc_set_time(rtcc_time_t* time)
+uint8_t rtcc_get_time_async(twi_trans_t* trans, uint8_t* buf)
 {
-	rtcc_set_seconds(&time->seconds);
-	rtcc_set_minutes(&time->minutes);
-	rtcc_set_hours(&time->hours);
-	rtcc_set_day(&time->day);
-	rtcc_set_date(&time->date);
-	rtcc_set_month(&time->month);
-	rtcc_set_year(&time->year);
+	return rtcc_read_async(trans, SEC_REG, buf, RTCC_TIME_LEN);
 }
 
-void rtcc_set_seconds(unsigned int* seconds)
+/* Clock and calendar registers, indexed by their offset from SEC_REG. The fields
+ * of rtcc_time_t are in the same order. */
+typedef struct{
+	uint8_t units;								/* Mask of the BCD units digit */
+	uint8_t tens;								/* Mask of the BCD tens digit */
+	uint8_t min;								/* Valid range */
+	uint8_t max;
+}rtcc_field_t;
+
+static const rtcc_field_t rtcc_fields[RTCC_TIME_LEN] PROGMEM = {
+	{SEC_MASK,		SEC10_MASK,		0,	59},	/* SEC_REG */
+	{MIN_MASK,		MIN10_MASK,		0,	59},	/* MIN_REG */
+	{HOUR_MASK,		HOUR10_MASK,	0,	23},	/* HOUR_REG, 24-hour format */
+	{DAY_MASK,		DAY10_MASK,		1,	7},		/* DAY_REG */
+	{DATE_MASK,		DATE10_MASK,	1,	31},	/* DATE_REG */
+	{MONTH_MASK,	MONTH10_MASK,	1,	12},	/* MONTH_REG */
+	{YEAR_MASK,		YEAR10_MASK,	0,	99}		/* YEAR_REG */
+};
+
+/**
+ * @brief Converts a decimal value (0-99) to BCD.
+ * @param value Decimal value
+ * @return Tens digit in bits 4-7, units digit in bits 0-3
+ */
+static uint8_t rtcc_to_bcd(uint8_t value)
 {
-	uint8_t data;
+	return ((value/10)<<4)|(value%10);
+}
+
+uint8_t rtcc_decode_time(const uint8_t* buf, rtcc_time_t* data)
+{
+	unsigned* field = &data->seconds;			/* Fields in register order */
+	rtcc_field_t desc;
+	uint8_t units, valid = 1;
+	
+	for(uint8_t i=0; i<RTCC_TIME_LEN; i++) {
+		memcpy_P(&desc, &rtcc_fields[i], sizeof(desc));
+		units = buf[i] & desc.units;
+		field[i] = ((buf[i] & desc.tens)>>4)*10 + units;
+		if(units > 9 || field[i] < desc.min || field[i] > desc.max)
+			valid = 0;
+	}
 	
-	if(rtcc_oscon_flag)
-		data = get_binary(seconds, SEC_MASK, SEC10_MASK)|(1<<ST_OSC);
-	else
-		data = get_binary(seconds, SEC_MASK, SEC10_MASK);
-		
-	rtcc_byte_write(SEC_REG, &data);
+	return valid;
 }
 
-void rtcc_set_minutes(unsigned int* minutes)
+uint8_t rtcc_encode_time(const rtcc_time_t* time, uint8_t* buf)
 {
-	uint8_t data;
+	const unsigned* field = &time->seconds;
+	rtcc_field_t desc;
+	uint8_t mask;
+	
+	for(uint8_t i=0; i<RTCC_TIME_LEN; i++) {
+		memcpy_P(&desc, &rtcc_fields[i], sizeof(desc));
+		if(field[i] < desc.min || field[i] > desc.max)
+			return 0;
+	}
 	
-	data = get_binary(minutes, MIN_MASK, MIN10_MASK);
-	rtcc_byte_write(MIN_REG, &data);
+	for(uint8_t i=0; i<RTCC_TIME_LEN; i++) {
+		memcpy_P(&desc, &rtcc_fields[i], sizeof(desc));
+		mask = desc.units|desc.tens;
+		if(i == HOUR_REG)
+			mask |= HOUR12_MASK;				/* 24-hour format */
+		buf[i] = (buf[i] & ~mask)|rtcc_to_bcd(field[i]);
+	}
+	
+	return 1;
 }
 
-void rtcc_set_hours(unsigned int* hours)
+/**
+ * @brief Polls OSCON until the oscillator reached the requested state.
+ * @param running OSCON_MASK to wait for the start, 0 to wait for the stop
+ * @return Error code, RTCC_OSC_TIMEOUT after RTCC_OSC_POLLS reads
+ */
+static uint8_t rtcc_wait_oscon(uint8_t running)
 {
+	uint8_t ERR_CODE;
 	uint8_t data;
 	
-	data = get_binary(hours, HOUR_MASK, HOUR10_MASK);
-	rtcc_byte_write(HOUR_REG, &data);
+	for(uint8_t i=0; i<RTCC_OSC_POLLS; i++) {
+		ERR_CODE = rtcc_byte_read(OSCON_REG, &data);
+		if(ERR_CODE != TWI_SUCCESS)
+			return ERR_CODE;
+		if((data & OSCON_MASK) == running)
+			return TWI_SUCCESS;
+		hal_delay_ms(10);
+	}
+	
+	return RTCC_OSC_TIMEOUT;
 }
 
-void rtcc_set_day(unsigned int* day)
+uint8_t rtcc_set_time(const rtcc_time_t* time)
 {
+	uint8_t ERR_CODE, restart;
+	uint8_t old[RTCC_TIME_LEN], buf[RTCC_TIME_LEN];
 	uint8_t data;
+	rtcc_time_t check;
+	
+	ERR_CODE = rtcc_block_read(SEC_REG, old, RTCC_TIME_LEN);	/* Control bits to keep */
+	if(ERR_CODE != TWI_SUCCESS)
+		return ERR_CODE;
+	memcpy(buf, old, RTCC_TIME_LEN);
+	if(!rtcc_encode_time(time, buf))
+		return RTCC_RANGE_ERROR;
+	buf[SEC_REG] &= ~ST_OSC_MASK;
+	
+	/* Stop the oscillator, the registers do not carry while they are written */
+	data = old[SEC_REG] & ~ST_OSC_MASK;
+	ERR_CODE = rtcc_byte_write(SEC_REG, &data);
+	if(ERR_CODE != TWI_SUCCESS)
+		return ERR_CODE;
+	ERR_CODE = rtcc_wait_oscon(0);
+	if(ERR_CODE == TWI_SUCCESS)
+		ERR_CODE = rtcc_block_write(SEC_REG, buf, RTCC_TIME_LEN);
+	
+	/* Restart in any case, with the old seconds if the burst failed */
+	data = (ERR_CODE == TWI_SUCCESS ? buf[SEC_REG] : old[SEC_REG])|ST_OSC_MASK;
+	restart = rtcc_byte_write(SEC_REG, &data);
+	if(ERR_CODE != TWI_SUCCESS)
+		return ERR_CODE;
+	if(restart != TWI_SUCCESS)
+		return restart;
+	ERR_CODE = rtcc_wait_oscon(OSCON_MASK);
+	if(ERR_CODE != TWI_SUCCESS)
+		return ERR_CODE;
+	rtcc_oscon_flag = 1;
+	
+	/* Verify, the first second is not over yet */
+	ERR_CODE = rtcc_get_time(&check);
+	if(ERR_CODE != TWI_SUCCESS)
+		return ERR_CODE;
+	if(memcmp(&check, time, sizeof(check)))
+		return RTCC_VERIFY_ERROR;
+	
+	return TWI_SUCCESS;
+}
+
+uint8_t rtcc_set_alarm(uint8_t alarm, unsigned int hours, unsigned int minutes)
+{
+	uint8_t ERR_CODE;
+	uint8_t data[ALM_WKDAY_OFS+1];
+	
+	data[ALM_SEC_OFS] 	= 0;
+	data[ALM_MIN_OFS] 	= rtcc_to_bcd(minutes);
+	data[ALM_HOUR_OFS] 	= rtcc_to_bcd(hours);		/* 24-hour format */
+	data[ALM_WKDAY_OFS] = ALMMSK_MIN;				/* Match minutes, MFP active low, clear flag */
+	
+	ERR_CODE = rtcc_block_write(alarm == RTCC_ALM0 ? ALM0_REG : ALM1_REG, data, sizeof(data));
+	if(ERR_CODE != TWI_SUCCESS)
+		return ERR_CODE;
+	
+	ERR_CODE = rtcc_byte_read(CTRL_REG, data);		/* Enable alarm, keep the other control bits */
+	if(ERR_CODE != TWI_SUCCESS)
+		return ERR_CODE;
+	data[0] |= alarm == RTCC_ALM0 ? (1<<ALM0) : (1<<ALM1);
 	
-	data = get_binary(day,DAY_MASK, DAY10_MASK);
-	rtcc_byte_write(DAY_REG, &data);
+	return rtcc_byte_write(CTRL_REG, data);
 }
 
-void rtcc_set_date(unsigned int* date)
+uint8_t rtcc_disable_alarm(uint8_t alarm)
 {
+	uint8_t ERR_CODE;
 	uint8_t data;
 	
-	data = get_binary(date, DATE_MASK, DATE10_MASK);
-	rtcc_byte_write(DATE_REG, &data);
+	ERR_CODE = rtcc_byte_read(CTRL_REG, &data);
+	if(ERR_CODE != TWI_SUCCESS)
+		return ERR_CODE;
+	data &= alarm == RTCC_ALM0 ? ~(1<<ALM0) : ~(1<<ALM1);
+	
+	return rtcc_byte_write(CTRL_REG, &data);
 }
 
-void rtcc_set_month(unsigned int* month)
+uint8_t rtcc_clear_alarm(uint8_t alarm)
 {
+	uint8_t reg = (alarm == RTCC_ALM0 ? ALM0_REG : ALM1_REG) + ALM_WKDAY_OFS;
 	uint8_t data;
 	
-	data = get_binary(month, MONTH_MASK, MONTH10_MASK);
-	rtcc_byte_write(MONTH_REG, &data);
+	if(rtcc_byte_read(reg, &data) != TWI_SUCCESS || !(data & (1<<ALMIF)))
+		return 0;
+	
+	data &= ~(1<<ALMIF);
+	rtcc_byte_write(reg, &data);
+	
+	return 1;
 }
 
-void rtcc_set_year(unsigned int* year)
+uint8_t rtcc_enable_sqw(uint8_t rate)
 {
+	uint8_t ERR_CODE;
 	uint8_t data;
 	
-	data = get_binary(year, YEAR_MASK, YEAR10_MASK);
-	rtcc_byte_write(YEAR_REG, &data);
+	ERR_CODE = rtcc_byte_read(CTRL_REG, &data);		/* Keep the other control bits */
+	if(ERR_CODE != TWI_SUCCESS)
+		return ERR_CODE;
+	data = (data & ~RTCC_SQW_MASK)|(1<<SQWE)|rate;
+	
+	return rtcc_byte_write(CTRL_REG, &data);
 }
 
-uint8_t get_binary(unsigned int* data, uint8_t _mask, uint8_t _10_mask)
+uint8_t rtcc_disable_sqw()
 {
-	uint8_t value;
+	uint8_t ERR_CODE;
+	uint8_t data;
 	
-	value = ((*data%10) & _mask);
-	value |= ((*data/10)<<4) & _10_mask;
+	ERR_CODE = rtcc_byte_read(CTRL_REG, &data);
+	if(ERR_CODE != TWI_SUCCESS)
+		return ERR_CODE;
+	data &= ~(1<<SQWE);
 	
-	return value;
+	return rtcc_byte_write(CTRL_REG, &data);
 }
 
 void disable_master_mode()
@@ -31,9 +31,10 @@
 #define HOUR_MASK		0x0F
 #define HOUR10_MASK		0x30
 #define HOUR24_EN_MASK	0x00
+#define HOUR12_MASK		0x40			/* 12-hour format, cleared by rtcc_set_time() */
 
 #define DAY_REG			0x03
-#define DAY_MASK		0x05
+#define DAY_MASK		0x07
 #define DAY10_MASK		0x00
 
 #define DATE_REG		0x04
@@ -61,11 +62,24 @@
 
 #define CAL_REG			0x08
 
+#define ALM0_REG		0x0A			/* First register (seconds) of alarm 0 */
+#define ALM1_REG		0x11			/* First register (seconds) of alarm 1 */
+#define ALM_SEC_OFS		0				/* Offsets of the alarm registers */
+#define ALM_MIN_OFS		1
+#define ALM_HOUR_OFS	2
+#define ALM_WKDAY_OFS	3
+#define ALMPOL			7				/* Polarity of MFP on alarm (0 -> active low) */
+#define ALMIF			3				/* Alarm interrupt flag */
+#define ALMMSK_MASK		0x70
+#define ALMMSK_SEC		0x00			/* Alarm on match of seconds */
+#define ALMMSK_MIN		0x10			/* Alarm on match of minutes */
+#define ALMMSK_HOUR		0x20			/* Alarm on match of hours */
+
 /*--------------------------------------------------------------------------------*/
 
 volatile static int rtcc_oscon_flag = 0;/* 0 if oscillator is off, 1 if oscillator is on. */
 
-typedef struct{							/* Time structure for the RTCC */
+typedef struct{							/* Time structure for the RTCC, fields in register order */
 	unsigned seconds;
 	unsigned minutes;
 	unsigned hours;
@@ -77,6 +91,23 @@ typedef struct{							/* Time structure for the RTCC */
 
 /*--------------------------------------------------------------------------------*/
 /* Declarations for the TWI */
+
+#define TWI_QUEUE_SIZE	4				/* Max. number of queued transactions (power of two) */
+#define TWI_TX_MAX		8				/* Max. number of bytes written per transaction (address + 7 registers) */
+#define TWI_PENDING		0x01			/* Status of a queued or active transaction */
+#define TWI_QUEUE_FULL	0x02			/* Returned if a transaction could not be queued */
+#define TWI_TIMEOUT		0x03			/* Status if the bus hung, it was recovered */
+#define TWI_RETRIES		2				/* Repetitions of a failed transaction by the waiting functions */
+
+typedef struct twi_trans{				/* Descriptor of one TWI transaction */
+	uint8_t sla;						/* Slave address (7 bits) */
+	uint8_t tx_buf[TWI_TX_MAX];			/* Bytes to write after SLA+W */
+	uint8_t tx_len;						/* Number of bytes to write */
+	uint8_t* rx_buf;					/* Where received bytes are stored after SLA+R */
+	uint8_t rx_len;						/* Number of bytes to read, 0 for write only */
+	void (*callback)(struct twi_trans*);/* Called from the TWI interrupt on completion (may be 0) */
+	volatile uint8_t status;			/* TWI_PENDING, TWI_SUCCESS or TWI status code on failure */
+}twi_trans_t;
  
 /**
 * @brief Initializes the TWI. SCL frequency must 
@@ -85,56 +116,29 @@ typedef struct{							/* Time structure for the RTCC */
 void twi_init(void);
 
 /**
- * @brief Sends start condition over the TWI.
- * @return Error code
- */
-uint8_t twi_tx_start(void);
-
-/**
- * @brief Sends repeated start condition over the TWI.
- * @return Error code
- */
-uint8_t twi_tx_rep_start(void);
-
-/**
- * @brief Sends stop condition over the TWI.
- * @return Error code
- */
-uint8_t twi_tx_stop(void);
-
-/**
- * @brief Sends SLA+R over the TWI.
- * @param sla_addr Slave address (7 bits)
- * @return Error code
- */
-uint8_t twi_tx_sla_r(uint8_t);
-
-/**
- * @brief Sends SLA+W over the TWI.
- * @param sla_addr Slave address (7 bits)
- * @return Error code
+ * @brief Queues a transaction. The TWI interrupt writes tx_buf, sends a repeated
+ * start and reads rx_len bytes, then sets status and calls the callback.
+ * Descriptor and rx_buf must stay valid until the transaction is finished.
+ * @param trans Transaction descriptor
+ * @return TWI_SUCCESS if queued, TWI_QUEUE_FULL otherwise
  */
-uint8_t twi_tx_sla_w(uint8_t);
+uint8_t twi_submit(twi_trans_t*);
 
 /**
- * @brief Sends one data byte over the TWI.
- * @param data Pointer where data is stored
+ * @brief Waits until a queued transaction is finished. Must not be called from an interrupt.
+ * If the bus does not progress for a watchdog period (32ms), the active transaction
+ * fails with TWI_TIMEOUT, the bus is recovered and the queue continues.
+ * @param trans Transaction descriptor
  * @return Error code
  */
-uint8_t twi_tx_data(uint8_t*);
-
-/**
- * @brief Receives data byte over the TWI.
- * @param Pointer where data should be stored
- * @return Error code
- */
-uint8_t twi_rx_data(uint8_t*);
+uint8_t twi_wait(twi_trans_t*);
 
 /*--------------------------------------------------------------------------------*/
 /* Declarations for the RTCC */
 
 /**
  * @brief Performs a random read from the internal memory of the MCP7940M.
+ * Waits for the transaction and repeats it on failure, must not be called from an interrupt.
  * @param 	mem_address	Memory address to read from
  * @param	data		Pointer where received data should be stored
  * @return 	Error code
@@ -142,134 +146,155 @@ uint8_t twi_rx_data(uint8_t*);
 uint8_t rtcc_byte_read(uint8_t, uint8_t*);
 
 /**
- * @brief Performs a byte write to the internal memory of the MCP7940M.
- * @param mem_address Memory address to write to
- * @param data Pointer where data is stored
- * @return 
- */
-uint8_t rtcc_byte_write(uint8_t, uint8_t*);
-
-/**
- * @brief Check if the internal oscillator is on. Starts it as the case may be.
- * @return Error code
+ * @brief Performs a sequential read from the internal memory of the MCP7940M.
+ * All bytes are transferred in one transaction, every byte except the last is ACKed.
+ * Waits for the transaction and repeats it on failure, must not be called from an interrupt.
+ * @param	start_address	Memory address to start reading from
+ * @param	buf				Pointer where received data should be stored
+ * @param	len				Number of bytes to read (>0)
+ * @return 	Error code
  */
-void rtcc_start_osc(void);
+uint8_t rtcc_block_read(uint8_t, uint8_t*, uint8_t);
 
-/*--------------------------------------------------------------------------------*/
 /**
- * @brief Reads the clock and calender registers.
- * @param Pointer where data should be stored.
+ * @brief Queues a sequential read from the internal memory of the MCP7940M and returns right away.
+ * @param	trans			Transaction descriptor (callback set or 0 to poll status)
+ * @param	start_address	Memory address to start reading from
+ * @param	buf				Pointer where received data should be stored
+ * @param	len				Number of bytes to read (>0)
+ * @return 	TWI_SUCCESS if queued, TWI_QUEUE_FULL otherwise
  */
-void rtcc_get_time(rtcc_time_t*);
+uint8_t rtcc_read_async(twi_trans_t*, uint8_t, uint8_t*, uint8_t);
 
 /**
- * @brief Reads register from the RTCC and returns seconds.
- * @return Seconds as decimal value (0-59)
+ * @brief Performs a byte write to the internal memory of the MCP7940M.
+ * Waits for the transaction and repeats it on failure, must not be called from an interrupt.
+ * @param mem_address Memory address to write to
+ * @param data Pointer where data is stored
+ * @return Error code
  */
-unsigned int rtcc_get_seconds(void);
+uint8_t rtcc_byte_write(uint8_t, uint8_t*);
 
 /**
- * @brief Reads register from the RTCC and returns minutes.
- * @return Minutes as decimal value (0-59)
+ * @brief Performs a sequential write to the internal memory of the MCP7940M.
+ * Waits for the transaction and repeats it on failure, must not be called from an interrupt.
+ * @param start_address Memory address to start writing to
+ * @param data Pointer where data is stored
+ * @param len Number of bytes to write (<TWI_TX_MAX)
+ * @return Error code
  */
-unsigned int rtcc_get_minutes(void);
+uint8_t rtcc_block_write(uint8_t, uint8_t*, uint8_t);
 
 /**
- * @brief Reads register from the RTCC and returns hours.
- * @return Hours as decimal value (0-59)
+ * @brief Check if the internal oscillator is on. Starts it as the case may be.
+ * @return Error code
  */
-unsigned int rtcc_get_hours(void);
+uint8_t rtcc_start_osc(void);
 
-/**
- * @brief Reads register from the RTCC and returns the day.
- * @return Day as decimal value (1-7)
- */
-unsigned int rtcc_get_day(void);
+/*--------------------------------------------------------------------------------*/
+#define RTCC_TIME_LEN	7				/* Number of clock and calendar registers (SEC_REG..YEAR_REG) */
+#define RTCC_VERIFY_ERROR	0x04		/* Error code if the time read back differs */
+#define RTCC_OSC_TIMEOUT	0x05		/* Error code if OSCON did not follow ST_OSC */
+#define RTCC_OSC_POLLS		100			/* Reads of OSCON, 10ms apart */
+#define RTCC_RANGE_ERROR	0x06		/* Error code if a field of the time is out of range */
+#define RTCC_DATA_ERROR		0x07		/* Error code if the registers hold no valid time */
 
 /**
- * @brief Reads register from the RTCC and returns the date.
- * @return Date as decimal value (1-31)
+ * @brief Reads the clock and calender registers in one burst, so that
+ * a carry between the registers can not tear the timestamp.
+ * @param Pointer where data should be stored, unchanged on failure.
+ * @return Error code, RTCC_DATA_ERROR if a field is no valid BCD within its range
  */
-unsigned int rtcc_get_date(void);
+uint8_t rtcc_get_time(rtcc_time_t*);
 
 /**
- * @brief Reads register from the RTCC and returns the month.
- * @return Month as decimal value (1-12)
+ * @brief Queues a burst read of the clock and calender registers and returns right away.
+ * @param trans Transaction descriptor (callback set or 0 to poll status)
+ * @param buf Buffer of RTCC_TIME_LEN bytes, decode with rtcc_decode_time()
+ * @return TWI_SUCCESS if queued, TWI_QUEUE_FULL otherwise
  */
-unsigned int rtcc_get_month(void);
+uint8_t rtcc_get_time_async(twi_trans_t*, uint8_t*);
 
 /**
- * @brief Reads register from the RTCC and returns the year.
- * @return Year as decimal value (0-99)
+ * @brief Decodes the clock and calender registers from BCD, all fields in one pass.
+ * @param buf Register values SEC_REG..YEAR_REG
+ * @param data Pointer where data should be stored, also if invalid.
+ * @return 1 if every field is valid BCD within its range, 0 otherwise
  */
-unsigned int rtcc_get_year(void);
+uint8_t rtcc_decode_time(const uint8_t*, rtcc_time_t*);
 
 /**
- * @brief Reads from register of the RTCC, combines two hex values and returns decimal.
- * @param reg Register to read from
- * @param _mask Mask for the first byte (contains MSB)
- * @param _10_mask Mask for second byte
- * @return Masked register value in decimal
+ * @brief Encodes the time into the clock and calender registers. The bits
+ * which are no time fields (ST_OSC, OSCON, VBATEN, LP) are taken from the current values.
+ * @param time Time to encode (24-hour format)
+ * @param buf Current register values SEC_REG..YEAR_REG, overwritten with the new values
+ * @return 1 on success, 0 if a field is out of range (buf unchanged)
  */
-unsigned int get_decimal(uint8_t, uint8_t, uint8_t);
+uint8_t rtcc_encode_time(const rtcc_time_t*, uint8_t*);
 
 /*--------------------------------------------------------------------------------*/
 /**
- * @brief Writes the time to the RTCC registers.
+ * @brief Sets the time without a carry between the registers: the oscillator is
+ * stopped, SEC_REG..YEAR_REG are written in one burst and the oscillator is
+ * restarted, then the registers are read back. The second starts with the restart.
+ * Control bits in the time registers are kept.
  * @param time Time to be set
+ * @return Error code, RTCC_RANGE_ERROR, RTCC_OSC_TIMEOUT or RTCC_VERIFY_ERROR
  */
-void rtcc_set_time(rtcc_time_t*);
+uint8_t rtcc_set_time(const rtcc_time_t*);
 
-/**
- * @brief Writes the seconds to the appropriate register.
- * @param seconds Seconds to be set
- */
-void rtcc_set_seconds(unsigned int*);
+/*--------------------------------------------------------------------------------*/
+/* Declarations for the alarms (MFP is active low, open drain) */
 
-/**
- * @brief Writes the minutes to the appropriate register.
- * @param minutes Minutes to be set
- */
-void rtcc_set_minutes(unsigned int*);
+#define RTCC_ALM0		0
+#define RTCC_ALM1		1
 
 /**
- * @brief Writes the hours to the appropriate register.
- * @param hours Hours to be set
+ * @brief Sets an alarm on hours and minutes and enables it. The MCP7940M can
+ * only match minutes alone, so the alarm fires every hour at the given minute.
+ * The hours are stored in the alarm register, compare them with the time on wake-up.
+ * @param alarm RTCC_ALM0 or RTCC_ALM1
+ * @param hours Hours (0-23)
+ * @param minutes Minutes (0-59)
+ * @return Error code
  */
-void rtcc_set_hours(unsigned int*);
+uint8_t rtcc_set_alarm(uint8_t, unsigned int, unsigned int);
 
 /**
- * @brief Writes the day to the appropriate register.
- * @param day Day to be set
+ * @brief Disables an alarm.
+ * @param alarm RTCC_ALM0 or RTCC_ALM1
+ * @return Error code
  */
-void rtcc_set_day(unsigned int*);
+uint8_t rtcc_disable_alarm(uint8_t);
 
 /**
- * @brief Writes the date to the appropriate register.
- * @param date Date to be set
+ * @brief Checks and clears the interrupt flag of an alarm, which releases MFP.
+ * @param alarm RTCC_ALM0 or RTCC_ALM1
+ * @return 1 if the alarm fired, 0 otherwise
  */
-void rtcc_set_date(unsigned int*);
+uint8_t rtcc_clear_alarm(uint8_t);
 
-/**
- * @brief Writes the month to the appropriate register.
- * @param month Month to be set
- */
-void rtcc_set_month(unsigned int*);
+/*--------------------------------------------------------------------------------*/
+/* Declarations for the square wave output on MFP (overrides the alarm output) */
+
+#define RTCC_SQW_1HZ	0x00			/* Values for RS1:0 */
+#define RTCC_SQW_4KHZ	0x01
+#define RTCC_SQW_8KHZ	0x02
+#define RTCC_SQW_32KHZ	0x03
+#define RTCC_SQW_MASK	((1<<SQWE)|(1<<RS2)|(1<<RS1)|(1<<RS0))
 
 /**
- * @brief Writes the year to the appropriate register.
- * @param year Year to be set
+ * @brief Enables the square wave output on MFP.
+ * @param rate RTCC_SQW_1HZ to RTCC_SQW_32KHZ
+ * @return Error code
  */
-void rtcc_set_year(unsigned int*);
+uint8_t rtcc_enable_sqw(uint8_t);
 
 /**
- * @brief Takes an integer and returns the masked binary value appropriate to the registers of the RTCC.
- * @param data Integer value
- * @param _mask Mask for bits 0-3
- * @param _10_mask Mask for bits 4-7
- * @return Binary value
+ * @brief Disables the square wave output on MFP.
+ * @return Error code
  */
-uint8_t get_binary(unsigned int*, uint8_t, uint8_t);
+uint8_t rtcc_disable_sqw(void);
 
 /**
  * @brief Disables master mode of the MCU
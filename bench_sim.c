@@ -0,0 +1,500 @@
+/* Host-side benchmark of the firmware in simavr.
+ * Built and run by "make bench", writes a text report to stdout which can be
+ * compared between commits. The run is deterministic, there is no hardware involved.
+ *
+ * The simulation provides the MCP7940M on the TWI (registers, oscillator, 1Hz
+ * square wave on MFP, alarms are not matched) and types the given shell
+ * commands into the softuart RX pin.
+ * It measures
+ * - per interrupt vector: calls, cycles from entry to reti and the maximum latency
+ *   from the interrupt flag to the entry,
+ * - per given function: calls, cycles per call, busy-waiting (awake outside of
+ *   interrupts while inside the function) and the TWI bus time per call,
+ * - the share of the time the CPU is awake.
+ *
+ * Usage: bench_sim [-m mcu] [-F Hz] [-s seconds] [-p ppm] [-c "cmd;cmd"]
+ *                  [-w name=addr:size]... firmware.elf
+ * addr and size are hex as printed by avr-nm -S.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_irq.h"
+#include "sim_interrupts.h"
+#include "sim_cycle_timers.h"
+#include "avr_ioport.h"
+#include "avr_twi.h"
+
+#define BENCH_VECTORS		26				/* ATmega48/88/168/328 */
+#define BENCH_FUNCS			8
+#define BENCH_BAUD			9600			/* softuart.h */
+#define BENCH_CMD_START		1				/* Second of the first command */
+
+#define RTCC_ADDR			0xDE			/* SLA+W of the MCP7940M */
+#define RTCC_REGS			0x60
+#define RTCC_ST				0x80			/* RTCSEC: oscillator enabled */
+#define RTCC_OSCON			0x20			/* RTCWKDAY: oscillator running */
+#define RTCC_CONTROL		0x07
+#define RTCC_SQWEN			0x40
+#define RTCC_OUT			0x80
+#define RTCC_ALMEN			0x30			/* ALM0EN | ALM1EN */
+
+static const char* bench_vector_names[BENCH_VECTORS] = {
+	"RESET", "INT0", "INT1", "PCINT0", "PCINT1", "PCINT2", "WDT",
+	"TIMER2_COMPA", "TIMER2_COMPB", "TIMER2_OVF", "TIMER1_CAPT", "TIMER1_COMPA",
+	"TIMER1_COMPB", "TIMER1_OVF", "TIMER0_COMPA", "TIMER0_COMPB", "TIMER0_OVF",
+	"SPI_STC", "USART_RX", "USART_UDRE", "USART_TX", "ADC", "EE_READY",
+	"ANALOG_COMP", "TWI", "SPM_READY"
+};
+
+typedef struct {
+	uint32_t count;
+	uint64_t cycles;
+	uint32_t max;
+	uint32_t latency;						/* Max. cycles from pending to running */
+	avr_cycle_count_t pending;				/* 0 if not pending */
+	avr_cycle_count_t entry;
+} bench_vector_t;
+
+typedef struct {
+	char name[32];
+	uint32_t start;							/* Byte address */
+	uint16_t sp;							/* Stack pointer at the entry, 0 if not active */
+	avr_cycle_count_t entry;
+	uint64_t bus_entry;						/* TWI counters at the entry */
+	uint32_t bytes_entry;
+	uint32_t calls;
+	uint64_t cycles;
+	uint32_t max;
+	uint64_t busy;							/* Awake outside interrupts */
+	uint64_t bus;							/* TWI bus cycles */
+	uint32_t bytes;
+} bench_func_t;
+
+typedef struct {
+	uint8_t regs[RTCC_REGS];
+	uint8_t selected;
+	uint8_t pointer_set;					/* Register pointer written in this transaction */
+	uint8_t ptr;
+	uint8_t sqw;							/* Level of the square wave */
+	avr_irq_t* irq;
+} bench_rtcc_t;
+
+static avr_t* avr;
+static uint32_t frequency = 16000000;
+static bench_vector_t vectors[BENCH_VECTORS];
+static bench_func_t funcs[BENCH_FUNCS];
+static int func_count;
+static int isr_depth;
+static bench_rtcc_t rtcc;
+static double rtcc_ppm;						/* Deviation of the simulated crystal */
+
+/* TWI bus, one transaction lasts from START to STOP */
+static avr_cycle_count_t bus_start;			/* 0 if idle */
+static uint64_t bus_cycles;
+static uint32_t bus_bytes;
+static uint32_t bus_transactions;
+
+/* Shell commands typed into the softuart */
+static char* uart_text;
+static size_t uart_pos;
+static int uart_bit;						/* 0 start bit, 1-8 data, 9 stop bit */
+static avr_cycle_count_t uart_frame;		/* Cycle of the start bit */
+static avr_irq_t* uart_rx;
+
+static uint8_t bcd_inc(uint8_t bcd, uint8_t limit, uint8_t* carry)
+{
+	uint8_t value = (bcd >> 4)*10 + (bcd & 0x0F) + 1;
+
+	*carry = value >= limit;
+	if(*carry)
+		value = 0;
+	return ((value/10) << 4) | (value%10);
+}
+
+/**
+ * @brief Advances the time of the RTCC by one second, only seconds to hours are carried.
+ */
+static void rtcc_tick(void)
+{
+	uint8_t* r = rtcc.regs;
+	uint8_t carry;
+
+	if(!(r[0] & RTCC_ST))
+		return;
+	r[0] = RTCC_ST | bcd_inc(r[0] & 0x7F, 60, &carry);
+	if(carry) {
+		r[1] = bcd_inc(r[1] & 0x7F, 60, &carry);
+		if(carry)
+			r[2] = (r[2] & 0x40) | bcd_inc(r[2] & 0x3F, 24, &carry);
+	}
+}
+
+/**
+ * @brief Half period of the square wave, the second of the RTCC starts with the falling edge.
+ */
+static avr_cycle_count_t rtcc_timer(avr_t* avr, avr_cycle_count_t when, void* param)
+{
+	uint8_t control = rtcc.regs[RTCC_CONTROL];
+	avr_irq_t* mfp = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('D'), 2);
+
+	rtcc.sqw = !rtcc.sqw;
+	if(!rtcc.sqw)
+		rtcc_tick();
+
+	if(control & RTCC_SQWEN)
+		avr_raise_irq(mfp, rtcc.sqw);
+	else if(control & RTCC_ALMEN)					/* Alarms are never matched */
+		avr_raise_irq(mfp, 1);
+	else
+		avr_raise_irq(mfp, !!(control & RTCC_OUT));
+
+	return when + (avr_cycle_count_t)(frequency/2/(1 + rtcc_ppm*1e-6));
+}
+
+/**
+ * @brief TWI slave of the MCP7940M, answers the messages of the simulated TWI master.
+ */
+static void rtcc_twi_hook(avr_irq_t* irq, uint32_t value, void* param)
+{
+	avr_twi_msg_irq_t v;
+
+	v.u.v = value;
+
+	if(v.u.twi.msg & TWI_COND_STOP) {
+		rtcc.selected = 0;
+		if(bus_start) {
+			bus_cycles += avr->cycle - bus_start;
+			bus_start = 0;
+		}
+	}
+	if(v.u.twi.msg & TWI_COND_START) {
+		rtcc.selected = 0;
+		rtcc.pointer_set = 0;
+		if(!bus_start) {
+			bus_start = avr->cycle;
+			bus_transactions++;
+		}
+		bus_bytes++;								/* SLA+R/W */
+		if((v.u.twi.addr & 0xFE) == RTCC_ADDR) {
+			rtcc.selected = v.u.twi.addr;
+			avr_raise_irq(rtcc.irq + TWI_IRQ_INPUT, avr_twi_irq_msg(TWI_COND_ACK, rtcc.selected, 1));
+		}
+	}
+	if(!rtcc.selected)
+		return;
+
+	if(v.u.twi.msg & TWI_COND_WRITE) {
+		bus_bytes++;
+		avr_raise_irq(rtcc.irq + TWI_IRQ_INPUT, avr_twi_irq_msg(TWI_COND_ACK, rtcc.selected, 1));
+		if(!rtcc.pointer_set) {
+			rtcc.ptr = v.u.twi.data % RTCC_REGS;
+			rtcc.pointer_set = 1;
+		}
+		else {
+			rtcc.regs[rtcc.ptr] = v.u.twi.data;
+			if(rtcc.ptr == 3)						/* OSCON is read-only */
+				rtcc.regs[3] = (rtcc.regs[3] & ~RTCC_OSCON) | (rtcc.regs[0] & RTCC_ST ? RTCC_OSCON : 0);
+			rtcc.ptr = (rtcc.ptr + 1) % RTCC_REGS;
+		}
+	}
+	if(v.u.twi.msg & TWI_COND_READ) {
+		bus_bytes++;
+		if(rtcc.ptr == 3)
+			rtcc.regs[3] = (rtcc.regs[3] & ~RTCC_OSCON) | (rtcc.regs[0] & RTCC_ST ? RTCC_OSCON : 0);
+		avr_raise_irq(rtcc.irq + TWI_IRQ_INPUT, avr_twi_irq_msg(TWI_COND_READ, rtcc.selected, rtcc.regs[rtcc.ptr]));
+		rtcc.ptr = (rtcc.ptr + 1) % RTCC_REGS;
+	}
+}
+
+static void rtcc_init(void)
+{
+	static const char* names[2] = {"8<rtcc.in", "32>rtcc.out"};
+
+	memset(rtcc.regs, 0, sizeof(rtcc.regs));
+	rtcc.regs[3] = 0x01;							/* Monday, 1.1.00 */
+	rtcc.regs[4] = 0x01;
+	rtcc.regs[5] = 0x01;
+	rtcc.regs[RTCC_CONTROL] = RTCC_OUT;
+
+	rtcc.irq = avr_alloc_irq(&avr->irq_pool, 0, 2, names);
+	avr_irq_register_notify(rtcc.irq + TWI_IRQ_OUTPUT, rtcc_twi_hook, NULL);
+	avr_connect_irq(rtcc.irq + TWI_IRQ_INPUT, avr_io_getirq(avr, AVR_IOCTL_TWI_GETIRQ(0), TWI_IRQ_INPUT));
+	avr_connect_irq(avr_io_getirq(avr, AVR_IOCTL_TWI_GETIRQ(0), TWI_IRQ_OUTPUT), rtcc.irq + TWI_IRQ_OUTPUT);
+
+	avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('D'), 2), 1);
+	avr_cycle_timer_register(avr, frequency/2, rtcc_timer, NULL);
+}
+
+/**
+ * @brief Sends the next bit of the shell commands, one command per second.
+ */
+static avr_cycle_count_t uart_timer(avr_t* avr, avr_cycle_count_t when, void* param)
+{
+	uint8_t ch = uart_text[uart_pos];
+	int level;
+
+	if(uart_bit == 0) {
+		uart_frame = when;
+		level = 0;
+	}
+	else if(uart_bit <= 8)
+		level = (ch >> (uart_bit - 1)) & 1;
+	else
+		level = 1;
+	avr_raise_irq(uart_rx, level);
+
+	if(++uart_bit <= 9)
+		return uart_frame + (avr_cycle_count_t)uart_bit*frequency/BENCH_BAUD;
+
+	/* Stop bit is out, next character or the next command a second later */
+	uart_bit = 0;
+	if(!uart_text[++uart_pos])
+		return 0;
+	if(ch == '\r')
+		return (when/frequency + 1)*frequency;
+	return uart_frame + (avr_cycle_count_t)10*frequency/BENCH_BAUD;
+}
+
+static void uart_init(const char* cmds)
+{
+	size_t len = strlen(cmds);
+
+	uart_rx = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('D'), 0);
+	avr_raise_irq(uart_rx, 1);						/* Idle */
+	if(!len)
+		return;
+
+	uart_text = malloc(len + 2);
+	for(size_t i=0; i<len; i++)
+		uart_text[i] = cmds[i] == ';' ? '\r' : cmds[i];
+	uart_text[len] = '\r';
+	uart_text[len + 1] = 0;
+	avr_cycle_timer_register(avr, (avr_cycle_count_t)BENCH_CMD_START*frequency, uart_timer, NULL);
+}
+
+static void pending_hook(avr_irq_t* irq, uint32_t value, void* param)
+{
+	bench_vector_t* v = param;
+
+	if(value && !v->pending)
+		v->pending = avr->cycle;
+}
+
+static void running_hook(avr_irq_t* irq, uint32_t value, void* param)
+{
+	bench_vector_t* v = param;
+	uint32_t cycles;
+
+	if(value) {										/* Entry */
+		if(v->pending && avr->cycle - v->pending > v->latency)
+			v->latency = avr->cycle - v->pending;
+		v->pending = 0;
+		v->entry = avr->cycle;
+		isr_depth++;
+	}
+	else {											/* reti */
+		cycles = avr->cycle - v->entry;
+		v->count++;
+		v->cycles += cycles;
+		if(cycles > v->max)
+			v->max = cycles;
+		if(isr_depth)
+			isr_depth--;
+	}
+}
+
+static void vectors_init(void)
+{
+	for(int i=1; i<BENCH_VECTORS; i++) {
+		avr_irq_t* irq = avr_get_interrupt_irq(avr, i);
+
+		if(!irq)
+			continue;
+		avr_irq_register_notify(irq + AVR_INT_IRQ_PENDING, pending_hook, &vectors[i]);
+		avr_irq_register_notify(irq + AVR_INT_IRQ_RUNNING, running_hook, &vectors[i]);
+	}
+}
+
+static int func_add(const char* arg)
+{
+	bench_func_t* f = &funcs[func_count];
+	const char* eq = strchr(arg, '=');
+	char* end;
+
+	if(!eq || eq == arg || eq - arg >= (int)sizeof(f->name) || func_count == BENCH_FUNCS)
+		return 0;
+	memcpy(f->name, arg, eq - arg);
+	f->name[eq - arg] = 0;
+	f->start = strtoul(eq + 1, &end, 16);
+	if(end == eq + 1 || *end != ':') {				/* Not in the ELF */
+		fprintf(stderr, "%s not found, skipped\n", f->name);
+		return 1;
+	}
+	func_count++;
+	return 1;
+}
+
+static uint16_t sp_get(void)
+{
+	return avr->data[R_SPL] | (avr->data[R_SPH] << 8);
+}
+
+/**
+ * @brief Tracks the entries and returns of the functions and the cycles of the last step.
+ * A function has returned once the stack pointer is above the one at its entry.
+ */
+static void funcs_step(avr_cycle_count_t cycles, int awake, int in_isr)
+{
+	uint16_t sp = sp_get();
+
+	for(int i=0; i<func_count; i++) {
+		bench_func_t* f = &funcs[i];
+
+		if(f->sp) {
+			if(awake && !in_isr)
+				f->busy += cycles;
+			if(sp > f->sp) {
+				uint32_t total = avr->cycle - f->entry;
+
+				f->calls++;
+				f->cycles += total;
+				if(total > f->max)
+					f->max = total;
+				f->bus += bus_cycles + (bus_start ? avr->cycle - bus_start : 0) - f->bus_entry;
+				f->bytes += bus_bytes - f->bytes_entry;
+				f->sp = 0;
+			}
+		}
+		else if(avr->pc == f->start) {
+			f->sp = sp;
+			f->entry = avr->cycle;
+			f->bus_entry = bus_cycles + (bus_start ? avr->cycle - bus_start : 0);
+			f->bytes_entry = bus_bytes;
+		}
+	}
+}
+
+/**
+ * @brief Sleeping only advances the cycle counter, no real time passes.
+ */
+static void bench_sleep(avr_t* avr, avr_cycle_count_t howlong)
+{
+}
+
+static double percent(uint64_t part, uint64_t total)
+{
+	return total ? 100.0*part/total : 0;
+}
+
+static double usec(uint64_t cycles)
+{
+	return 1e6*cycles/frequency;
+}
+
+static void report(const char* elf, uint32_t seconds, uint64_t awake, uint64_t total)
+{
+	printf("Benchmark of %s, %u s at %u Hz, RTCC %+.1f ppm\n\n", elf, seconds, frequency, rtcc_ppm);
+	printf("CPU awake: %llu cycles, %.3f %%\n\n", (unsigned long long)awake, percent(awake, total));
+
+	printf("%-14s %8s %12s %8s %8s %12s\n", "Interrupt", "calls", "cycles", "avg", "max", "max latency");
+	for(int i=1; i<BENCH_VECTORS; i++) {
+		bench_vector_t* v = &vectors[i];
+
+		if(!v->count)
+			continue;
+		printf("%-14s %8u %12llu %8llu %8u %12u\n", bench_vector_names[i], v->count,
+			(unsigned long long)v->cycles, (unsigned long long)(v->cycles/v->count), v->max, v->latency);
+	}
+
+	printf("\n%-18s %6s %10s %10s %8s %10s %10s\n", "Function", "calls", "avg", "max",
+		"busy %", "TWI bytes", "TWI us");
+	for(int i=0; i<func_count; i++) {
+		bench_func_t* f = &funcs[i];
+		uint32_t calls = f->calls ? f->calls : 1;
+
+		printf("%-18s %6u %10llu %10u %8.3f %10.1f %10.1f\n", f->name, f->calls,
+			(unsigned long long)(f->cycles/calls), f->max, percent(f->busy, total),
+			(double)f->bytes/calls, usec(f->bus)/calls);
+	}
+
+	printf("\nTWI: %u transactions, %u bytes, bus busy %.1f us\n",
+		bus_transactions, bus_bytes, usec(bus_cycles));
+}
+
+int main(int argc, char** argv)
+{
+	const char* mcu = "atmega168";
+	const char* cmds = "";
+	uint32_t seconds = 10;
+	elf_firmware_t firmware;
+	uint64_t end, awake = 0;
+	int opt, state;
+
+	while((opt = getopt(argc, argv, "m:F:s:p:c:w:")) != -1) {
+		switch(opt) {
+			case 'm': mcu = optarg; break;
+			case 'F': frequency = strtoul(optarg, NULL, 0); break;
+			case 's': seconds = strtoul(optarg, NULL, 0); break;
+			case 'p': rtcc_ppm = atof(optarg); break;
+			case 'c': cmds = optarg; break;
+			case 'w':
+				if(func_add(optarg))
+					break;
+				/* fall through */
+			default:
+				fprintf(stderr, "Usage: %s [-m mcu] [-F Hz] [-s seconds] [-p ppm] [-c \"cmd;cmd\"] "
+					"[-w name=addr:size]... firmware.elf\n", argv[0]);
+				return 1;
+		}
+	}
+	if(optind != argc - 1 || !frequency)
+		return fprintf(stderr, "Usage: %s [options] firmware.elf\n", argv[0]), 1;
+
+	memset(&firmware, 0, sizeof(firmware));
+	if(elf_read_firmware(argv[optind], &firmware)) {
+		fprintf(stderr, "Can not read %s!\n", argv[optind]);
+		return 1;
+	}
+	avr = avr_make_mcu_by_name(mcu);
+	if(!avr) {
+		fprintf(stderr, "Unknown MCU %s!\n", mcu);
+		return 1;
+	}
+	avr_init(avr);
+	avr_load_firmware(avr, &firmware);
+	avr->frequency = frequency;
+	avr->log = LOG_NONE;
+	avr->sleep = bench_sleep;
+
+	vectors_init();
+	rtcc_init();
+	uart_init(cmds);
+
+	/* Step by step, sleeping advances to the next timer event */
+	end = (uint64_t)seconds*frequency;
+	while(avr->cycle < end) {
+		avr_cycle_count_t before = avr->cycle;
+		int was_awake = avr->state == cpu_Running;
+		int in_isr = isr_depth > 0;
+
+		state = avr_run(avr);
+		if(state == cpu_Done || state == cpu_Crashed) {
+			fprintf(stderr, "Simulation stopped at cycle %llu (state %d)\n",
+				(unsigned long long)avr->cycle, state);
+			break;
+		}
+		if(was_awake)
+			awake += avr->cycle - before;
+		funcs_step(avr->cycle - before, was_awake, in_isr);
+	}
+
+	report(argv[optind], seconds, awake, avr->cycle);
+	avr_terminate(avr);
+
+	return 0;
+}
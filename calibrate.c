@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "calibrate.h"
+#include "softuart.h"
+#include "power.h"
+#include "trim.h"
+#include "hal.h"
+
+#define CALIBRATE_EE_VALID		0xA5			/* Marker of a stored calibration value */
+#if TRIM_TICKS != HAL_TIMER1_TICKS
+	#error "Timer1 does not match the calibration math!"
+#endif
+
+#define CALIBRATE_TOLERANCE		(TRIM_TICKS/256)		/* Max. deviation of one period (+-3900ppm) */
+
+static uint8_t HAL_EEMEM calibrate_ee_valid;
+static uint8_t HAL_EEMEM calibrate_ee_value;
+
+static uint8_t calibrate_minutes;				/* Requested duration, 0 if none */
+volatile static uint8_t calibrate_running;
+static uint8_t calibrate_old;					/* CAL_REG before, restored on failure */
+static uint8_t calibrate_value;					/* Result of the last calibration */
+static uint8_t calibrate_error;					/* 1 if the oscillator can not be calibrated */
+
+/* Timestamps of the square wave in counts of Timer1, written by the interrupts */
+volatile static uint32_t calibrate_periods;		/* Periods of Timer1 (seconds) */
+volatile static uint32_t calibrate_begin;		/* Periods at the start */
+volatile static uint32_t calibrate_first;		/* First edge of the measurement */
+volatile static uint32_t calibrate_last;		/* Latest edge */
+volatile static uint16_t calibrate_edges;		/* Edges since the first one */
+volatile static uint8_t calibrate_glitches;		/* Restarts of the measurement */
+
+/* Estimate, updated by calibrate_service() */
+static uint16_t calibrate_span;					/* Seconds of the RTCC between the first and the latest edge */
+static trim_t calibrate_trim;
+static uint8_t calibrate_in_range;				/* Deviation within the trim range */
+
+void calibrate_init()
+{
+	uint8_t data;
+
+	if(hal_ee_read_byte(&calibrate_ee_valid) == CALIBRATE_EE_VALID) {
+		data = hal_ee_read_byte(&calibrate_ee_value);
+		rtcc_byte_write(CAL_REG, &data);
+	}
+	else
+		calibrate_request(CALIBRATE_MINUTES);
+}
+
+void calibrate_request(uint8_t minutes)
+{
+	calibrate_minutes = minutes;
+}
+
+uint8_t calibrate_pending()
+{
+	return calibrate_minutes && !calibrate_running;
+}
+
+void calibrate_start()
+{
+	uint8_t data;
+
+	/* Measure the crystal without trimming, the time of the RTCC is kept */
+	rtcc_byte_read(CAL_REG, &calibrate_old);
+	data = 0x00;
+	rtcc_byte_write(CAL_REG, &data);
+
+	calibrate_span = 0;
+	calibrate_trim.ppm = 0;
+	calibrate_trim.uncertainty = 0;
+
+	cli();
+	calibrate_begin = calibrate_periods;
+	calibrate_edges = 0;
+	calibrate_glitches = 0;
+	calibrate_running = 1;
+	sei();
+}
+
+void calibrate_timer()
+{
+	calibrate_periods++;
+}
+
+void calibrate_edge()
+{
+	uint16_t count;
+	uint32_t stamp, period;
+
+	if(!calibrate_running)
+		return;
+
+	count = hal_timer1_count();
+	stamp = calibrate_periods;
+	if(hal_timer1_pending() && count < TRIM_TICKS/2)	/* Compare match not yet served */
+		stamp++;
+	stamp = stamp*TRIM_TICKS + count;
+
+	if(calibrate_edges) {
+		period = stamp - calibrate_last;
+		if(period < TRIM_TICKS - CALIBRATE_TOLERANCE || period > TRIM_TICKS + CALIBRATE_TOLERANCE) {
+			calibrate_edges = 0;						/* Missing or extra edge -> start over */
+			calibrate_glitches++;
+		}
+	}
+	if(!calibrate_edges)
+		calibrate_first = stamp;
+	calibrate_last = stamp;
+	calibrate_edges++;
+
+	POWER_WAKE(POWER_WAKE_RTCC);
+}
+
+uint8_t calibrate_active()
+{
+	return calibrate_running;
+}
+
+/**
+ * @brief Ends the calibration and writes the result to CAL_REG and EEPROM.
+ * @param error 1 if no estimate could be made
+ * @return CALIBRATE_DONE or CALIBRATE_FAILED
+ */
+static uint8_t calibrate_finish(uint8_t error)
+{
+	calibrate_running = 0;
+	calibrate_minutes = 0;
+
+	if(error || !calibrate_in_range) {					/* Crystal can not be calibrated */
+		calibrate_error = 1;
+		rtcc_byte_write(CAL_REG, &calibrate_old);
+		return CALIBRATE_FAILED;
+	}
+
+	calibrate_error = 0;
+	calibrate_value = calibrate_trim.cal;
+	rtcc_byte_write(CAL_REG, &calibrate_value);
+	hal_ee_update_byte(&calibrate_ee_value, calibrate_value);
+	hal_ee_update_byte(&calibrate_ee_valid, CALIBRATE_EE_VALID);
+
+	return CALIBRATE_DONE;
+}
+
+/**
+ * @brief Sends the current estimate with its interval.
+ */
+static void calibrate_print(void)
+{
+	char softuart_out[48];
+	uint32_t ppm = labs(calibrate_trim.ppm);
+
+	snprintf(softuart_out, sizeof softuart_out, "%c%lu.%lu ppm +-%u.%u after %u s\r",
+		calibrate_trim.ppm < 0 ? '-' : '+',
+		ppm/10, ppm%10,
+		calibrate_trim.uncertainty/10, calibrate_trim.uncertainty%10,
+		calibrate_span);
+	softuart_puts(softuart_out);
+}
+
+uint8_t calibrate_service()
+{
+	uint32_t first, last, elapsed;
+	uint16_t edges;
+	uint8_t glitches, timeout;
+
+	if(!calibrate_running)
+		return CALIBRATE_IDLE;
+
+	cli();
+	first = calibrate_first;
+	last = calibrate_last;
+	edges = calibrate_edges;
+	glitches = calibrate_glitches;
+	elapsed = calibrate_periods - calibrate_begin;
+	sei();
+
+	timeout = elapsed >= (uint32_t)calibrate_minutes*60;
+	if(glitches > CALIBRATE_MAX_GLITCHES)				/* No usable square wave */
+		return calibrate_finish(1);
+	if(edges < 2)
+		return timeout ? calibrate_finish(1) : CALIBRATE_IDLE;
+	if(edges - 1 == calibrate_span && !timeout)			/* No new edge */
+		return CALIBRATE_IDLE;
+
+	calibrate_span = edges - 1;
+	calibrate_in_range = trim_compute(calibrate_span, last - first, &calibrate_trim);
+
+	/* Stable once both ends of the interval give the same trim value */
+	if(timeout || (calibrate_span >= CALIBRATE_MIN_SECONDS && calibrate_trim.stable))
+		return calibrate_finish(0);
+
+	if(calibrate_span % CALIBRATE_REPORT == 0) {
+		softuart_puts("Calibrating: ");
+		calibrate_print();
+	}
+
+	return CALIBRATE_IDLE;
+}
+
+int32_t calibrate_ppm()
+{
+	return calibrate_trim.ppm;
+}
+
+void calibrate_report()
+{
+	char softuart_out[32];
+
+	if(calibrate_error)
+		softuart_puts("Crystal could not be calibrated! Deviation to much!!! ");
+	else {
+		snprintf(softuart_out, sizeof softuart_out, "Calibration value: 0x%02x; ", calibrate_value);
+		softuart_puts(softuart_out);
+	}
+	calibrate_print();
+}
@@ -0,0 +1,82 @@
+#ifndef CALIBRATE_H
+#define CALIBRATE_H
+
+#include <stdint.h>
+#include "MCP7940M.h"
+
+#define CALIBRATE_MINUTES		10				/* Default max. duration of a calibration */
+												/* The crystal at room temperature was measured to be 32766.2Hz
+												 * instead of 32768Hz. This means minus 108 cycles per minute,
+												 * which gives a calibration value of 0b10110110 */
+
+#define CALIBRATE_MIN_SECONDS	60				/* Min. duration before the estimate counts as stable */
+#define CALIBRATE_MAX_GLITCHES	8				/* Missing or extra edges until the calibration fails */
+#define CALIBRATE_REPORT		30				/* Progress is sent every 30s */
+
+#define CALIBRATE_IDLE			0				/* Results of calibrate_service() */
+#define CALIBRATE_DONE			1				/* Value written to CAL_REG and EEPROM */
+#define CALIBRATE_FAILED		2				/* Deviation too large or no square wave, CAL_REG restored */
+
+/**
+ * @brief Loads the calibration value from EEPROM into the RTCC. Requests a
+ * calibration if the EEPROM holds none (first start-up at a new place).
+ */
+void calibrate_init(void);
+
+/**
+ * @brief Requests a calibration, it is started by the application with calibrate_start().
+ * @param minutes Max. duration (1-255), it ends earlier once the estimate is stable
+ */
+void calibrate_request(uint8_t);
+
+/**
+ * @brief Checks if a calibration was requested and not yet started.
+ * @return 1 if pending, 0 otherwise
+ */
+uint8_t calibrate_pending(void);
+
+/**
+ * @brief Starts the requested calibration. Resets the calibration value of the RTCC,
+ * which keeps its time. The application has to run Timer1 at 1s (CTC, OCR1A = 15624,
+ * prescaling 1024) and the 1Hz square wave on MFP, and call calibrate_timer() and
+ * calibrate_edge() from the interrupts.
+ */
+void calibrate_start(void);
+
+/**
+ * @brief Counts the periods of Timer1. Call from its compare match interrupt.
+ */
+void calibrate_timer(void);
+
+/**
+ * @brief Timestamps a falling edge of the square wave with Timer1. Call from the
+ * pin change interrupt of MFP. Wakes the main loop with POWER_WAKE_RTCC.
+ */
+void calibrate_edge(void);
+
+/**
+ * @brief Checks if a calibration is running.
+ * @return 1 if running, 0 otherwise
+ */
+uint8_t calibrate_active(void);
+
+/**
+ * @brief Updates the estimate after new edges and sends the progress. Finishes the
+ * calibration once the estimate is stable or the max. duration elapsed: writes the
+ * value to CAL_REG and EEPROM. Call from the main loop.
+ * @return CALIBRATE_DONE or CALIBRATE_FAILED once at the end, CALIBRATE_IDLE otherwise
+ */
+uint8_t calibrate_service(void);
+
+/**
+ * @brief Returns the deviation measured by the last calibration.
+ * @return Deviation of the crystal without trimming in 0.1ppm, positive if the RTCC is slow
+ */
+int32_t calibrate_ppm(void);
+
+/**
+ * @brief Sends the result of the last calibration over UART.
+ */
+void calibrate_report(void);
+
+#endif
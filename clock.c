@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "clock.h"
+#include "softuart.h"
+
+#define CLOCK_IDLE				0xFF			/* clock_read_second without a queued read */
+
+static rtcc_time_t clock_time;					/* Software clock, advanced by clock_tick() */
+volatile static uint8_t clock_sync_due;			/* Set by clock_tick() when a check is due */
+volatile static uint8_t clock_sync_retry;		/* The last check failed, repeated every second */
+static clock_drift_t clock_drift;
+static twi_trans_t clock_read;					/* Burst read of the RTCC for the check */
+static uint8_t clock_regs[RTCC_TIME_LEN];
+static uint8_t clock_read_second = CLOCK_IDLE;	/* Software clock when the read was queued */
+
+/**
+ * @brief Returns the seconds since midnight.
+ * @param time Time
+ * @return Seconds (0-86399)
+ */
+static int32_t clock_seconds(rtcc_time_t* time)
+{
+	return (int32_t)time->hours*3600 + (int32_t)time->minutes*60 + time->seconds;
+}
+
+uint8_t clock_load()
+{
+	uint8_t ERR_CODE;
+	rtcc_time_t time;
+	
+	if(clock_read_second != CLOCK_IDLE) {		/* A queued check read an older time */
+		twi_wait(&clock_read);
+		clock_read_second = CLOCK_IDLE;
+	}
+	
+	ERR_CODE = rtcc_get_time(&time);
+	if(ERR_CODE != TWI_SUCCESS) {
+		clock_sync_due = 1;						/* Keep running, retried by clock_service() */
+		return ERR_CODE;
+	}
+	
+	cli();
+	clock_time = time;
+	clock_sync_due = 0;
+	sei();
+	
+	return TWI_SUCCESS;
+}
+
+/**
+ * @brief Advances the date by one day.
+ */
+static void clock_next_day(void)
+{
+	static const uint8_t days_in_month[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+	uint8_t last;
+	
+	if(++clock_time.day > 7)
+		clock_time.day = 1;
+	
+	if(clock_time.month < 1 || clock_time.month > 12)	/* Invalid, corrected by the next check */
+		return;
+	last = days_in_month[clock_time.month - 1];
+	if(clock_time.month == 2 && clock_time.year % 4 == 0)	/* 2000-2099 */
+		last++;
+	
+	if(++clock_time.date > last) {
+		clock_time.date = 1;
+		if(++clock_time.month > 12) {
+			clock_time.month = 1;
+			if(++clock_time.year > 99)
+				clock_time.year = 0;
+		}
+	}
+}
+
+void clock_tick()
+{
+	if(++clock_time.seconds == 60) {
+		clock_time.seconds = 0;
+		if(++clock_time.minutes == 60) {
+			clock_time.minutes = 0;
+			if(++clock_time.hours == 24) {
+				clock_time.hours = 0;
+				clock_next_day();
+			}
+		}
+	}
+	
+	/* Check in the middle of a minute, far away from any carry, a failed check every second */
+	if(clock_sync_retry || (clock_time.seconds == 30 && clock_time.minutes % CLOCK_SYNC_INTERVAL == 0))
+		clock_sync_due = 1;
+}
+
+void clock_get(rtcc_time_t* time)
+{
+	cli();
+	*time = clock_time;
+	sei();
+}
+
+uint8_t clock_sync()
+{
+	rtcc_time_t time;
+	uint8_t before;
+	int32_t diff;
+	
+	if(clock_read_second == CLOCK_IDLE) {		/* Queue the read, the main loop sleeps meanwhile */
+		cli();
+		clock_read_second = clock_time.seconds;
+		sei();
+		clock_read.callback = 0;
+		if(rtcc_get_time_async(&clock_read, clock_regs) != TWI_SUCCESS)
+			clock_read_second = CLOCK_IDLE;		/* Queue full, retried by the next clock_service() */
+		return 0;
+	}
+	
+	if(clock_read.status == TWI_PENDING)		/* Woken before the TWI interrupt finished it */
+		twi_wait(&clock_read);					/* Aborted after the watchdog period if the bus hangs */
+	before = clock_read_second;
+	clock_read_second = CLOCK_IDLE;
+	
+	if(clock_read.status != TWI_SUCCESS || !rtcc_decode_time(clock_regs, &time)) {
+		clock_sync_due = 0;						/* Repeated with the next second */
+		clock_sync_retry = 1;
+		return 0;
+	}
+	
+	cli();
+	if(clock_time.seconds != before) {			/* Ticked during the read -> not comparable, queue again */
+		sei();
+		return 0;
+	}
+	diff = clock_seconds(&time) - clock_seconds(&clock_time);
+	clock_time = time;
+	clock_sync_due = 0;
+	clock_sync_retry = 0;
+	sei();
+	
+	if(diff > 43200L)							/* Shortest way around midnight */
+		diff -= 86400L;
+	else if(diff < -43200L)
+		diff += 86400L;
+	
+	clock_drift.drift += diff;
+	clock_drift.last = diff;
+	if(labs(diff) > clock_drift.max)
+		clock_drift.max = labs(diff);
+	clock_drift.checks++;
+	
+	return 1;
+}
+
+void clock_service()
+{
+	if(clock_sync_due || clock_read_second != CLOCK_IDLE)
+		clock_sync();
+}
+
+void clock_get_drift(clock_drift_t* drift)
+{
+	*drift = clock_drift;
+}
+
+void clock_report()
+{
+	char softuart_out[80];
+	
+	sprintf(softuart_out, "Drift: last %i s, max %u s, total %li s in %u checks\r",
+		clock_drift.last,
+		clock_drift.max,
+		clock_drift.drift,
+		clock_drift.checks);
+	softuart_puts(softuart_out);
+}
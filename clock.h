@@ -0,0 +1,63 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+#include "MCP7940M.h"
+
+#define CLOCK_SYNC_INTERVAL		10				/* Minutes between two checks against the RTCC */
+
+typedef struct{									/* Deviation of the software clock from the RTCC */
+	int32_t drift;								/* Sum of all corrections (RTCC - software clock) [s] */
+	int16_t last;								/* Correction at the last check [s] */
+	uint16_t max;								/* Largest absolute correction [s] */
+	uint16_t checks;							/* Number of checks */
+}clock_drift_t;
+
+/**
+ * @brief Loads the time from the RTCC into the software clock, without counting it as drift.
+ * Use after boot or when the clock source was stopped (power-down).
+ * If the RTCC can not be read or holds no valid time, the software clock keeps running
+ * and is synchronized later.
+ * @return Error code of the TWI
+ */
+uint8_t clock_load(void);
+
+/**
+ * @brief Advances the software clock by one second, including the date.
+ * Call from the interrupt of the clock source.
+ */
+void clock_tick(void);
+
+/**
+ * @brief Copies the software clock.
+ * @param time Pointer where the time should be stored
+ */
+void clock_get(rtcc_time_t*);
+
+/**
+ * @brief Compares the software clock with a burst read of the RTCC, records the
+ * difference as drift and corrects the software clock. The first call queues the
+ * read and returns, the TWI interrupt wakes the main loop and the next call compares.
+ * @return 1 if the check was done, 0 if the read was queued, the clock ticked during
+ * the read (queued again) or the read failed (repeated with the next second)
+ */
+uint8_t clock_sync(void);
+
+/**
+ * @brief Runs the periodic check every CLOCK_SYNC_INTERVAL minutes and finishes
+ * a queued read. Call from the main loop.
+ */
+void clock_service(void);
+
+/**
+ * @brief Copies the drift statistics.
+ * @param drift Pointer where statistics should be stored
+ */
+void clock_get_drift(clock_drift_t*);
+
+/**
+ * @brief Sends the drift statistics over UART.
+ */
+void clock_report(void);
+
+#endif
@@ -0,0 +1,221 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "fade.h"
+#include "power.h"
+#include "hal.h"
+
+/* State of the fade engine, written by fade_tick() from the timer interrupt */
+volatile static uint8_t fade_level;				/* Current brightness */
+volatile static uint8_t fade_from;				/* Brightness at the start of the fade */
+volatile static uint8_t fade_target;			/* Brightness at the end of the fade */
+volatile static int8_t fade_dir;				/* +1 sunrise, -1 sunset, 0 idle */
+volatile static uint16_t fade_wait;				/* Seconds until the next step (deadline) */
+volatile static uint32_t fade_scale = 65536;		/* Factor for the step delays (16 fractional bits) */
+
+/**
+ * @brief Loads a level into the PWM. Fully on or off is driven by the port
+ * and stops Timer2, every level in between is generated by the PWM.
+ * @param level Brightness
+ */
+static void fade_apply(uint8_t level)
+{
+	if(level == FADE_LEVEL_OFF || level == FADE_LEVEL_FULL) {
+		hal_pwm_stop();
+		power_release(POWER_HOLD_PWM);
+		hal_pwm_disconnect();							/* Use PORTD */
+		if(level == FADE_LEVEL_OFF)
+			hal_gpio_clear(HAL_PIN_PWM);
+		else
+			hal_gpio_set(HAL_PIN_PWM);
+	}
+	else {
+		hal_pwm_connect(PWM_RESOLUTION - level);		/* Inverting mode */
+		hal_pwm_start();
+		power_hold(POWER_HOLD_PWM);						/* Timer2 runs from the I/O clock */
+	}
+	fade_level = level;
+}
+
+/**
+ * @brief Returns the time along the curve table to brighten from dark to a level.
+ * @param level Brightness (FADE_LEVEL_OFF to FADE_LEVEL_FULL+1)
+ * @return Time in seconds
+ */
+static uint16_t fade_curve_time(uint16_t level)
+{
+	if(level <= FADE_LEVEL_OFF+1)						/* Dark output leaves right away */
+		return 0;
+	
+	return pwm_curve_sum(PWM_RESOLUTION) - pwm_curve_sum(PWM_RESOLUTION + 1 - level);
+}
+
+/**
+ * @brief Returns the time along the curve table to fade between two levels.
+ * @param from Brightness at the start
+ * @param to Brightness at the end
+ * @return Time in seconds
+ */
+static uint16_t fade_curve_span(uint8_t from, uint8_t to)
+{
+	if(from < to)
+		return fade_curve_time(to) - fade_curve_time(from);
+	else
+		return fade_curve_time(from + 1) - fade_curve_time(to + 1);
+}
+
+/**
+ * @brief Returns the factor to stretch the curve between two levels to a duration.
+ * @param from Brightness at the start
+ * @param to Brightness at the end
+ * @param minutes Duration of the fade (0 -> curve timing)
+ * @return Factor with 16 fractional bits, the stretched span stays below 2^30
+ */
+static uint32_t fade_curve_scale(uint8_t from, uint8_t to, uint8_t minutes)
+{
+	uint16_t natural = fade_curve_span(from, to);
+	
+	if(!minutes || !natural)
+		return 65536;
+	
+	return ((uint32_t)minutes*60*65536 + natural/2) / natural;
+}
+
+/**
+ * @brief Returns the time from the start of the current fade until a level is reached.
+ * Deadlines are taken from the stretched running sum, so the rounding
+ * of the single steps does not add up.
+ * @param level Brightness between the start and the target
+ * @return Time in seconds
+ */
+static uint16_t fade_time(uint8_t level)
+{
+	return ((uint32_t)fade_curve_span(fade_from, level) * fade_scale + 32768) >> 16;
+}
+
+/**
+ * @brief Moves the output towards the target by the steps which are due now and
+ * sets the next deadline. A fade stretched to a short duration takes several steps per second.
+ */
+static void fade_step(void)
+{
+	uint16_t now = fade_time(fade_level + fade_dir);
+	uint8_t level = fade_level;
+	
+	do
+		level += fade_dir;
+	while(level != fade_target && fade_time(level + fade_dir) == now);
+	
+	fade_apply(level);
+	
+	if(fade_level == fade_target)
+		fade_dir = 0;
+	else
+		fade_wait = fade_time(fade_level + fade_dir) - now;
+}
+
+/**
+ * @brief Sets up a fade between two levels. Call with interrupts disabled.
+ * @param from Brightness at the start
+ * @param target Brightness to fade to
+ * @param minutes Duration of the fade (0 -> curve timing)
+ */
+static void fade_prepare(uint8_t from, uint8_t target, uint8_t minutes)
+{
+	fade_scale = fade_curve_scale(from, target, minutes);
+	fade_from = from;
+	fade_target = target;
+	if(target > from)
+		fade_dir = 1;
+	else if(target < from)
+		fade_dir = -1;
+	else
+		fade_dir = 0;
+}
+
+void fade_init()
+{
+	cli();
+	
+	hal_pwm_init();
+	fade_dir = 0;
+	fade_apply(FADE_LEVEL_OFF);
+
+	sei();
+}
+
+void fade_set_level(uint8_t level)
+{
+	uint8_t sreg_tmp = SREG;
+	cli();
+	
+	fade_dir = 0;
+	fade_apply(level);
+	
+	SREG = sreg_tmp;
+}
+
+void fade_start(uint8_t target, uint8_t minutes)
+{
+	uint8_t sreg_tmp = SREG;
+	cli();
+	
+	fade_prepare(fade_level, target, minutes);
+	if(fade_dir) {
+		fade_wait = fade_time(fade_level + fade_dir);
+		if(!fade_wait)									/* Dark output: take the first step right away */
+			fade_step();
+	}
+	
+	SREG = sreg_tmp;
+}
+
+void fade_resume(uint8_t from, uint8_t target, uint8_t minutes, uint32_t elapsed)
+{
+	uint8_t low, high, mid;
+	uint8_t sreg_tmp = SREG;
+	cli();
+	
+	fade_prepare(from, target, minutes);
+	if(!fade_dir || elapsed >= fade_time(target)) {		/* Fade already over */
+		fade_dir = 0;
+		fade_apply(target);
+	}
+	else {
+		/* Binary search for the last level reached, the time rises
+		 * with the distance from the start */
+		low = 0;
+		high = fade_dir > 0 ? target - from : from - target;
+		while(low < high) {
+			mid = high - (high - low) / 2;
+			if(fade_time(from + fade_dir*mid) <= elapsed)
+				low = mid;
+			else
+				high = mid - 1;
+		}
+		fade_apply(from + fade_dir*low);
+		fade_wait = fade_time(fade_level + fade_dir) - elapsed;
+	}
+	
+	SREG = sreg_tmp;
+}
+
+void fade_tick()
+{
+	if(!fade_dir)
+		return;
+	
+	if(fade_wait && --fade_wait)
+		return;
+	
+	fade_step();										/* Deadline reached -> next step */
+}
+
+uint8_t fade_get_level()
+{
+	return fade_level;
+}
+
+uint8_t fade_active()
+{
+	return fade_dir != 0;
+}
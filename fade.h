@@ -0,0 +1,57 @@
+#ifndef FADE_H
+#define FADE_H
+
+#include <stdint.h>
+#include "pwm_curve.h"
+
+#define FADE_LEVEL_OFF			0				/* Output dark */
+#define FADE_LEVEL_FULL			PWM_RESOLUTION	/* Output fully on */
+
+/**
+ * @brief Initializes Timer2 for PWM on OC2B (PD3), output dark.
+ */
+void fade_init(void);
+
+/**
+ * @brief Sets the output to a level right away and cancels a running fade.
+ * @param level Brightness (FADE_LEVEL_OFF to FADE_LEVEL_FULL)
+ */
+void fade_set_level(uint8_t);
+
+/**
+ * @brief Starts fading from the current level to the target along the curve table
+ * and returns right away. The fade is advanced by fade_tick().
+ * @param target Brightness to fade to (FADE_LEVEL_OFF to FADE_LEVEL_FULL)
+ * @param minutes Duration of the fade, the curve is stretched accordingly (0 -> curve timing)
+ */
+void fade_start(uint8_t, uint8_t);
+
+/**
+ * @brief Continues a fade which started in the past, e.g. after a power loss.
+ * The reached level is looked up from the elapsed time and set right away.
+ * @param from Brightness at the start of the fade
+ * @param target Brightness to fade to
+ * @param minutes Duration of the fade (0 -> curve timing)
+ * @param elapsed Seconds since the start of the fade
+ */
+void fade_resume(uint8_t, uint8_t, uint8_t, uint32_t);
+
+/**
+ * @brief Advances the fade by one second. Must be called once per second,
+ * normally from the interrupt of the timekeeping timer.
+ */
+void fade_tick(void);
+
+/**
+ * @brief Returns the current level of the output.
+ * @return Brightness (FADE_LEVEL_OFF to FADE_LEVEL_FULL)
+ */
+uint8_t fade_get_level(void);
+
+/**
+ * @brief Checks if a fade is in progress.
+ * @return 1 if fading, 0 otherwise
+ */
+uint8_t fade_active(void);
+
+#endif
@@ -0,0 +1,319 @@
+#ifndef HAL_H
+#define HAL_H
+
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/twi.h>
+
+/* Hardware abstraction of the ATmega168 for GPIO, timers, PWM, TWI, EEPROM, ADC and watchdog.
+ * Everything is inlined, the modules compile to the same instructions as with
+ * direct register access. The UART backends keep their own pin macros (softuart.h).
+ * With HAL_HOST the same functions drive simulated peripherals (make host-test). */
+
+/* GPIO, all used pins are on port D */
+#define HAL_PIN_MFP				(1<<PD2)		/* MFP of the RTCC (INT0, PCINT18), open drain */
+#define HAL_PIN_PWM				(1<<PD3)		/* LED driver (OC2B) */
+#define HAL_PIN_ERROR			(1<<PD6)		/* TWI error LED */
+#define HAL_PIN_LED				(1<<PD7)		/* Status LED */
+
+/* Timer1, time base of one second */
+#define HAL_TIMER1_TICKS		15625U			/* Counts per second (16MHz, prescaling 1024) */
+
+#ifdef HAL_HOST
+#include "host/hal_host.h"
+#else
+
+#include <avr/eeprom.h>
+#include <avr/wdt.h>
+#include <util/delay_basic.h>
+
+#define HAL_INLINE				static inline __attribute__((always_inline))
+
+HAL_INLINE void hal_gpio_output(uint8_t pins)
+{
+	DDRD |= pins;
+}
+
+HAL_INLINE void hal_gpio_input_pullup(uint8_t pins)
+{
+	DDRD &= ~pins;
+	PORTD |= pins;
+}
+
+HAL_INLINE void hal_gpio_set(uint8_t pins)
+{
+	PORTD |= pins;
+}
+
+HAL_INLINE void hal_gpio_clear(uint8_t pins)
+{
+	PORTD &= ~pins;
+}
+
+HAL_INLINE uint8_t hal_gpio_read(uint8_t pins)
+{
+	return PIND & pins;
+}
+
+/* Interrupts of MFP: INT0 for the alarms, PCINT18 for the square wave */
+HAL_INLINE void hal_mfp_alarm_init(void)
+{
+	EICRA &= ~((1<<ISC01)|(1<<ISC00));					/* Low level, the only INT0 sense which wakes from power-down */
+}
+
+HAL_INLINE void hal_mfp_alarm_enable(void)
+{
+	EIMSK |= (1<<INT0);
+}
+
+HAL_INLINE void hal_mfp_alarm_disable(void)
+{
+	EIMSK &= ~(1<<INT0);
+}
+
+HAL_INLINE void hal_mfp_edge_enable(void)
+{
+	PCMSK2 |= (1<<PCINT18);								/* Pin change wakes even from power-down */
+	PCICR |= (1<<PCIE2);
+}
+
+HAL_INLINE void hal_mfp_edge_disable(void)
+{
+	PCMSK2 &= ~(1<<PCINT18);
+	if(!PCMSK2)											/* The vector may be shared with RXD */
+		PCICR &= ~(1<<PCIE2);
+}
+
+/* Timer1 */
+HAL_INLINE void hal_timer1_init(void)
+{
+	TCNT1 = 0;
+	OCR1A = HAL_TIMER1_TICKS - 1;						/* Interrupt every 1s (prescaling 1024) */
+	TCCR1B = (1<<WGM12);								/* Enable CTC */
+	TIMSK1 = (1<<OCIE1A);								/* Enable interrupt on compare match OCR1A */
+}
+
+HAL_INLINE void hal_timer1_start(void)
+{
+	TCCR1B |= (1<<CS12)|(1<<CS10);						/* Start timer (prescaling 1024) */
+}
+
+HAL_INLINE void hal_timer1_stop(void)
+{
+	TCCR1B &= ~((1<<CS12)|(1<<CS10));
+}
+
+HAL_INLINE uint16_t hal_timer1_count(void)
+{
+	return TCNT1;
+}
+
+HAL_INLINE uint16_t hal_timer1_top(void)
+{
+	return OCR1A;
+}
+
+HAL_INLINE uint8_t hal_timer1_pending(void)
+{
+	return TIFR1 & (1<<OCF1A);							/* Compare match not yet served */
+}
+
+/* PWM on OC2B, Timer2 in fast PWM mode */
+HAL_INLINE void hal_pwm_init(void)
+{
+	TCCR2A = (1<<WGM21)|(1<<WGM20);						/* Fast PWM -> TOP = 0xFF */
+}
+
+HAL_INLINE void hal_pwm_start(void)
+{
+	TCCR2B = (1<<CS22)|(1<<CS21);						/* Start timer (prescaling 256 -> 244Hz) */
+}
+
+HAL_INLINE void hal_pwm_stop(void)
+{
+	TCCR2B = 0;
+}
+
+HAL_INLINE void hal_pwm_connect(uint8_t compare)
+{
+	OCR2B = compare;
+	TCCR2A |= (1<<COM2B1)|(1<<COM2B0);					/* Inverting mode -> Set OC2B on Compare Match */
+}
+
+HAL_INLINE void hal_pwm_disconnect(void)
+{
+	TCCR2A &= ~((1<<COM2B1)|(1<<COM2B0));				/* Disconnect OC2B, use PORTD */
+}
+
+HAL_INLINE uint8_t hal_pwm_async(void)
+{
+	return ASSR & (1<<AS2);								/* Timer2 runs from a watch crystal */
+}
+
+/* TWI master, interrupt driven */
+#define HAL_TWCR				((1<<TWINT)|(1<<TWEN)|(1<<TWIE))	/* Clear TWINT flag, keep TWI and its interrupt enabled */
+
+HAL_INLINE void hal_twi_init(uint8_t bitrate)
+{
+	TWBR = bitrate;										/* Division factor for SCL frequency */
+	TWCR = (1<<TWEN)|(1<<TWIE);							/* Enable TWI and its interrupt */
+}
+
+HAL_INLINE uint8_t hal_twi_status(void)
+{
+	return TW_STATUS;
+}
+
+HAL_INLINE void hal_twi_start(uint8_t stop)
+{
+	TWCR = HAL_TWCR|(1<<TWSTA)|(stop ? (1<<TWSTO) : 0);	/* Stop first if requested */
+}
+
+HAL_INLINE void hal_twi_stop(void)
+{
+	TWCR = HAL_TWCR|(1<<TWSTO);
+}
+
+HAL_INLINE void hal_twi_write(uint8_t data)
+{
+	TWDR = data;
+	TWCR = HAL_TWCR;
+}
+
+HAL_INLINE void hal_twi_read(uint8_t ack)
+{
+	TWCR = HAL_TWCR|(ack ? (1<<TWEA) : 0);				/* ACK requests more bytes */
+}
+
+HAL_INLINE uint8_t hal_twi_data(void)
+{
+	return TWDR;
+}
+
+HAL_INLINE void hal_twi_disable(void)
+{
+	TWCR = 0;											/* SDA and SCL return to port C */
+}
+
+#define HAL_TWI_SDA				(1<<PC4)
+#define HAL_TWI_SCL				(1<<PC5)
+#define HAL_TWI_HALF_BIT		27						/* Loops of 3 cycles, 5us at 16MHz -> 100kHz */
+
+/**
+ * @brief Frees a slave which holds SDA low after an aborted transfer: SCL is
+ * clocked (up to 9 times) until SDA is released, followed by a STOP condition.
+ * Both lines are driven open drain by the port, the TWI must be disabled.
+ */
+HAL_INLINE void hal_twi_recover(void)
+{
+	PORTC &= ~(HAL_TWI_SDA|HAL_TWI_SCL);				/* Low if output, released (pull-up) if input */
+	DDRC &= ~(HAL_TWI_SDA|HAL_TWI_SCL);
+	
+	for(uint8_t i=0; i<9 && !(PINC & HAL_TWI_SDA); i++) {
+		DDRC |= HAL_TWI_SCL;
+		_delay_loop_1(HAL_TWI_HALF_BIT);
+		DDRC &= ~HAL_TWI_SCL;
+		_delay_loop_1(HAL_TWI_HALF_BIT);
+	}
+	
+	/* STOP: SDA rises while SCL is high */
+	DDRC |= HAL_TWI_SCL;
+	_delay_loop_1(HAL_TWI_HALF_BIT);
+	DDRC |= HAL_TWI_SDA;
+	_delay_loop_1(HAL_TWI_HALF_BIT);
+	DDRC &= ~HAL_TWI_SCL;
+	_delay_loop_1(HAL_TWI_HALF_BIT);
+	DDRC &= ~HAL_TWI_SDA;
+	_delay_loop_1(HAL_TWI_HALF_BIT);
+}
+
+/* EEPROM */
+#define HAL_EEMEM				EEMEM
+
+HAL_INLINE uint8_t hal_ee_read_byte(const uint8_t* addr)
+{
+	return eeprom_read_byte(addr);
+}
+
+HAL_INLINE uint16_t hal_ee_read_word(const uint16_t* addr)
+{
+	return eeprom_read_word(addr);
+}
+
+HAL_INLINE void hal_ee_read_block(void* dst, const void* addr, uint16_t len)
+{
+	eeprom_read_block(dst, addr, len);
+}
+
+HAL_INLINE void hal_ee_update_byte(uint8_t* addr, uint8_t data)
+{
+	eeprom_update_byte(addr, data);
+}
+
+HAL_INLINE void hal_ee_update_word(uint16_t* addr, uint16_t data)
+{
+	eeprom_update_word(addr, data);
+}
+
+HAL_INLINE void hal_ee_update_block(const void* src, void* addr, uint16_t len)
+{
+	eeprom_update_block(src, addr, len);
+}
+
+/* ADC, internal temperature sensor */
+HAL_INLINE void hal_adc_temp_enable(void)
+{
+	ADMUX = (1<<REFS1)|(1<<REFS0)|(1<<MUX3);			/* Internal 1.1V reference, ADC8 */
+	ADCSRA = (1<<ADEN)|(1<<ADPS2)|(1<<ADPS1)|(1<<ADPS0);	/* Prescaling 128 -> 125kHz */
+}
+
+HAL_INLINE uint16_t hal_adc_convert(void)
+{
+	ADCSRA |= (1<<ADSC);
+	while(ADCSRA & (1<<ADSC));
+	return ADC;
+}
+
+HAL_INLINE void hal_adc_disable(void)
+{
+	ADCSRA = 0;
+}
+
+/* Busy delay, the interrupts keep running */
+#define HAL_DELAY_MS_LOOPS		4000					/* Loops of 4 cycles per ms at 16MHz */
+
+HAL_INLINE void hal_delay_ms(uint8_t ms)
+{
+	while(ms--)
+		_delay_loop_2(HAL_DELAY_MS_LOOPS);
+}
+
+/* Watchdog in interrupt mode as timeout (WDT_vect), never resets the MCU.
+ * Needs the WDTON fuse unprogrammed. */
+HAL_INLINE void hal_wdt_timeout_start(void)
+{
+	uint8_t sreg_tmp = SREG;
+	cli();
+	
+	wdt_reset();										/* Full period from now */
+	WDTCSR = (1<<WDCE)|(1<<WDE);						/* Timed sequence for the prescaler */
+	WDTCSR = (1<<WDIE)|(1<<WDP0);						/* Interrupt every 32ms */
+	
+	SREG = sreg_tmp;
+}
+
+HAL_INLINE void hal_wdt_timeout_stop(void)
+{
+	uint8_t sreg_tmp = SREG;
+	cli();
+	
+	WDTCSR = (1<<WDCE)|(1<<WDE);
+	WDTCSR = 0;
+	
+	SREG = sreg_tmp;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef HOST_AVR_INTERRUPT_H
+#define HOST_AVR_INTERRUPT_H
+
+#include <avr/io.h>
+
+/* Interrupts of the host build: the vectors are plain functions which
+ * host/hal_host.c calls while the I flag of SREG is set. */
+
+#define SREG_I					7
+
+/**
+ * @brief Sets the I flag and serves the pending interrupts.
+ */
+void host_sei(void);
+
+#define sei()					host_sei()
+#define cli()					(SREG &= ~(1<<SREG_I))
+
+#define ISR(vector, ...)		void vector(void); void vector(void)
+
+#endif
@@ -0,0 +1,185 @@
+#ifndef HOST_AVR_IO_H
+#define HOST_AVR_IO_H
+
+#include <stdint.h>
+
+/* Registers of the ATmega168 for the host build (make host-test). They are plain
+ * variables, defined in host/hal_host.c. The peripherals behind the HAL are simulated
+ * there, the registers which the UART backends access directly are read by the
+ * simulation of Timer0, the pin change interrupts and the serial lines. */
+
+#define _BV(bit)				(1<<(bit))
+
+#define HOST_REGISTERS(R8, R16) \
+	R8(PINB) R8(DDRB) R8(PORTB) R8(PINC) R8(DDRC) R8(PORTC) R8(PIND) R8(DDRD) R8(PORTD) \
+	R8(TIFR0) R8(TIFR1) R8(TIFR2) R8(PCIFR) R8(EIFR) R8(EIMSK) R8(GPIOR0) R8(GPIOR1) R8(GPIOR2) \
+	R8(TCCR0A) R8(TCCR0B) R8(TCNT0) R8(OCR0A) R8(OCR0B) R8(SMCR) R8(MCUSR) R8(WDTCSR) \
+	R8(PCICR) R8(EICRA) R8(PCMSK0) R8(PCMSK1) R8(PCMSK2) R8(TIMSK0) R8(TIMSK1) R8(TIMSK2) \
+	R8(ADCSRA) R8(ADMUX) R8(TCCR1A) R8(TCCR1B) R8(TCCR2A) R8(TCCR2B) R8(TCNT2) R8(OCR2A) R8(OCR2B) \
+	R8(ASSR) R8(TWBR) R8(TWSR) R8(TWDR) R8(TWCR) \
+	R8(UCSR0A) R8(UCSR0B) R8(UCSR0C) R8(UBRR0L) R8(UBRR0H) R8(UDR0) R8(SREG) \
+	R16(ADC) R16(TCNT1) R16(OCR1A)
+
+#define HOST_EXTERN8(reg)		extern volatile uint8_t reg;
+#define HOST_EXTERN16(reg)		extern volatile uint16_t reg;
+HOST_REGISTERS(HOST_EXTERN8, HOST_EXTERN16)
+
+/* Port pins */
+#define PB0		0
+#define PB1		1
+#define PB2		2
+#define PB3		3
+#define PB4		4
+#define PB5		5
+#define PB6		6
+#define PB7		7
+#define PC0		0
+#define PC1		1
+#define PC2		2
+#define PC3		3
+#define PC4		4
+#define PC5		5
+#define PC6		6
+#define PD0		0
+#define PD1		1
+#define PD2		2
+#define PD3		3
+#define PD4		4
+#define PD5		5
+#define PD6		6
+#define PD7		7
+
+/* Timer0 */
+#define WGM00	0
+#define WGM01	1
+#define COM0B0	4
+#define COM0B1	5
+#define COM0A0	6
+#define COM0A1	7
+#define CS00	0
+#define CS01	1
+#define CS02	2
+#define WGM02	3
+#define TOIE0	0
+#define OCIE0A	1
+#define OCIE0B	2
+#define TOV0	0
+#define OCF0A	1
+#define OCF0B	2
+
+/* Timer1 */
+#define CS10	0
+#define CS11	1
+#define CS12	2
+#define WGM12	3
+#define WGM13	4
+#define TOIE1	0
+#define OCIE1A	1
+#define OCIE1B	2
+#define TOV1	0
+#define OCF1A	1
+#define OCF1B	2
+
+/* Timer2 */
+#define WGM20	0
+#define WGM21	1
+#define COM2B0	4
+#define COM2B1	5
+#define COM2A0	6
+#define COM2A1	7
+#define CS20	0
+#define CS21	1
+#define CS22	2
+#define TCR2BUB	0
+#define AS2		5
+
+/* External and pin change interrupts */
+#define INT0	0
+#define INT1	1
+#define INTF0	0
+#define INTF1	1
+#define ISC00	0
+#define ISC01	1
+#define ISC10	2
+#define ISC11	3
+#define PCIE0	0
+#define PCIE1	1
+#define PCIE2	2
+#define PCIF0	0
+#define PCIF1	1
+#define PCIF2	2
+#define PCINT16	0
+#define PCINT17	1
+#define PCINT18	2
+
+/* USART0 */
+#define MPCM0	0
+#define U2X0	1
+#define UPE0	2
+#define DOR0	3
+#define FE0		4
+#define UDRE0	5
+#define TXC0	6
+#define RXC0	7
+#define TXB80	0
+#define RXB80	1
+#define UCSZ02	2
+#define TXEN0	3
+#define RXEN0	4
+#define UDRIE0	5
+#define TXCIE0	6
+#define RXCIE0	7
+#define UCPOL0	0
+#define UCSZ00	1
+#define UCSZ01	2
+#define USBS0	3
+#define UPM00	4
+#define UPM01	5
+#define UMSEL00	6
+#define UMSEL01	7
+
+/* TWI */
+#define TWIE	0
+#define TWEN	2
+#define TWWC	3
+#define TWSTO	4
+#define TWSTA	5
+#define TWEA	6
+#define TWINT	7
+#define TWPS0	0
+#define TWPS1	1
+
+/* Watchdog */
+#define WDP0	0
+#define WDP1	1
+#define WDP2	2
+#define WDE		3
+#define WDCE	4
+#define WDP3	5
+#define WDIE	6
+#define WDIF	7
+
+/* ADC */
+#define MUX0	0
+#define MUX1	1
+#define MUX2	2
+#define MUX3	3
+#define ADLAR	5
+#define REFS0	6
+#define REFS1	7
+#define ADPS0	0
+#define ADPS1	1
+#define ADPS2	2
+#define ADIE	3
+#define ADIF	4
+#define ADATE	5
+#define ADSC	6
+#define ADEN	7
+
+/* Sleep */
+#define SE		0
+#define SM0		1
+#define SM1		2
+#define SM2		3
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef HOST_AVR_PGMSPACE_H
+#define HOST_AVR_PGMSPACE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+
+/* Program memory of the host build, flash and RAM share one address space */
+
+#define PROGMEM
+#define PSTR(s)					(s)
+#define pgm_read_byte(addr)		(*(const uint8_t*)(addr))
+#define pgm_read_word(addr)		(*(const uint16_t*)(addr))
+#define memcpy_P				memcpy
+#define strcmp_P				strcmp
+#define strncmp_P				strncmp
+#define strlen_P				strlen
+#define vsnprintf_P				vsnprintf
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef HOST_AVR_SLEEP_H
+#define HOST_AVR_SLEEP_H
+
+/* Sleep modes of the host build, host/hal_host.c stops the I/O clock
+ * (Timer0, Timer1, TWI) in every mode but idle. */
+
+#define SLEEP_MODE_IDLE			0
+#define SLEEP_MODE_ADC			1
+#define SLEEP_MODE_PWR_DOWN		2
+#define SLEEP_MODE_PWR_SAVE		3
+#define SLEEP_MODE_STANDBY		6
+#define SLEEP_MODE_EXT_STANDBY	7
+
+void set_sleep_mode(uint8_t);
+
+/**
+ * @brief Marks the start of a sleep, an interrupt served from now on ends it right away.
+ */
+void sleep_enable(void);
+
+/**
+ * @brief Advances the simulated time until an interrupt was served.
+ */
+void sleep_cpu(void);
+
+#define sleep_disable()
+
+#endif
@@ -0,0 +1,1252 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <setjmp.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <util/twi.h>
+#include "hal.h"
+#include "MCP7940M.h"
+
+/* Simulated peripherals of the host build, see hal_host.h. One step of the simulation
+ * never passes more than one event (compare match, watchdog period, second of the RTCC,
+ * bit of the serial lines), the interrupts are served in between. */
+
+#define HOST_DEFINE8(reg)		volatile uint8_t reg;
+#define HOST_DEFINE16(reg)		volatile uint16_t reg;
+HOST_REGISTERS(HOST_DEFINE8, HOST_DEFINE16)
+
+/* Vectors, defined by the modules and tests which use them */
+#define HOST_VECTORS(X) \
+	X(INT0_vect) X(PCINT2_vect) X(WDT_vect) X(TIMER1_COMPA_vect) X(TIMER0_COMPA_vect) \
+	X(USART_RX_vect) X(USART_UDRE_vect) X(USART_TX_vect) X(TWI_vect)
+#define HOST_WEAK(vector)		void vector(void) __attribute__((weak));
+HOST_VECTORS(HOST_WEAK)
+
+#define HOST_RUN				0				/* Index of host_residency, as POWER_RUN */
+#define HOST_IDLE				1
+#define HOST_DEEP				2
+
+#define HOST_WDT_CYCLES			(32*HOST_CYCLES_PER_MS)		/* Watchdog period of hal_wdt_timeout_start() */
+#define HOST_EE_CYCLES			(34*HOST_CYCLES_PER_MS/10)	/* EEPROM write */
+#define HOST_ADC_CYCLES			(13*128)					/* Conversion at prescaling 128 */
+#define HOST_RECOVER_CYCLES		(100*HOST_CYCLES_PER_MS/1000)	/* 9 SCL pulses and STOP */
+#define HOST_OSC_START_CYCLES	(20*HOST_CYCLES_PER_MS)		/* ST set until OSCRUN */
+#define HOST_OSC_STOP_CYCLES	(1*HOST_CYCLES_PER_MS)		/* ST cleared until OSCRUN clears */
+#define HOST_WAKE_CYCLES		16384					/* Start-up of the crystal oscillator after power-down (16K CK) */
+#define HOST_SLEEP_MAX			(8*86400*HOST_CYCLES_PER_S)	/* Sleep without a deadline, assume a hang */
+#define HOST_RX_FRAMES			256						/* Queued characters on the RX pin */
+#define HOST_TX_CHARS			4096					/* Decoded characters from the TX pin */
+
+uint64_t host_cycles;
+uint16_t host_adc;
+uint16_t host_ee_writes;
+uint64_t host_residency[3];
+void (*host_second_hook)(void);
+host_rtcc_t host_rtcc;
+uint32_t host_uart_baud = 9600;
+
+static uint8_t host_state;						/* HOST_RUN, HOST_IDLE or HOST_DEEP */
+static uint8_t host_sleep_mode;
+static uint8_t host_in_isr;
+static uint32_t host_served;					/* Interrupts served */
+static uint32_t host_sleep_mark;				/* host_served at sleep_enable() */
+static uint64_t host_deadline = UINT64_MAX;
+static jmp_buf host_exit;
+static unsigned host_checks, host_failures;
+
+/* Timers: prescaler phase in CPU cycles, Timer0 keeps its count in TCNT0 */
+static struct{
+	uint8_t running;
+	uint16_t count;
+	uint16_t top;
+	uint16_t phase;
+	uint8_t flag;								/* OCF1A */
+}host_t1;
+static uint16_t host_t0_phase;
+static uint8_t host_t0_flag;					/* OCF0A as set by the simulation */
+static uint64_t host_wdt_phase;
+static uint8_t host_wdt_flag;
+
+/* TWI master and the bus */
+static struct{
+	uint8_t on;									/* TWEN */
+	uint8_t flag;								/* TWINT */
+	uint64_t due;								/* Cycles until TWINT, 0 if idle */
+	uint8_t status;
+	uint8_t data;
+	uint8_t owner;								/* Bus taken by a START */
+	uint8_t sla;								/* Next byte is SLA+R/W */
+	uint8_t reading;
+	uint8_t pointer_set;						/* Register pointer was written */
+	uint8_t pointer;
+	uint8_t sda_low;							/* Held by a hung slave */
+}host_twi;
+
+/* Oscillator of the RTCC */
+static uint64_t host_osc_phase;					/* Cycles into the current second */
+static uint64_t host_osc_period = HOST_CYCLES_PER_S;
+static int64_t host_osc_error;					/* Accumulated deviation in 1e-9 cycles */
+static uint64_t host_osc_delay;					/* Cycles until OSCRUN follows ST, 0 if settled */
+static uint8_t host_alarm_match[2];
+
+/* Serial lines */
+static struct{
+	uint64_t start;
+	uint32_t bit;
+	char ch;
+}host_rx[HOST_RX_FRAMES];
+static uint16_t host_rx_head, host_rx_tail;
+static uint64_t host_rx_idle;							/* RXD stays idle up to then */
+static struct{
+	uint8_t level;
+	uint8_t active;
+	uint8_t index;								/* Next bit to sample, 1-8 data, 9 stop */
+	uint8_t ch;
+	uint64_t start;
+}host_tx = {1};
+static char host_tx_buf[HOST_TX_CHARS + 1];
+static uint16_t host_tx_len;
+
+/* USART0, it passes whole characters. UDR0 is one variable for both directions: the
+ * RX interrupt must read it, each UDRE interrupt must write it once. */
+static struct{
+	uint8_t rx_full;							/* RXC0, one level of buffering */
+	uint8_t rx_status;							/* FE0 and DOR0 of the received character */
+	uint8_t tx_full;							/* Transmit buffer written, UDRE0 cleared */
+	uint8_t tx_data;
+	uint8_t tx_shift;							/* Character in the shift register */
+	uint64_t tx_due;							/* Cycles until its stop bit is out, 0 if idle */
+	uint8_t tx_flag;							/* TXC0 */
+}host_usart;
+
+
+/*--------------------------------------------------------------------------------*/
+/* Checks */
+
+int host_check(int cond, const char* format, ...)
+{
+	va_list args;
+
+	host_checks++;
+	if(!cond) {
+		host_failures++;
+		va_start(args, format);
+		printf("FAIL at %.3f s: ", (double)host_cycles/HOST_CYCLES_PER_S);
+		vprintf(format, args);
+		printf("\n");
+		va_end(args);
+	}
+
+	return cond;
+}
+
+int host_result(const char* name)
+{
+	printf("%s: %u checks, %u failed\n", name, host_checks, host_failures);
+
+	return host_failures != 0;
+}
+
+static void host_fatal(const char* message)
+{
+	printf("FATAL at %.3f s: %s\n", (double)host_cycles/HOST_CYCLES_PER_S, message);
+	exit(2);
+}
+
+
+/*--------------------------------------------------------------------------------*/
+/* MCP7940M */
+
+static uint8_t host_bcd(uint8_t value)
+{
+	return ((value/10)<<4)|(value%10);
+}
+
+static uint8_t host_dec(uint8_t bcd)
+{
+	return (bcd>>4)*10 + (bcd & 0x0F);
+}
+
+/**
+ * @brief Increments a BCD field of a register.
+ * @return 1 if it wrapped from last to first
+ */
+static uint8_t host_bcd_inc(uint8_t reg, uint8_t mask, uint8_t first, uint8_t last)
+{
+	uint8_t* r = &host_rtcc.regs[reg];
+	uint8_t value = host_dec(*r & mask);
+	uint8_t wrap = value >= last;
+
+	*r = (*r & ~mask)|host_bcd(wrap ? first : value + 1);
+
+	return wrap;
+}
+
+static uint8_t host_days_in_month(void)
+{
+	static const uint8_t days[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+	uint8_t month = host_dec(host_rtcc.regs[MONTH_REG] & 0x1F);
+
+	if(month < 1 || month > 12)
+		return 31;
+	if(month == 2 && host_dec(host_rtcc.regs[YEAR_REG]) % 4 == 0)
+		return 29;
+	return days[month - 1];
+}
+
+/**
+ * @brief Compares the time with an alarm according to its mask.
+ */
+static uint8_t host_alarm_matches(uint8_t base)
+{
+	const uint8_t* r = host_rtcc.regs;
+	const uint8_t* a = &r[base];
+	uint8_t sec = (r[SEC_REG] & 0x7F) == (a[ALM_SEC_OFS] & 0x7F);
+	uint8_t min = (r[MIN_REG] & 0x7F) == (a[ALM_MIN_OFS] & 0x7F);
+	uint8_t hour = (r[HOUR_REG] & 0x3F) == (a[ALM_HOUR_OFS] & 0x3F);
+	uint8_t day = (r[DAY_REG] & 0x07) == (a[ALM_WKDAY_OFS] & 0x07);
+	uint8_t date = (r[DATE_REG] & 0x3F) == (a[4] & 0x3F);
+
+	switch((a[ALM_WKDAY_OFS] & ALMMSK_MASK)>>4) {
+		case 0: return sec;
+		case 1: return min;
+		case 2: return hour;
+		case 3: return day;
+		case 4: return date;
+		case 7: return sec && min && hour && day && date && (r[MONTH_REG] & 0x1F) == (a[5] & 0x1F);
+		default: return 0;
+	}
+}
+
+/**
+ * @brief Length of the next second from the deviation of the crystal and CAL_REG,
+ * each trim step is 2 clocks per minute.
+ */
+static void host_osc_next_period(void)
+{
+	uint8_t cal = host_rtcc.regs[CAL_REG];
+	int64_t trim = (int64_t)(cal & 0x7F)*2000000000LL/(32768L*60);
+	int64_t ppb = host_rtcc.ppb + ((cal & 0x80) ? trim : -trim);
+	int64_t adjust;
+
+	host_osc_error += (int64_t)HOST_CYCLES_PER_S*ppb;
+	adjust = host_osc_error/1000000000LL;			/* Faster crystal -> shorter second */
+	host_osc_error -= adjust*1000000000LL;
+	host_osc_period = HOST_CYCLES_PER_S - adjust;
+}
+
+static void host_rtcc_second(void)
+{
+	uint8_t* r = host_rtcc.regs;
+
+	if(host_bcd_inc(SEC_REG, 0x7F, 0, 59) && host_bcd_inc(MIN_REG, 0x7F, 0, 59)
+		&& host_bcd_inc(HOUR_REG, 0x3F, 0, 23)) {
+		host_bcd_inc(DAY_REG, 0x07, 1, 7);
+		if(host_bcd_inc(DATE_REG, 0x3F, 1, host_days_in_month()) && host_bcd_inc(MONTH_REG, 0x1F, 1, 12))
+			host_bcd_inc(YEAR_REG, 0xFF, 0, 99);
+	}
+
+	for(uint8_t i=0; i<2; i++) {					/* The flag is set when a match begins */
+		uint8_t base = i ? ALM1_REG : ALM0_REG;
+		uint8_t match = (r[CTRL_REG] & (1<<(i ? ALM1 : ALM0))) && host_alarm_matches(base);
+
+		if(match && !host_alarm_match[i])
+			r[base + ALM_WKDAY_OFS] |= 1<<ALMIF;
+		host_alarm_match[i] = match;
+	}
+
+	host_osc_next_period();
+	if(host_second_hook) {							/* Like an interrupt, sei() serves nothing */
+		uint8_t in_isr = host_in_isr;
+		host_in_isr = 1;
+		host_second_hook();
+		host_in_isr = in_isr;
+	}
+}
+
+/**
+ * @brief Lets OSCRUN follow ST after the start-up or stop time.
+ */
+static void host_osc_follow(void)
+{
+	uint8_t st = host_rtcc.regs[SEC_REG] & ST_OSC_MASK;
+	uint8_t run = host_rtcc.regs[OSCON_REG] & OSCON_MASK;
+
+	if(!st == !run)
+		host_osc_delay = 0;
+	else if(!host_osc_delay)
+		host_osc_delay = st ? HOST_OSC_START_CYCLES : HOST_OSC_STOP_CYCLES;
+}
+
+static void host_osc_settle(void)
+{
+	host_rtcc.regs[OSCON_REG] &= ~OSCON_MASK;
+	if(host_rtcc.regs[SEC_REG] & ST_OSC_MASK) {
+		host_rtcc.regs[OSCON_REG] |= OSCON_MASK;
+		host_osc_phase = 0;							/* The second starts with the oscillator */
+		host_osc_next_period();
+	}
+}
+
+/**
+ * @brief Level of MFP: square wave (1Hz only), alarm output or OUT.
+ */
+static uint8_t host_mfp_level(void)
+{
+	const uint8_t* r = host_rtcc.regs;
+	uint8_t asserted;
+
+	if(r[CTRL_REG] & (1<<SQWE)) {
+		if((r[CTRL_REG] & 0x03) != RTCC_SQW_1HZ || !(r[OSCON_REG] & OSCON_MASK))
+			return 1;
+		return host_osc_phase >= host_osc_period/2;	/* Falls with the start of a second */
+	}
+	if(r[CTRL_REG] & ((1<<ALM0)|(1<<ALM1))) {
+		asserted = ((r[CTRL_REG] & (1<<ALM0)) && (r[ALM0_REG + ALM_WKDAY_OFS] & (1<<ALMIF)))
+			|| ((r[CTRL_REG] & (1<<ALM1)) && (r[ALM1_REG + ALM_WKDAY_OFS] & (1<<ALMIF)));
+		return !asserted == !(r[ALM0_REG + ALM_WKDAY_OFS] & (1<<ALMPOL));
+	}
+	return (r[CTRL_REG]>>OUT) & 1;
+}
+
+static uint8_t host_rtcc_read(uint8_t addr)
+{
+	return host_rtcc.regs[addr];
+}
+
+static void host_rtcc_write(uint8_t addr, uint8_t data)
+{
+	if(addr == OSCON_REG)							/* OSCRUN is read-only */
+		data = (data & ~OSCON_MASK)|(host_rtcc.regs[OSCON_REG] & OSCON_MASK);
+	host_rtcc.regs[addr] = data;
+	if(addr == SEC_REG)
+		host_osc_follow();
+}
+
+static uint8_t host_rtcc_next(uint8_t addr)
+{
+	if(addr < 0x20)									/* Registers and SRAM wrap separately */
+		return (addr + 1) & 0x1F;
+	return addr == 0x5F ? 0x20 : addr + 1;
+}
+
+void host_rtcc_set(uint8_t year, uint8_t month, uint8_t date, uint8_t day,
+	uint8_t hours, uint8_t minutes, uint8_t seconds)
+{
+	uint8_t* r = host_rtcc.regs;
+
+	r[SEC_REG] = ST_OSC_MASK|host_bcd(seconds);
+	r[MIN_REG] = host_bcd(minutes);
+	r[HOUR_REG] = host_bcd(hours);
+	r[DAY_REG] = OSCON_MASK|0x08|day;				/* VBATEN */
+	r[DATE_REG] = host_bcd(date);
+	r[MONTH_REG] = host_bcd(month)|(year % 4 == 0 ? LP_MASK : 0);
+	r[YEAR_REG] = host_bcd(year);
+	r[CTRL_REG] = 1<<OUT;
+	r[CAL_REG] = 0;
+	host_osc_delay = 0;
+	host_osc_phase = 0;
+	host_osc_error = 0;
+	host_osc_next_period();
+}
+
+uint32_t host_rtcc_seconds(void)
+{
+	const uint8_t* r = host_rtcc.regs;
+
+	return host_dec(r[HOUR_REG] & 0x3F)*3600UL + host_dec(r[MIN_REG] & 0x7F)*60 + host_dec(r[SEC_REG] & 0x7F);
+}
+
+
+/*--------------------------------------------------------------------------------*/
+/* Serial lines */
+
+/**
+ * @brief Cycles of one bit of the USART from UBRR0 and U2X0.
+ */
+static uint32_t host_usart_bit(void)
+{
+	return ((UCSR0A & (1<<U2X0)) ? 8UL : 16UL)*(((uint16_t)UBRR0H<<8 | UBRR0L) + 1);
+}
+
+/**
+ * @brief Samples a frame on RXD in the middle of the bits of the USART, a sender at
+ * another baud rate gives wrong bits or a missing stop bit.
+ * @param ch Character of the frame
+ * @param bit Cycles of one bit of the frame
+ */
+static void host_usart_receive(char ch, uint32_t bit)
+{
+	uint32_t usart = host_usart_bit();
+	uint8_t data = 0, stop = 1;
+
+	if(!(UCSR0B & (1<<RXEN0)))
+		return;
+	for(uint8_t i=1; i<=9; i++) {
+		uint32_t index = (2*i + 1)*usart/(2*bit);		/* Bit of the frame at the sample */
+		uint8_t level = index == 0 ? 0 : index <= 8 ? ((uint8_t)ch >> (index - 1)) & 1 : 1;
+
+		if(i <= 8)
+			data |= level << (i - 1);
+		else
+			stop = level;
+	}
+	if(host_usart.rx_full) {						/* Not read in time, the new one is lost */
+		host_usart.rx_status |= 1<<DOR0;
+		return;
+	}
+	UDR0 = data;
+	host_usart.rx_full = 1;
+	host_usart.rx_status = stop ? 0 : 1<<FE0;
+}
+
+/**
+ * @brief Moves the transmit buffer into the idle shift register.
+ */
+static void host_usart_load(void)
+{
+	if(!host_usart.tx_full || host_usart.tx_due)
+		return;
+	host_usart.tx_shift = host_usart.tx_data;
+	host_usart.tx_full = 0;
+	host_usart.tx_due = 10ULL*host_usart_bit();
+}
+
+/**
+ * @brief Passes the shifted character to the output after its stop bit.
+ */
+static void host_usart_sent(void)
+{
+	if(host_tx_len < HOST_TX_CHARS)
+		host_tx_buf[host_tx_len++] = host_usart.tx_shift;
+	host_usart_load();
+	if(!host_usart.tx_due)
+		host_usart.tx_flag = 1;
+}
+
+static uint8_t host_rx_level(void)
+{
+	uint64_t t;
+	uint8_t bit;
+
+	while(host_rx_head != host_rx_tail && host_cycles >= host_rx[host_rx_head].start + 10ULL*host_rx[host_rx_head].bit) {
+		host_usart_receive(host_rx[host_rx_head].ch, host_rx[host_rx_head].bit);
+		host_rx_head = (host_rx_head + 1) % HOST_RX_FRAMES;
+	}
+	if(host_rx_head == host_rx_tail || host_cycles < host_rx[host_rx_head].start)
+		return 1;
+
+	t = host_cycles - host_rx[host_rx_head].start;
+	bit = t / host_rx[host_rx_head].bit;
+	if(bit == 0)
+		return 0;										/* Start bit */
+	if(bit <= 8)
+		return (host_rx[host_rx_head].ch >> (bit - 1)) & 1;
+	return 1;											/* Stop bit */
+}
+
+void host_uart_send(const char* s, uint32_t baud)
+{
+	uint16_t last = (host_rx_tail + HOST_RX_FRAMES - 1) % HOST_RX_FRAMES;
+	uint64_t start = host_cycles;
+
+	if(host_rx_head != host_rx_tail && host_rx[last].start + 10ULL*host_rx[last].bit > start)
+		start = host_rx[last].start + 10ULL*host_rx[last].bit;
+	if(host_rx_idle > start)
+		start = host_rx_idle;
+
+	for(; *s; s++) {
+		if((host_rx_tail + 1) % HOST_RX_FRAMES == host_rx_head)
+			host_fatal("RX queue full");
+		host_rx[host_rx_tail].start = start;
+		host_rx[host_rx_tail].bit = (F_CPU + baud/2)/baud;
+		host_rx[host_rx_tail].ch = *s;
+		start += 10ULL*host_rx[host_rx_tail].bit;
+		host_rx_tail = (host_rx_tail + 1) % HOST_RX_FRAMES;
+	}
+}
+
+void host_uart_pause(uint64_t cycles)
+{
+	uint16_t last = (host_rx_tail + HOST_RX_FRAMES - 1) % HOST_RX_FRAMES;
+
+	if(host_rx_idle < host_cycles)
+		host_rx_idle = host_cycles;
+	if(host_rx_head != host_rx_tail && host_rx[last].start + 10ULL*host_rx[last].bit > host_rx_idle)
+		host_rx_idle = host_rx[last].start + 10ULL*host_rx[last].bit;
+	host_rx_idle += cycles;
+}
+
+/**
+ * @brief Samples the TX pin in the middle of the bits up to a point in time,
+ * the level was constant since the last edge.
+ */
+static void host_tx_sample(uint64_t until)
+{
+	uint32_t bit = (F_CPU + host_uart_baud/2)/host_uart_baud;
+
+	while(host_tx.active && host_tx.start + host_tx.index*(uint64_t)bit + bit/2 < until) {
+		if(host_tx.index <= 8)
+			host_tx.ch |= host_tx.level << (host_tx.index - 1);
+		else {
+			host_tx.active = 0;
+			if(host_tx.level && host_tx_len < HOST_TX_CHARS)
+				host_tx_buf[host_tx_len++] = host_tx.ch;	/* Frames without stop bit are lost */
+		}
+		host_tx.index++;
+	}
+}
+
+static void host_tx_edge(uint8_t level)
+{
+	host_tx_sample(host_cycles);
+	host_tx.level = level;
+	if(!host_tx.active && !level) {					/* Start bit */
+		host_tx.active = 1;
+		host_tx.index = 1;
+		host_tx.ch = 0;
+		host_tx.start = host_cycles;
+	}
+}
+
+const char* host_uart_output(void)
+{
+	static char out[HOST_TX_CHARS + 1];
+
+	host_tx_sample(host_cycles);
+	memcpy(out, host_tx_buf, host_tx_len);
+	out[host_tx_len] = 0;
+	host_tx_len = 0;
+
+	return out;
+}
+
+
+/*--------------------------------------------------------------------------------*/
+/* Pins, timers and interrupts */
+
+/**
+ * @brief Updates PIND from the outputs, the pull-ups, RXD and MFP, sets the pin change
+ * flag and decodes TX. Also drops flags which the firmware cleared by writing a one.
+ */
+static void host_sync(void)
+{
+	uint8_t pins, rx, tx;
+
+	if(!host_t0_flag)
+		TIFR0 &= ~(1<<OCF0A);
+	UCSR0A = (UCSR0A & ((1<<U2X0)|(1<<MPCM0)))|(host_usart.rx_full<<RXC0)|host_usart.rx_status
+		|(host_usart.tx_flag<<TXC0)|(!host_usart.tx_full<<UDRE0);
+
+	pins = PORTD;									/* Outputs and pull-ups */
+	rx = host_rx_level();
+	if(!(DDRD & (1<<PD0)))
+		pins = (pins & ~(1<<PD0))|(rx<<PD0);
+	if(!(DDRD & HAL_PIN_MFP) && !host_mfp_level())	/* Open drain */
+		pins &= ~HAL_PIN_MFP;
+	if((PIND ^ pins) & PCMSK2)
+		PCIFR |= 1<<PCIF2;
+	PIND = pins;
+
+	tx = (DDRD & (1<<PD1)) ? (PORTD>>PD1) & 1 : 1;
+	if(tx != host_tx.level)
+		host_tx_edge(tx);
+}
+
+static uint16_t host_t0_prescale(void)
+{
+	static const uint16_t prescale[8] = {0, 1, 8, 64, 256, 1024, 0, 0};
+
+	return prescale[TCCR0B & 0x07];
+}
+
+/**
+ * @brief Ticks of a timer in CTC mode until it reaches top.
+ */
+static uint32_t host_ctc_ticks(uint16_t count, uint16_t top, uint32_t max)
+{
+	if(count < top)
+		return top - count;
+	if(count == top)
+		return top + 1;
+	return max - count + 1 + top;					/* Above top, counts through max */
+}
+
+/**
+ * @brief Advances a timer in CTC mode.
+ * @return 1 if it reached top
+ */
+static uint8_t host_ctc_advance(uint16_t* count, uint16_t top, uint32_t max, uint32_t ticks)
+{
+	uint32_t ahead = host_ctc_ticks(*count, top, max);
+	uint8_t match = 0;
+
+	if(!ticks)
+		return 0;
+	if(ticks >= ahead) {
+		ticks -= ahead;
+		*count = top;
+		match = 1;
+		if(!ticks)
+			return match;
+	}
+	if(*count == top)
+		*count = (ticks - 1) % (top + 1);
+	else
+		*count = (*count + ticks) % (max + 1);
+
+	return match;
+}
+
+/**
+ * @brief Cycles until the next event of any peripheral.
+ * @return Cycles, 0 if nothing will happen
+ */
+static uint64_t host_next_event(void)
+{
+	uint64_t next = UINT64_MAX, cycles;
+	uint16_t prescale = host_t0_prescale();
+
+	#define HOST_NEXT(c)	do { cycles = (c); if(cycles < next) next = cycles; } while(0)
+
+	if(host_state != HOST_DEEP) {					/* I/O clock */
+		if(prescale)
+			HOST_NEXT(host_ctc_ticks(TCNT0, OCR0A, 0xFF)*(uint64_t)prescale - host_t0_phase);
+		if(host_t1.running)
+			HOST_NEXT(host_ctc_ticks(host_t1.count, host_t1.top, 0xFFFF)*1024ULL - host_t1.phase);
+		if(host_twi.due)
+			HOST_NEXT(host_twi.due);
+		if(host_usart.tx_due)
+			HOST_NEXT(host_usart.tx_due);
+	}
+	if(WDTCSR & (1<<WDIE))
+		HOST_NEXT(HOST_WDT_CYCLES - host_wdt_phase);
+	if(host_osc_delay)
+		HOST_NEXT(host_osc_delay);
+	if(host_rtcc.regs[OSCON_REG] & OSCON_MASK) {
+		HOST_NEXT(host_osc_period - host_osc_phase);
+		if(host_osc_phase < host_osc_period/2)
+			HOST_NEXT(host_osc_period/2 - host_osc_phase);	/* Square wave */
+	}
+	if(host_rx_head != host_rx_tail) {				/* Next bit boundary on RXD */
+		uint64_t start = host_rx[host_rx_head].start;
+		HOST_NEXT(host_cycles < start ? start - host_cycles
+			: host_rx[host_rx_head].bit - (host_cycles - start) % host_rx[host_rx_head].bit);
+	}
+	if(host_deadline != UINT64_MAX)
+		HOST_NEXT(host_deadline - host_cycles);
+
+	#undef HOST_NEXT
+
+	return next == UINT64_MAX ? 0 : next;
+}
+
+/**
+ * @brief Advances all peripherals, the step must not pass the next event.
+ */
+static void host_elapse(uint64_t cycles)
+{
+	uint16_t prescale = host_t0_prescale();
+	uint32_t ticks;
+	uint16_t count;
+
+	host_cycles += cycles;
+	host_residency[host_state] += cycles;
+
+	if(host_state != HOST_DEEP) {
+		if(prescale) {
+			ticks = (host_t0_phase + cycles)/prescale;
+			host_t0_phase = (host_t0_phase + cycles) % prescale;
+			count = TCNT0;
+			if(host_ctc_advance(&count, OCR0A, 0xFF, ticks)) {
+				host_t0_flag = 1;
+				TIFR0 |= 1<<OCF0A;
+			}
+			TCNT0 = count;
+		}
+		if(host_t1.running) {
+			ticks = (host_t1.phase + cycles)/1024;
+			host_t1.phase = (host_t1.phase + cycles) % 1024;
+			if(host_ctc_advance(&host_t1.count, host_t1.top, 0xFFFF, ticks))
+				host_t1.flag = 1;
+		}
+		if(host_twi.due) {
+			if(cycles >= host_twi.due) {
+				host_twi.due = 0;
+				host_twi.flag = 1;
+			}
+			else
+				host_twi.due -= cycles;
+		}
+		if(host_usart.tx_due) {
+			if(cycles >= host_usart.tx_due) {
+				host_usart.tx_due = 0;
+				host_usart_sent();
+			}
+			else
+				host_usart.tx_due -= cycles;
+		}
+	}
+
+	if(WDTCSR & (1<<WDIE)) {
+		host_wdt_phase += cycles;
+		if(host_wdt_phase >= HOST_WDT_CYCLES) {
+			host_wdt_phase -= HOST_WDT_CYCLES;
+			host_wdt_flag = 1;
+		}
+	}
+
+	if(host_osc_delay) {
+		if(cycles >= host_osc_delay) {
+			host_osc_delay = 0;
+			host_osc_settle();
+		}
+		else
+			host_osc_delay -= cycles;
+	}
+	else if(host_rtcc.regs[OSCON_REG] & OSCON_MASK) {
+		host_osc_phase += cycles;
+		if(host_osc_phase >= host_osc_period) {
+			host_osc_phase -= host_osc_period;
+			host_rtcc_second();
+		}
+	}
+
+	host_sync();
+
+	if(host_cycles >= host_deadline)
+		longjmp(host_exit, 1);
+}
+
+static void host_call(void (*vector)(void))
+{
+	SREG &= ~(1<<SREG_I);
+	host_in_isr = 1;
+	vector();
+	host_in_isr = 0;
+	SREG |= 1<<SREG_I;								/* reti */
+	host_served++;
+	host_sync();
+}
+
+/**
+ * @brief Serves the pending interrupt of the highest priority.
+ * @return 1 if one was pending
+ */
+static uint8_t host_serve_one(void)
+{
+	host_sync();
+
+	if((EIMSK & (1<<INT0)) && !(EICRA & ((1<<ISC01)|(1<<ISC00))) && !(PIND & HAL_PIN_MFP) && INT0_vect) {
+		host_call(INT0_vect);						/* Low level, no flag */
+		return 1;
+	}
+	if((PCIFR & (1<<PCIF2)) && (PCICR & (1<<PCIE2))) {
+		PCIFR &= ~(1<<PCIF2);
+		if(PCINT2_vect)
+			host_call(PCINT2_vect);
+		return 1;
+	}
+	if(host_wdt_flag && (WDTCSR & (1<<WDIE))) {
+		host_wdt_flag = 0;
+		if(WDT_vect)
+			host_call(WDT_vect);
+		return 1;
+	}
+	if(host_t1.flag && (TIMSK1 & (1<<OCIE1A))) {
+		host_t1.flag = 0;
+		if(TIMER1_COMPA_vect)
+			host_call(TIMER1_COMPA_vect);
+		return 1;
+	}
+	if(host_t0_flag && (TIMSK0 & (1<<OCIE0A))) {
+		host_t0_flag = 0;
+		TIFR0 &= ~(1<<OCF0A);
+		if(TIMER0_COMPA_vect)
+			host_call(TIMER0_COMPA_vect);
+		return 1;
+	}
+	if(host_usart.rx_full && (UCSR0B & (1<<RXCIE0)) && USART_RX_vect) {
+		host_call(USART_RX_vect);
+		host_usart.rx_full = 0;						/* UDR0 was read */
+		host_usart.rx_status = 0;
+		return 1;
+	}
+	if(!host_usart.tx_full && (UCSR0B & (1<<UDRIE0)) && (UCSR0B & (1<<TXEN0)) && USART_UDRE_vect) {
+		host_call(USART_UDRE_vect);
+		host_usart.tx_data = UDR0;					/* UDR0 was written */
+		host_usart.tx_full = 1;
+		host_usart_load();
+		return 1;
+	}
+	if(host_usart.tx_flag && (UCSR0B & (1<<TXCIE0))) {
+		host_usart.tx_flag = 0;						/* Cleared by executing the vector */
+		if(USART_TX_vect)
+			host_call(USART_TX_vect);
+		return 1;
+	}
+	if(host_twi.flag && host_twi.on && TWI_vect) {	/* TWINT stays set until the next command */
+		host_twi.flag = 0;
+		host_call(TWI_vect);
+		return 1;
+	}
+
+	return 0;
+}
+
+static void host_dispatch(void)
+{
+	uint32_t storm = 0;
+
+	if(host_in_isr)
+		return;
+	while((SREG & (1<<SREG_I)) && host_serve_one())
+		if(++storm > 100000)
+			host_fatal("interrupt storm");
+}
+
+void host_sei(void)
+{
+	SREG |= 1<<SREG_I;
+	host_dispatch();
+}
+
+void host_run(uint64_t cycles)
+{
+	uint64_t end = host_cycles + cycles, step;
+
+	host_dispatch();
+	while(host_cycles < end) {
+		step = host_next_event();
+		if(!step || step > end - host_cycles)
+			step = end - host_cycles;
+		host_elapse(step);
+		host_dispatch();
+	}
+}
+
+void host_run_until(void (*entry)(void), uint64_t cycles)
+{
+	host_deadline = host_cycles + cycles;
+	if(!setjmp(host_exit))
+		entry();
+	host_deadline = UINT64_MAX;
+	host_state = HOST_RUN;
+	host_in_isr = 0;
+}
+
+/**
+ * @brief Checks for an interrupt which ends power-down: INT0 at low level,
+ * a pin change or the watchdog.
+ */
+static uint8_t host_deep_wake(void)
+{
+	return ((EIMSK & (1<<INT0)) && !(EICRA & ((1<<ISC01)|(1<<ISC00))) && !(PIND & HAL_PIN_MFP))
+		|| ((PCIFR & (1<<PCIF2)) && (PCICR & (1<<PCIE2)))
+		|| (host_wdt_flag && (WDTCSR & (1<<WDIE)));
+}
+
+/**
+ * @brief Lets the oscillator start after power-down, the CPU and the I/O clock
+ * stand still meanwhile. The pin change flags are latched.
+ */
+static void host_startup(void)
+{
+	uint64_t end = host_cycles + HOST_WAKE_CYCLES, step;
+
+	while(host_cycles < end) {
+		step = host_next_event();
+		if(!step || step > end - host_cycles)
+			step = end - host_cycles;
+		host_elapse(step);
+	}
+	host_state = HOST_RUN;
+}
+
+void set_sleep_mode(uint8_t mode)
+{
+	host_sleep_mode = mode;
+}
+
+void sleep_enable(void)
+{
+	host_sleep_mark = host_served;
+}
+
+void sleep_cpu(void)
+{
+	uint64_t step, start = host_cycles;
+
+	if(!(SREG & (1<<SREG_I)))
+		host_fatal("sleep with interrupts disabled");
+
+	while(host_served == host_sleep_mark) {			/* Woken by the first interrupt */
+		host_state = host_sleep_mode == SLEEP_MODE_IDLE ? HOST_IDLE : HOST_DEEP;
+		step = host_next_event();
+		if(!step || (host_deadline == UINT64_MAX && host_cycles - start > HOST_SLEEP_MAX))
+			host_fatal("sleep without a wake-up source");
+		host_elapse(step);
+		if(host_state == HOST_DEEP && host_deep_wake())
+			host_startup();
+		host_dispatch();
+	}
+	host_state = HOST_RUN;
+}
+
+
+/*--------------------------------------------------------------------------------*/
+/* HAL */
+
+void hal_gpio_output(uint8_t pins)
+{
+	DDRD |= pins;
+}
+
+void hal_gpio_input_pullup(uint8_t pins)
+{
+	DDRD &= ~pins;
+	PORTD |= pins;
+}
+
+void hal_gpio_set(uint8_t pins)
+{
+	PORTD |= pins;
+}
+
+void hal_gpio_clear(uint8_t pins)
+{
+	PORTD &= ~pins;
+}
+
+uint8_t hal_gpio_read(uint8_t pins)
+{
+	host_sync();
+
+	return PIND & pins;
+}
+
+void hal_mfp_alarm_init(void)
+{
+	EICRA &= ~((1<<ISC01)|(1<<ISC00));
+}
+
+void hal_mfp_alarm_enable(void)
+{
+	EIMSK |= 1<<INT0;
+}
+
+void hal_mfp_alarm_disable(void)
+{
+	EIMSK &= ~(1<<INT0);
+}
+
+void hal_mfp_edge_enable(void)
+{
+	host_sync();									/* No edge from the old level */
+	PCMSK2 |= 1<<PCINT18;
+	PCICR |= 1<<PCIE2;
+}
+
+void hal_mfp_edge_disable(void)
+{
+	PCMSK2 &= ~(1<<PCINT18);
+	if(!PCMSK2)
+		PCICR &= ~(1<<PCIE2);
+}
+
+void hal_timer1_init(void)
+{
+	host_t1.count = 0;
+	host_t1.phase = 0;
+	host_t1.top = HAL_TIMER1_TICKS - 1;
+	TIMSK1 = 1<<OCIE1A;
+}
+
+void hal_timer1_start(void)
+{
+	host_t1.running = 1;
+}
+
+void hal_timer1_stop(void)
+{
+	host_t1.running = 0;
+}
+
+uint16_t hal_timer1_count(void)
+{
+	return host_t1.count;
+}
+
+uint16_t hal_timer1_top(void)
+{
+	return host_t1.top;
+}
+
+uint8_t hal_timer1_pending(void)
+{
+	return host_t1.flag;
+}
+
+void hal_pwm_init(void)
+{
+	TCCR2A = (1<<WGM21)|(1<<WGM20);
+}
+
+void hal_pwm_start(void)
+{
+	TCCR2B = (1<<CS22)|(1<<CS21);
+}
+
+void hal_pwm_stop(void)
+{
+	TCCR2B = 0;
+}
+
+void hal_pwm_connect(uint8_t compare)
+{
+	OCR2B = compare;
+	TCCR2A |= (1<<COM2B1)|(1<<COM2B0);
+}
+
+void hal_pwm_disconnect(void)
+{
+	TCCR2A &= ~((1<<COM2B1)|(1<<COM2B0));
+}
+
+uint8_t hal_pwm_async(void)
+{
+	return 0;										/* No watch crystal at TOSC */
+}
+
+uint16_t host_pwm_output(void)
+{
+	if((TCCR2A & (1<<COM2B1)) && (TCCR2B & 0x07))
+		return 255 - OCR2B;							/* Inverting: set on compare match, cleared at BOTTOM */
+	return (PORTD & HAL_PIN_PWM) ? 256 : 0;
+}
+
+/**
+ * @brief Schedules TWINT after a number of SCL periods.
+ */
+static void host_twi_after(uint8_t bits, uint8_t status)
+{
+	host_twi.flag = 0;
+	host_twi.status = status;
+	host_twi.due = (uint64_t)bits*(16 + 2*TWBR);
+}
+
+/**
+ * @brief Counts down the data bytes of host_rtcc.stall, the byte which reaches 0 never completes.
+ * @return 1 if the slave stretches SCL
+ */
+static uint8_t host_twi_stalled(void)
+{
+	if(!host_rtcc.stall || --host_rtcc.stall)
+		return 0;
+	host_twi.flag = 0;
+	host_twi.due = 0;
+	return 1;
+}
+
+static void host_twi_release(void)
+{
+	if(host_twi.owner)
+		host_rtcc.transactions++;
+	host_twi.owner = 0;
+	host_twi.reading = 0;
+}
+
+void hal_twi_init(uint8_t bitrate)
+{
+	TWBR = bitrate;
+	host_twi.on = 1;
+	host_twi.flag = 0;
+	host_twi.due = 0;
+	host_twi.status = TW_NO_INFO;
+}
+
+uint8_t hal_twi_status(void)
+{
+	return host_twi.status;
+}
+
+void hal_twi_start(uint8_t stop)
+{
+	if(stop)
+		host_twi_release();
+	if(host_rtcc.hang) {							/* Slave hangs and holds SDA, START never completes */
+		host_rtcc.hang--;
+		host_twi.sda_low = 1;
+	}
+	if(host_twi.sda_low) {
+		host_twi.flag = 0;
+		host_twi.due = 0;
+		return;
+	}
+	host_rtcc.starts++;
+	host_twi_after(1, host_twi.owner ? TW_REP_START : TW_START);
+	host_twi.owner = 1;
+	host_twi.sla = 1;
+}
+
+void hal_twi_stop(void)
+{
+	host_twi.flag = 0;
+	host_twi_release();
+}
+
+void hal_twi_write(uint8_t data)
+{
+	host_twi.data = data;
+	if(host_twi.sla) {
+		host_twi.sla = 0;
+		if(host_rtcc.arb) {							/* The other master keeps the bus, TWI is slave again */
+			host_rtcc.arb--;
+			host_twi.owner = 0;
+			host_twi_after(9, TW_MT_ARB_LOST);
+			return;
+		}
+		if((data>>1) != SLA_ADDRESS || host_rtcc.nack) {
+			if(host_rtcc.nack)
+				host_rtcc.nack--;
+			host_twi_after(9, (data & TW_READ) ? TW_MR_SLA_NACK : TW_MT_SLA_NACK);
+		}
+		else {
+			host_twi.reading = data & TW_READ;
+			host_twi.pointer_set = host_twi.reading;
+			host_twi_after(9, host_twi.reading ? TW_MR_SLA_ACK : TW_MT_SLA_ACK);
+		}
+		return;
+	}
+	if(host_twi_stalled())
+		return;
+	if(!host_twi.pointer_set) {
+		host_twi.pointer = data & 0x7F;
+		host_twi.pointer_set = 1;
+	}
+	else {
+		host_rtcc.writes++;
+		host_rtcc_write(host_twi.pointer, data);
+		host_twi.pointer = host_rtcc_next(host_twi.pointer);
+	}
+	host_twi_after(9, TW_MT_DATA_ACK);
+}
+
+void hal_twi_read(uint8_t ack)
+{
+	if(host_twi_stalled())
+		return;
+	host_twi.data = host_rtcc_read(host_twi.pointer);
+	host_twi.pointer = host_rtcc_next(host_twi.pointer);
+	host_rtcc.reads++;
+	if(!ack)
+		host_rtcc.read_nacks++;
+	host_twi_after(9, ack ? TW_MR_DATA_ACK : TW_MR_DATA_NACK);
+}
+
+uint8_t hal_twi_data(void)
+{
+	return host_twi.data;
+}
+
+void hal_twi_disable(void)
+{
+	host_twi.on = 0;
+	host_twi.flag = 0;
+	host_twi.due = 0;
+	host_twi.owner = 0;
+	host_twi.reading = 0;
+}
+
+void hal_twi_recover(void)
+{
+	host_rtcc.recoveries++;
+	if(host_twi.sda_low && host_rtcc.stuck <= 9)
+		host_twi.sda_low = 0;
+	host_run(HOST_RECOVER_CYCLES);
+}
+
+/* EEPROM: the variables of HAL_EEMEM, the linker provides the bounds of the section */
+extern uint8_t __start_host_eeprom[] __attribute__((weak));
+extern uint8_t __stop_host_eeprom[] __attribute__((weak));
+
+void host_ee_erase(void)
+{
+	if(__start_host_eeprom)
+		memset(__start_host_eeprom, 0xFF, __stop_host_eeprom - __start_host_eeprom);
+}
+
+uint8_t hal_ee_read_byte(const uint8_t* addr)
+{
+	return *addr;
+}
+
+uint16_t hal_ee_read_word(const uint16_t* addr)
+{
+	return *addr;
+}
+
+void hal_ee_read_block(void* dst, const void* addr, uint16_t len)
+{
+	memcpy(dst, addr, len);
+}
+
+void hal_ee_update_byte(uint8_t* addr, uint8_t data)
+{
+	if(*addr == data)
+		return;
+	*addr = data;
+	host_ee_writes++;
+	host_run(HOST_EE_CYCLES);
+}
+
+void hal_ee_update_word(uint16_t* addr, uint16_t data)
+{
+	hal_ee_update_block(&data, addr, sizeof(data));
+}
+
+void hal_ee_update_block(const void* src, void* addr, uint16_t len)
+{
+	for(uint16_t i=0; i<len; i++)
+		hal_ee_update_byte((uint8_t*)addr + i, ((const uint8_t*)src)[i]);
+}
+
+void hal_adc_temp_enable(void)
+{
+	ADMUX = (1<<REFS1)|(1<<REFS0)|(1<<MUX3);
+	ADCSRA = (1<<ADEN)|(1<<ADPS2)|(1<<ADPS1)|(1<<ADPS0);
+}
+
+uint16_t hal_adc_convert(void)
+{
+	host_run(HOST_ADC_CYCLES);
+	ADC = host_adc;
+
+	return ADC;
+}
+
+void hal_adc_disable(void)
+{
+	ADCSRA = 0;
+}
+
+void hal_delay_ms(uint8_t ms)
+{
+	host_run(ms*HOST_CYCLES_PER_MS);
+}
+
+void hal_wdt_timeout_start(void)
+{
+	host_wdt_phase = 0;								/* Full period from now */
+	host_wdt_flag = 0;
+	WDTCSR = (1<<WDIE)|(1<<WDP0);
+}
+
+void hal_wdt_timeout_stop(void)
+{
+	WDTCSR = 0;
+	host_wdt_flag = 0;
+}
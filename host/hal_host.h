@@ -0,0 +1,187 @@
+#ifndef HAL_HOST_H
+#define HAL_HOST_H
+
+#include <stdint.h>
+
+/* Host implementation of the HAL for the tests (make host-test, HAL_HOST). The same
+ * functions as on the ATmega168 drive simulated peripherals in host/hal_host.c:
+ * Timer1, the PWM on Timer2, the TWI with an MCP7940M on the bus, EEPROM, ADC and
+ * the watchdog. Time only advances in sleep, in busy delays and in host_run(),
+ * in CPU cycles of F_CPU. The interrupts are served from sei() and sleep. */
+
+/* GPIO */
+void hal_gpio_output(uint8_t);
+void hal_gpio_input_pullup(uint8_t);
+void hal_gpio_set(uint8_t);
+void hal_gpio_clear(uint8_t);
+uint8_t hal_gpio_read(uint8_t);
+
+/* Interrupts of MFP */
+void hal_mfp_alarm_init(void);
+void hal_mfp_alarm_enable(void);
+void hal_mfp_alarm_disable(void);
+void hal_mfp_edge_enable(void);
+void hal_mfp_edge_disable(void);
+
+/* Timer1 */
+void hal_timer1_init(void);
+void hal_timer1_start(void);
+void hal_timer1_stop(void);
+uint16_t hal_timer1_count(void);
+uint16_t hal_timer1_top(void);
+uint8_t hal_timer1_pending(void);
+
+/* PWM */
+void hal_pwm_init(void);
+void hal_pwm_start(void);
+void hal_pwm_stop(void);
+void hal_pwm_connect(uint8_t);
+void hal_pwm_disconnect(void);
+uint8_t hal_pwm_async(void);
+
+/* TWI master */
+void hal_twi_init(uint8_t);
+uint8_t hal_twi_status(void);
+void hal_twi_start(uint8_t);
+void hal_twi_stop(void);
+void hal_twi_write(uint8_t);
+void hal_twi_read(uint8_t);
+uint8_t hal_twi_data(void);
+void hal_twi_disable(void);
+void hal_twi_recover(void);
+
+/* EEPROM, the variables are collected in one section */
+#define HAL_EEMEM				__attribute__((section("host_eeprom")))
+
+uint8_t hal_ee_read_byte(const uint8_t*);
+uint16_t hal_ee_read_word(const uint16_t*);
+void hal_ee_read_block(void*, const void*, uint16_t);
+void hal_ee_update_byte(uint8_t*, uint8_t);
+void hal_ee_update_word(uint16_t*, uint16_t);
+void hal_ee_update_block(const void*, void*, uint16_t);
+
+/* ADC */
+void hal_adc_temp_enable(void);
+uint16_t hal_adc_convert(void);
+void hal_adc_disable(void);
+
+/* Busy delay and watchdog */
+void hal_delay_ms(uint8_t);
+void hal_wdt_timeout_start(void);
+void hal_wdt_timeout_stop(void);
+
+/*--------------------------------------------------------------------------------*/
+/* Control of the simulation, used by the tests */
+
+#define HOST_CYCLES_PER_MS		((uint64_t)F_CPU/1000)
+#define HOST_CYCLES_PER_S		((uint64_t)F_CPU)
+
+extern uint64_t host_cycles;					/* Simulated time since the start */
+extern uint16_t host_adc;						/* Result of the next conversion */
+extern uint16_t host_ee_writes;					/* Bytes written to EEPROM */
+extern uint64_t host_residency[3];				/* Cycles in run, idle and deep sleep */
+extern void (*host_second_hook)(void);			/* Called after every second of the RTCC, as an interrupt */
+
+typedef struct{									/* MCP7940M on the bus */
+	uint8_t regs[0x60];							/* Registers (0x00-0x1F) and SRAM (0x20-0x5F) */
+	int32_t ppb;								/* Deviation of the crystal without trimming (1e-9) */
+	uint8_t nack;								/* Faults: next SLA to NACK */
+	uint8_t arb;								/* Next SLA which lose the arbitration to another master */
+	uint8_t hang;								/* Next START conditions which never complete */
+	uint8_t stuck;								/* SCL pulses until a hung slave releases SDA (>9 -> never) */
+	uint8_t stall;								/* Data bytes until the slave stretches SCL up to a recovery */
+	uint16_t transactions;						/* Counted STOP conditions */
+	uint16_t starts;							/* Counted START conditions */
+	uint16_t recoveries;						/* Calls of hal_twi_recover() */
+	uint16_t writes;							/* Counted bytes written to registers and SRAM */
+	uint16_t reads;								/* Counted data bytes sent to the master */
+	uint16_t read_nacks;						/* Of them answered with NACK by the master */
+}host_rtcc_t;
+
+extern host_rtcc_t host_rtcc;
+
+/**
+ * @brief Fills the EEPROM with 0xFF as after a chip erase.
+ */
+void host_ee_erase(void);
+
+/**
+ * @brief Sets the time of the RTCC model and starts its oscillator, trimming off.
+ * The registers hold the 24-hour format, VBATEN is set.
+ * @param year Year (0-99)
+ * @param month Month (1-12)
+ * @param date Day of the month (1-31)
+ * @param day Day of the week (1-7)
+ * @param hours Hours (0-23)
+ * @param minutes Minutes (0-59)
+ * @param seconds Seconds (0-59)
+ */
+void host_rtcc_set(uint8_t, uint8_t, uint8_t, uint8_t, uint8_t, uint8_t, uint8_t);
+
+/**
+ * @brief Returns the seconds since midnight of the RTCC model.
+ */
+uint32_t host_rtcc_seconds(void);
+
+/**
+ * @brief Advances the simulated time and serves the interrupts.
+ * @param cycles CPU cycles
+ */
+void host_run(uint64_t);
+
+/**
+ * @brief Runs a function, normally the main loop of the firmware, until the simulated
+ * time reached a deadline. The function is left by a long jump from the next sleep or delay.
+ * @param entry Function to run
+ * @param cycles CPU cycles from now
+ */
+void host_run_until(void (*)(void), uint64_t);
+
+/**
+ * @brief Sends characters to the RX pin (PD0) at a baud rate, one stop bit.
+ * The frames start after the frames queued before. With RXEN0 the USART samples
+ * them at its own baud rate.
+ * @param s Zero terminated characters
+ * @param baud Baud rate
+ */
+void host_uart_send(const char*, uint32_t);
+
+/**
+ * @brief Keeps the RX pin idle for a time after the frames queued before,
+ * the next frames start later.
+ * @param cycles CPU cycles
+ */
+void host_uart_pause(uint64_t);
+
+/**
+ * @brief Returns the characters decoded from the TX pin (PD1) or sent by the USART,
+ * zero terminated, and empties the buffer.
+ */
+const char* host_uart_output(void);
+
+extern uint32_t host_uart_baud;					/* Baud rate of the TX decoder */
+
+/**
+ * @brief Returns the brightness at the PWM pin PD3.
+ * @return High time in 1/256 of the period (0 to 256)
+ */
+uint16_t host_pwm_output(void);
+
+/**
+ * @brief Counts a check, a failed one is printed.
+ * @param cond Result of the check
+ * @param format printf format of the message, followed by its arguments
+ * @return cond
+ */
+int host_check(int, const char*, ...);
+
+/**
+ * @brief Prints the result of the test.
+ * @param name Name of the test
+ * @return Exit status, 1 if a check failed
+ */
+int host_result(const char*);
+
+#define HOST_CHECK(cond, ...)	host_check(!!(cond), __VA_ARGS__)
+
+#endif
@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <string.h>
+#include "hal.h"
+
+/* The alarms of the firmware (main.c) with RTCC_ALARM_WAKE: after the calibration at
+ * boot the MCU is in power-down and only woken by MFP. Alarm 0 holds the minute of the
+ * next event of the schedule (schedule_next()) and matches the minutes only, so it also
+ * fires once per hour before the sunrise. Those wake-ups find no event, set the alarm
+ * again and go back to power-down without touching the output. The sunrise wakes the
+ * MCU at its minute and starts the fade. */
+
+#define main firmware_main
+#include "main.c"
+#undef main
+
+#define ALARM_START				(12*3600L)
+#define ALARM_SUNRISE			(SUNRISE_HOUR*3600L + SUNRISE_MINUTE*60)
+#define ALARM_END				(ALARM_SUNRISE + 5*60)
+#define ALARM_AWAKE_MS			10						/* Max. time awake for an alarm without event */
+
+static uint64_t alarm_deep[86400];						/* Power-down cycles in each second of the RTCC */
+static uint16_t alarm_output[86400];
+static uint16_t alarm_set[86400];						/* Minute of the day in alarm 0, 0xFFFF if disabled */
+static uint16_t alarm_next[86400];						/* Minute of the day of schedule_next() */
+static uint32_t alarm_settled;							/* First second in run mode with the UART timed out */
+
+/**
+ * @brief Converts a BCD register to binary.
+ */
+static uint8_t alarm_bcd(uint8_t bcd)
+{
+	return (bcd>>4)*10 + (bcd & 0x0F);
+}
+
+/**
+ * @brief Returns the minute of the day in the registers of alarm 0.
+ */
+static uint16_t alarm_regs(void)
+{
+	const uint8_t* r = &host_rtcc.regs[ALM0_REG];
+
+	if(!(host_rtcc.regs[CTRL_REG] & (1<<ALM0)))
+		return 0xFFFF;
+	return alarm_bcd(r[ALM_HOUR_OFS] & 0x3F)*60 + alarm_bcd(r[ALM_MIN_OFS] & 0x7F);
+}
+
+/**
+ * @brief Records the power-down time of the second before, the output and the alarm.
+ */
+static void alarm_second(void)
+{
+	static uint64_t deep;
+	uint32_t now = host_rtcc_seconds();
+	const schedule_event_t* event = schedule_next();
+
+	alarm_deep[(now + 86399) % 86400] = host_residency[POWER_DEEP] - deep;
+	deep = host_residency[POWER_DEEP];
+	alarm_output[now] = host_pwm_output();
+	alarm_set[now] = alarm_regs();
+	alarm_next[now] = event ? event->hours*60 + event->minutes : 0xFFFF;
+
+	if(!alarm_settled && mode == MODE_RUN && !uart_awake && !power_holds)
+		alarm_settled = now + 1;
+}
+
+static void alarm_firmware(void)
+{
+	firmware_main();
+}
+
+int main(void)
+{
+	uint32_t t, matches = 0;
+
+	host_ee_erase();
+	host_rtcc_set(26, 10, 17, 6, ALARM_START/3600, 0, 0);
+	host_second_hook = alarm_second;
+
+	host_run_until(alarm_firmware, (ALARM_END - ALARM_START)*HOST_CYCLES_PER_S);
+
+	HOST_CHECK(alarm_settled && alarm_settled < ALARM_START + 26*60, "power-down only from %u s", alarm_settled);
+
+	for(t=alarm_settled; t<ALARM_SUNRISE; t++) {
+		uint8_t match = t % 3600 == SUNRISE_MINUTE*60;	/* Minute of alarm 0 in any hour */
+		uint8_t woke = alarm_deep[t] < HOST_CYCLES_PER_S - HOST_CYCLES_PER_MS/10;
+
+		/* Alarm 0 holds the next event of the schedule, the sunrise */
+		if(!HOST_CHECK(alarm_set[t] == alarm_next[t] && alarm_set[t] == ALARM_SUNRISE/60,
+			"%u s: alarm 0 at minute %u, next event at %u", t, alarm_set[t], alarm_next[t]))
+			break;
+		/* Power-down except for the minute-only matches in the other hours */
+		if(!HOST_CHECK(woke == match, "%u s: %s", t, woke ? "woken without alarm" : "alarm missed"))
+			break;
+		if(match) {
+			HOST_CHECK(alarm_deep[t] > HOST_CYCLES_PER_S - ALARM_AWAKE_MS*HOST_CYCLES_PER_MS,
+				"%u s: awake for %lu us after a match in hour %u", t,
+				(unsigned long)((HOST_CYCLES_PER_S - alarm_deep[t])*1000/HOST_CYCLES_PER_MS), t/3600);
+			matches++;
+		}
+		if(!HOST_CHECK(alarm_output[t] == 0, "%u s: output %u before the sunrise", t, alarm_output[t]))
+			break;
+	}
+	HOST_CHECK(matches == SUNRISE_HOUR - ALARM_START/3600, "%u minute-only matches before the sunrise", matches);
+
+	/* The sunrise wakes the MCU at its minute, the fade starts and the alarm moves to the sunset */
+	HOST_CHECK(alarm_deep[ALARM_SUNRISE] < HOST_CYCLES_PER_S - HOST_CYCLES_PER_MS/10, "not woken at the sunrise");
+	HOST_CHECK(alarm_deep[ALARM_SUNRISE - 1] >= HOST_CYCLES_PER_S - HOST_CYCLES_PER_MS/10,
+		"woken before the sunrise");
+	HOST_CHECK(alarm_output[ALARM_SUNRISE + 60] > 0, "output %u after the sunrise", alarm_output[ALARM_SUNRISE + 60]);
+	HOST_CHECK(alarm_set[ALARM_SUNRISE + 60] == alarm_next[ALARM_SUNRISE + 60]
+		&& alarm_set[ALARM_SUNRISE + 60] == SUNSET_HOUR*60 + SUNSET_MINUTE,
+		"alarm 0 at minute %u after the sunrise, next event at %u", alarm_set[ALARM_SUNRISE + 60],
+		alarm_next[ALARM_SUNRISE + 60]);
+
+	printf("power-down from %02u:%02u:%02u, %u minute-only matches before the sunrise\n",
+		alarm_settled/3600, alarm_settled/60 % 60, alarm_settled % 60, matches);
+
+	return host_result("test_alarm");
+}
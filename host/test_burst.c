@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <string.h>
+#include "hal.h"
+#include "MCP7940M.h"
+
+/* The burst read of the time (MCP7940M.c): one transaction with two START conditions,
+ * every byte acknowledged except the last. The carry of the year is moved across the
+ * read bit by bit: a burst read returns the old or the new time unless the carry falls
+ * between its data bytes, seven reads of single registers are torn over a longer window. */
+
+#define BURST_TEST_SWEEP		400						/* Bits before the carry where a read starts */
+
+static const rtcc_time_t burst_old = {59, 59, 23, 5, 31, 12, 99};
+static const rtcc_time_t burst_new = {0, 0, 0, 6, 1, 1, 0};
+
+/**
+ * @brief Reads SEC_REG to YEAR_REG with one transaction per register like before the burst read.
+ */
+static uint8_t burst_read_single(rtcc_time_t* time)
+{
+	uint8_t buf[RTCC_TIME_LEN];
+	uint8_t ERR_CODE;
+
+	for(uint8_t i=0; i<RTCC_TIME_LEN; i++) {
+		ERR_CODE = rtcc_byte_read(SEC_REG + i, &buf[i]);
+		if(ERR_CODE != TWI_SUCCESS)
+			return ERR_CODE;
+	}
+	return rtcc_decode_time(buf, time) ? TWI_SUCCESS : RTCC_DATA_ERROR;
+}
+
+/**
+ * @brief Starts a read at every bit before the carry of the year.
+ * @param read Function which reads the time
+ * @return Number of torn results
+ */
+static uint16_t burst_sweep(uint8_t (*read)(rtcc_time_t*))
+{
+	uint32_t bit = 16 + 2*TWBR;
+	uint16_t torn = 0;
+	rtcc_time_t time;
+
+	for(uint16_t b=0; b<BURST_TEST_SWEEP; b++) {
+		host_rtcc_set(99, 12, 31, 5, 23, 59, 59);
+		host_run(HOST_CYCLES_PER_S - (uint64_t)b*bit);
+		HOST_CHECK(read(&time) == TWI_SUCCESS, "read %u bits before the carry failed", b);
+		if(memcmp(&time, &burst_old, sizeof(time)) && memcmp(&time, &burst_new, sizeof(time)))
+			torn++;
+	}
+	return torn;
+}
+
+int main(void)
+{
+	rtcc_time_t time;
+	uint64_t begin;
+	uint32_t bit;
+	uint16_t torn_burst, torn_single;
+
+	twi_init();
+	sei();
+	bit = 16 + 2*TWBR;
+	host_rtcc_set(26, 10, 17, 6, 12, 34, 56);
+
+	begin = host_cycles;
+	HOST_CHECK(rtcc_get_time(&time) == TWI_SUCCESS, "rtcc_get_time() failed");
+	HOST_CHECK(host_rtcc.transactions == 1 && host_rtcc.starts == 2, "%u transactions, %u starts, expected 1, 2",
+		host_rtcc.transactions, host_rtcc.starts);
+	HOST_CHECK(host_rtcc.reads == RTCC_TIME_LEN && host_rtcc.read_nacks == 1, "%u bytes read, %u NACKed",
+		host_rtcc.reads, host_rtcc.read_nacks);
+	HOST_CHECK(time.hours == 12 && time.minutes == 34 && time.seconds == 56 && time.date == 17
+		&& time.month == 10 && time.year == 26 && time.day == 6, "read %02u:%02u:%02u %02u.%02u.%02u",
+		time.hours, time.minutes, time.seconds, time.date, time.month, time.year);
+	/* START, SLA+W, address, repeated START, SLA+R and the data bytes */
+	HOST_CHECK(host_cycles - begin <= (1 + 9 + 9 + 1 + 9 + 9*RTCC_TIME_LEN)*bit, "read took %lu bits",
+		(unsigned long)((host_cycles - begin)/bit));
+
+	torn_burst = burst_sweep(rtcc_get_time);
+	torn_single = burst_sweep(burst_read_single);
+	HOST_CHECK(torn_burst <= 9*(RTCC_TIME_LEN - 1), "burst read torn at %u bits", torn_burst);
+	HOST_CHECK(torn_single > torn_burst, "single reads torn at %u bits, burst read at %u", torn_single, torn_burst);
+	printf("Torn at %u of %u bits with the burst read, %u with single reads\n", torn_burst, BURST_TEST_SWEEP, torn_single);
+
+	return host_result("test_burst");
+}
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <string.h>
+#include "hal.h"
+#include "MCP7940M.h"
+#include "clock.h"
+
+/* Exhaustive check of the table driven BCD codec of the time registers against
+ * the register layout of the datasheet, and the rejection of invalid registers
+ * by rtcc_get_time() and the software clock. */
+
+static const uint8_t codec_units[RTCC_TIME_LEN] = {0x0F, 0x0F, 0x0F, 0x07, 0x0F, 0x0F, 0x0F};
+static const uint8_t codec_tens[RTCC_TIME_LEN] = {0x70, 0x70, 0x30, 0x00, 0x30, 0x10, 0xF0};
+static const unsigned codec_min[RTCC_TIME_LEN] = {0, 0, 0, 1, 1, 1, 0};
+static const unsigned codec_max[RTCC_TIME_LEN] = {59, 59, 23, 7, 31, 12, 99};
+static const uint8_t codec_valid[RTCC_TIME_LEN] = {0x00, 0x00, 0x00, 0x01, 0x01, 0x01, 0x00};
+
+/**
+ * @brief Decodes every value of every register, the other registers valid.
+ */
+static void codec_decode(void)
+{
+	uint8_t buf[RTCC_TIME_LEN];
+	rtcc_time_t time;
+	unsigned* field = &time.seconds;
+	unsigned units, value;
+	uint8_t valid, expected;
+
+	for(uint8_t i=0; i<RTCC_TIME_LEN; i++)
+		for(uint16_t b=0; b<256; b++) {
+			memcpy(buf, codec_valid, sizeof(buf));
+			buf[i] = b;
+			valid = rtcc_decode_time(buf, &time);
+			units = b & codec_units[i];
+			value = ((b & codec_tens[i])>>4)*10 + units;
+			expected = units <= 9 && value >= codec_min[i] && value <= codec_max[i];
+			HOST_CHECK(field[i] == value && valid == expected, "decode register %u of 0x%02X: %u/%u, expected %u/%u",
+				i, b, field[i], valid, value, expected);
+		}
+}
+
+/**
+ * @brief Encodes every value of every field over every old register value: range,
+ * kept control bits and the round trip.
+ */
+static void codec_encode(void)
+{
+	uint8_t buf[RTCC_TIME_LEN], before[RTCC_TIME_LEN], keep, ok;
+	rtcc_time_t time, back;
+
+	for(uint8_t i=0; i<RTCC_TIME_LEN; i++)
+		for(unsigned value=0; value<=120; value++)
+			for(uint16_t old=0; old<256; old++) {
+				memcpy(&time, &(rtcc_time_t){0, 0, 0, 1, 1, 1, 0}, sizeof(time));
+				(&time.seconds)[i] = value;
+				memset(buf, old, sizeof(buf));
+				memcpy(before, buf, sizeof(buf));
+				ok = rtcc_encode_time(&time, buf);
+				if(!HOST_CHECK(ok == (value >= codec_min[i] && value <= codec_max[i]),
+					"encode register %u of %u: %u", i, value, ok))
+					continue;
+				if(!ok) {
+					HOST_CHECK(!memcmp(buf, before, sizeof(buf)), "encode register %u of %u changed buf", i, value);
+					continue;
+				}
+				keep = ~(codec_units[i]|codec_tens[i]|(i == HOUR_REG ? HOUR12_MASK : 0));
+				HOST_CHECK(buf[i] == ((old & keep)|((value/10)<<4)|(value%10)),
+					"encode register %u of %u over 0x%02X: 0x%02X", i, value, old, buf[i]);
+				rtcc_decode_time(buf, &back);
+				HOST_CHECK((&back.seconds)[i] == value, "round trip of register %u of %u over 0x%02X", i, value, old);
+			}
+}
+
+/**
+ * @brief Reads invalid registers: rtcc_get_time() fails and the software clock keeps its time.
+ */
+static void codec_get_time(void)
+{
+	rtcc_time_t time, marker, clock;
+	uint8_t ERR_CODE;
+
+	twi_init();
+	sei();
+	host_rtcc_set(26, 10, 17, 6, 12, 34, 56);
+
+	ERR_CODE = clock_load();
+	clock_get(&clock);
+	HOST_CHECK(ERR_CODE == TWI_SUCCESS && clock.hours == 12 && clock.minutes == 34 && clock.seconds == 56,
+		"clock_load() of a valid time: 0x%02X", ERR_CODE);
+
+	host_rtcc.regs[SEC_REG] = ST_OSC_MASK|0x7F;			/* Decodes to 85 seconds */
+	memset(&marker, 0xAA, sizeof(marker));
+	time = marker;
+	ERR_CODE = rtcc_get_time(&time);
+	HOST_CHECK(ERR_CODE == RTCC_DATA_ERROR, "rtcc_get_time() of seconds 85: 0x%02X", ERR_CODE);
+	HOST_CHECK(!memcmp(&time, &marker, sizeof(time)), "rtcc_get_time() changed the time");
+
+	ERR_CODE = clock_load();
+	HOST_CHECK(ERR_CODE == RTCC_DATA_ERROR, "clock_load() of seconds 85: 0x%02X", ERR_CODE);
+	HOST_CHECK(!clock_sync(), "clock_sync() did not queue the read");
+	hal_delay_ms(1);
+	HOST_CHECK(!clock_sync(), "clock_sync() of seconds 85 succeeded");
+	clock_get(&time);
+	HOST_CHECK(!memcmp(&time, &clock, sizeof(time)), "software clock changed to %u:%u:%u",
+		time.hours, time.minutes, time.seconds);
+
+	host_rtcc.regs[SEC_REG] = ST_OSC_MASK|0x0A;			/* Units digit 10 */
+	HOST_CHECK(rtcc_get_time(&time) == RTCC_DATA_ERROR, "rtcc_get_time() of seconds 0x0A");
+	host_rtcc.regs[SEC_REG] = ST_OSC_MASK|0x12;
+	host_rtcc.regs[MONTH_REG] = 0x13;
+	HOST_CHECK(rtcc_get_time(&time) == RTCC_DATA_ERROR, "rtcc_get_time() of month 13");
+	host_rtcc.regs[MONTH_REG] = 0x10;
+	HOST_CHECK(rtcc_get_time(&time) == TWI_SUCCESS && time.seconds == 12 && time.month == 10,
+		"rtcc_get_time() after repair");
+}
+
+int main(void)
+{
+	codec_decode();
+	codec_encode();
+	codec_get_time();
+
+	return host_result("test_codec");
+}
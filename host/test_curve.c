@@ -0,0 +1,41 @@
+#include <stdio.h>
+#include <math.h>
+#include "hal.h"
+#include "pwm_curve.h"
+#include "pwm_table.h"
+
+/* The generated curve table against the formula t = A*log10(E/B)/log10(C) [min]:
+ * the delay of every PWM step, decoded from the block sums and the deltas. */
+
+/**
+ * @brief Delay of a step in seconds, computed independently of pwm_table_gen.
+ */
+static unsigned curve_delay(uint8_t step)
+{
+	double dark, bright;
+
+	if(step == 0)
+		return 2;												/* Fixed first step */
+	dark = PWM_TABLE_A*log10(((double)(255 - step)/256)/PWM_TABLE_B)/log10(PWM_TABLE_C);
+	bright = PWM_TABLE_A*log10(((double)(256 - step)/256)/PWM_TABLE_B)/log10(PWM_TABLE_C);
+
+	return (bright - dark)*60;
+}
+
+int main(void)
+{
+	unsigned sum = 0, delay, last = 0;
+
+	HOST_CHECK(pwm_curve_sum(0) == 0, "sum of no steps %u", pwm_curve_sum(0));
+	for(uint16_t step=0; step<PWM_RESOLUTION; step++) {
+		delay = pwm_curve_sum(step + 1) - pwm_curve_sum(step);
+		HOST_CHECK(delay == curve_delay(step), "delay of step %u is %u s, expected %u s", step, delay, curve_delay(step));
+		HOST_CHECK(step < 2 || delay >= last, "delay of step %u falls to %u s", step, delay);
+		sum += curve_delay(step);
+		HOST_CHECK(pwm_curve_sum(step + 1) == sum, "sum of %u steps is %u s, expected %u s", step + 1, pwm_curve_sum(step + 1), sum);
+		last = delay;
+	}
+	printf("sunrise %u s\n", pwm_curve_sum(PWM_RESOLUTION));
+
+	return host_result("test_curve");
+}
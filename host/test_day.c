@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hal.h"
+
+/* One simulated day of the firmware (main.c) from an erased EEPROM: the calibration
+ * at boot against a crystal which runs 20ppm fast, the default schedule with the
+ * sunrise at 14:26 and the sunset at 14:36, power-down between the alarms of the RTCC. */
+
+#define main firmware_main
+#include "main.c"
+#undef main
+
+#define DAY_START_HOUR			13
+#define DAY_CRYSTAL_PPB			20000					/* Deviation of the crystal */
+#define DAY_SUNRISE				(SUNRISE_HOUR*3600L + SUNRISE_MINUTE*60)
+#define DAY_SUNSET				(SUNSET_HOUR*3600L + SUNSET_MINUTE*60)
+#define DAY_DARK				(18*3600L)				/* The sunset fade is over */
+
+static uint16_t day_output[86400];						/* PWM at each second of the RTCC */
+static uint8_t day_seen[86400];
+static uint32_t day_clock_checks;
+static int32_t day_clock_max;
+
+/**
+ * @brief Records the output and compares the software clock with the RTCC
+ * while Timer1 advances it.
+ */
+static void day_second(void)
+{
+	uint32_t now = host_rtcc_seconds();
+	rtcc_time_t time;
+	int32_t diff;
+
+	day_output[now] = host_pwm_output();
+	day_seen[now] = 1;
+
+	if(power_holds & POWER_HOLD_CLOCK) {
+		uint8_t sreg_tmp = SREG;
+		clock_get(&time);
+		SREG = sreg_tmp;
+
+		diff = (int32_t)now - ((int32_t)time.hours*3600 + time.minutes*60 + time.seconds);
+		if(diff > 43200)
+			diff -= 86400;
+		if(diff < -43200)
+			diff += 86400;
+		if(labs(diff) > day_clock_max)
+			day_clock_max = labs(diff);
+		day_clock_checks++;
+	}
+}
+
+static void day_firmware(void)
+{
+	firmware_main();
+}
+
+int main(void)
+{
+	uint32_t t, missing = 0;
+	uint64_t total;
+	uint8_t cal;
+	const char* out;
+
+	host_ee_erase();
+	host_rtcc.ppb = DAY_CRYSTAL_PPB;
+	host_rtcc_set(26, 10, 17, 6, DAY_START_HOUR, 0, 0);
+	host_second_hook = day_second;
+
+	host_run_until(day_firmware, 86400*HOST_CYCLES_PER_S + HOST_CYCLES_PER_S/2);
+
+	for(t=0; t<86400; t++)
+		missing += !day_seen[t];
+	HOST_CHECK(missing == 0, "%u seconds of the RTCC not seen", missing);
+	HOST_CHECK(host_rtcc_seconds() == DAY_START_HOUR*3600L, "RTCC at %u s after one day", host_rtcc_seconds());
+
+	/* Calibration at boot: a fast crystal is slowed down by subtracting clocks */
+	cal = host_rtcc.regs[CAL_REG];
+	HOST_CHECK(!(cal & 0x80) && labs((long)(cal & 0x7F)*1017 - DAY_CRYSTAL_PPB) < 1017,
+		"CAL_REG 0x%02X for %d ppb", cal, DAY_CRYSTAL_PPB);
+	out = host_uart_output();
+	HOST_CHECK(strstr(out, "ppm") != 0, "no calibration report in \"%s\"", out);
+
+	/* Dark until the sunrise, rising until the sunset, dark again after the fade */
+	for(t=DAY_START_HOUR*3600L; t<DAY_SUNRISE; t++)
+		if(!HOST_CHECK(day_output[t] == 0, "output %u at %u s before the sunrise", day_output[t], t))
+			break;
+	HOST_CHECK(day_output[DAY_SUNRISE + 60] > 0, "no sunrise at %u s", DAY_SUNRISE);
+	for(t=DAY_SUNRISE + 1; t<DAY_SUNSET; t++)
+		if(!HOST_CHECK(day_output[t] >= day_output[t-1], "output falls at %u s during the sunrise", t))
+			break;
+	HOST_CHECK(day_output[DAY_SUNSET - 1] > day_output[DAY_SUNRISE + 60], "sunrise stalled");
+	for(t=DAY_SUNSET + 2; t<DAY_DARK; t++)
+		if(!HOST_CHECK(day_output[t] <= day_output[t-1], "output rises at %u s during the sunset", t))
+			break;
+	for(t=DAY_DARK; t<86400 + DAY_START_HOUR*3600L; t++)
+		if(!HOST_CHECK(day_output[t % 86400] == 0, "output %u at %u s after the sunset", day_output[t % 86400], t % 86400))
+			break;
+
+	/* The software clock follows the RTCC while it runs */
+	HOST_CHECK(day_clock_checks > 600, "software clock compared only %u times", day_clock_checks);
+	HOST_CHECK(day_clock_max <= 1, "software clock off by %d s", day_clock_max);
+
+	/* Power-down between the events, a few EEPROM writes for schedule and calibration */
+	total = host_residency[POWER_RUN] + host_residency[POWER_IDLE] + host_residency[POWER_DEEP];
+	printf("run %.3f%%, idle %.3f%%, deep %.3f%%, %u EEPROM writes\n",
+		100.0*host_residency[POWER_RUN]/total, 100.0*host_residency[POWER_IDLE]/total,
+		100.0*host_residency[POWER_DEEP]/total, host_ee_writes);
+	HOST_CHECK(host_residency[POWER_DEEP] > total*9/10, "deep sleep only %.1f%%", 100.0*host_residency[POWER_DEEP]/total);
+	HOST_CHECK(host_ee_writes < 64, "%u EEPROM writes", host_ee_writes);
+
+	return host_result("test_day");
+}
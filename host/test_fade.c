@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "hal.h"
+#include "fade.h"
+#include "power.h"
+
+/* Replay of the fade engine, one fade_tick() per second: the steps of sunrise and
+ * sunset follow the running sum of the curve table, stretched fades end on time,
+ * and the output is driven by the PWM only between dark and full. */
+
+/**
+ * @brief Time along the curve from dark to a level, as pwm_table_gen computes it.
+ */
+static uint16_t fade_test_time(uint16_t level)
+{
+	return level <= 1 ? 0 : pwm_curve_sum(PWM_RESOLUTION) - pwm_curve_sum(PWM_RESOLUTION + 1 - level);
+}
+
+/**
+ * @brief Checks the output pin for the current level.
+ */
+static void fade_test_output(void)
+{
+	uint8_t level = fade_get_level();
+	uint16_t expected = level == FADE_LEVEL_FULL ? 256 : level;
+
+	HOST_CHECK(host_pwm_output() == expected, "output %u at level %u", host_pwm_output(), level);
+	HOST_CHECK(!(power_holds & POWER_HOLD_PWM) == (level == FADE_LEVEL_OFF || level == FADE_LEVEL_FULL),
+		"POWER_HOLD_PWM 0x%02X at level %u", power_holds, level);
+}
+
+/**
+ * @brief Replays a fade along the curve timing and compares the time of every step.
+ */
+static void fade_test_curve(uint8_t from, uint8_t target)
+{
+	uint32_t t = 0;
+	uint16_t expected;
+	uint8_t last;
+
+	fade_set_level(from);
+	fade_start(target, 0);
+	last = fade_get_level();
+	while(fade_active() && t < 20000) {
+		fade_tick();
+		t++;
+		if(fade_get_level() != last) {
+			if(!HOST_CHECK(abs(fade_get_level() - last) == 1, "fade %u -> %u jumps from %u to %u",
+				from, target, last, fade_get_level()))
+				break;
+			last = fade_get_level();
+			if(target > from)
+				expected = fade_test_time(last) - fade_test_time(from);
+			else
+				expected = fade_test_time(from + 1) - fade_test_time(last + 1);
+			if(!HOST_CHECK(t == expected, "fade %u -> %u reaches %u after %u s, expected %u",
+				from, target, last, t, expected))
+				break;
+			fade_test_output();
+		}
+	}
+	HOST_CHECK(fade_get_level() == target && !fade_active(), "fade %u -> %u ends at %u", from, target, fade_get_level());
+	fade_test_output();
+}
+
+/**
+ * @brief Replays a fade stretched to a duration, several steps per second if short.
+ */
+static void fade_test_stretched(uint8_t from, uint8_t target, uint8_t minutes)
+{
+	uint32_t t = 0;
+	uint8_t last;
+
+	fade_set_level(from);
+	fade_start(target, minutes);
+	last = fade_get_level();
+	while(fade_active() && t < 20000) {
+		fade_tick();
+		t++;
+		if(!HOST_CHECK(target > from ? fade_get_level() >= last : fade_get_level() <= last,
+			"fade %u -> %u in %u min turns at %u s", from, target, minutes, t))
+			break;
+		last = fade_get_level();
+	}
+	HOST_CHECK(fade_get_level() == target, "fade %u -> %u in %u min ends at %u", from, target, minutes, fade_get_level());
+	HOST_CHECK(labs((long)t - minutes*60L) <= 1, "fade %u -> %u in %u min takes %u s", from, target, minutes, t);
+}
+
+int main(void)
+{
+	fade_init();
+	fade_test_output();
+
+	fade_test_curve(FADE_LEVEL_OFF, FADE_LEVEL_FULL);
+	fade_test_curve(FADE_LEVEL_FULL, FADE_LEVEL_OFF);
+	fade_test_curve(20, 200);
+	fade_test_curve(200, 20);
+
+	fade_test_stretched(FADE_LEVEL_OFF, FADE_LEVEL_FULL, 30);
+	fade_test_stretched(FADE_LEVEL_FULL, FADE_LEVEL_OFF, 5);
+	fade_test_stretched(FADE_LEVEL_FULL, FADE_LEVEL_OFF, 1);
+	fade_test_stretched(10, 250, 120);
+
+	/* A new level cancels a running fade */
+	fade_set_level(FADE_LEVEL_OFF);
+	fade_start(FADE_LEVEL_FULL, 10);
+	fade_tick();
+	fade_set_level(100);
+	HOST_CHECK(!fade_active() && fade_get_level() == 100, "fade_set_level() did not cancel the fade");
+	for(uint8_t i=0; i<10; i++)
+		fade_tick();
+	HOST_CHECK(fade_get_level() == 100, "level changed to %u after the fade was cancelled", fade_get_level());
+	fade_test_output();
+
+	return host_result("test_fade");
+}
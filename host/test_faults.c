@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <string.h>
+#include "hal.h"
+#include "MCP7940M.h"
+#include "clock.h"
+#include "power.h"
+
+/* Errors of the RTCC driver (MCP7940M.c) reach the callers: a NACK on every attempt,
+ * a slave which stretches SCL in the middle of a transaction and registers which hold
+ * no valid time. The results stay untouched, the error LED is lit by the bus faults,
+ * the software clock (clock.c) keeps running and the next transaction works again. */
+
+#define FAULTS_TEST_PERIODS		(TWI_RETRIES + 2)		/* Watchdog periods of 32ms for a stalled bus */
+
+static const rtcc_time_t faults_untouched = {11, 22, 33, 4, 5, 6, 7};
+
+/**
+ * @brief Reads the time under a fault and checks the error, the result and the duration.
+ * @param what Name of the fault
+ * @param expected Error code
+ * @param recoveries Calls of hal_twi_recover()
+ */
+static void faults_test_read(const char* what, uint8_t expected, uint16_t recoveries)
+{
+	rtcc_time_t time = faults_untouched;
+	uint64_t begin = host_cycles;
+	uint8_t ERR_CODE;
+
+	PORTD &= ~HAL_PIN_ERROR;
+	host_rtcc.recoveries = 0;
+	ERR_CODE = rtcc_get_time(&time);
+	HOST_CHECK(ERR_CODE == expected, "%s: 0x%02X, expected 0x%02X", what, ERR_CODE, expected);
+	HOST_CHECK(host_rtcc.recoveries == recoveries, "%s: %u recoveries, expected %u", what, host_rtcc.recoveries, recoveries);
+	HOST_CHECK(host_cycles - begin < FAULTS_TEST_PERIODS*32*HOST_CYCLES_PER_MS, "%s: took %lu ms", what,
+		(unsigned long)((host_cycles - begin)/HOST_CYCLES_PER_MS));
+	if(expected != TWI_SUCCESS) {
+		HOST_CHECK(!memcmp(&time, &faults_untouched, sizeof(time)), "%s: result changed", what);
+		HOST_CHECK(!(PORTD & HAL_PIN_ERROR) == (expected == RTCC_DATA_ERROR), "%s: error LED %s", what,
+			(PORTD & HAL_PIN_ERROR) ? "on" : "off");
+	}
+	else
+		HOST_CHECK(time.hours == 12 && time.minutes == 0 && time.date == 17, "%s: read %02u:%02u:%02u", what,
+			time.hours, time.minutes, time.seconds);
+}
+
+/**
+ * @brief Writes CAL_REG under a fault.
+ */
+static void faults_test_write(void)
+{
+	uint8_t data = 0x55;
+
+	host_rtcc.regs[CAL_REG] = 0;
+	host_rtcc.nack = TWI_RETRIES + 1;
+	HOST_CHECK(rtcc_byte_write(CAL_REG, &data) == TW_MT_SLA_NACK && !host_rtcc.regs[CAL_REG],
+		"write NACKed on every attempt: CAL_REG 0x%02X", host_rtcc.regs[CAL_REG]);
+
+	host_rtcc.stall = 2;											/* Address, then the data byte */
+	HOST_CHECK(rtcc_byte_write(CAL_REG, &data) == TWI_SUCCESS && host_rtcc.regs[CAL_REG] == data,
+		"stalled write not repeated: CAL_REG 0x%02X", host_rtcc.regs[CAL_REG]);
+	host_rtcc.regs[CAL_REG] = 0;
+}
+
+/**
+ * @brief Loads the software clock while the RTCC fails.
+ */
+static void faults_test_clock(void)
+{
+	rtcc_time_t time;
+
+	host_rtcc_set(26, 10, 17, 6, 12, 0, 0);
+	HOST_CHECK(clock_load() == TWI_SUCCESS, "clock_load() failed");
+	clock_tick();
+
+	host_rtcc_set(26, 10, 17, 6, 18, 30, 0);
+	host_rtcc.nack = TWI_RETRIES + 1;
+	HOST_CHECK(clock_load() == TW_MT_SLA_NACK, "clock_load() of a NACK succeeded");
+	clock_get(&time);
+	HOST_CHECK(time.hours == 12 && time.seconds == 1, "clock %02u:%02u:%02u after a failed load",
+		time.hours, time.minutes, time.seconds);
+
+	host_rtcc.regs[MONTH_REG] = 0x13;
+	HOST_CHECK(clock_load() == RTCC_DATA_ERROR, "clock_load() of month 13 succeeded");
+	clock_get(&time);
+	HOST_CHECK(time.hours == 12 && time.month == 10, "clock %02u:%02u month %u after invalid registers",
+		time.hours, time.minutes, time.month);
+
+	host_rtcc.regs[MONTH_REG] = 0x10;
+	HOST_CHECK(clock_load() == TWI_SUCCESS, "clock_load() failed after the faults");
+	clock_get(&time);
+	HOST_CHECK(time.hours == 18 && time.minutes == 30, "clock %02u:%02u after the faults", time.hours, time.minutes);
+}
+
+int main(void)
+{
+	static const struct{
+		uint8_t reg, value;
+	}invalid[] = {
+		{SEC_REG, ST_OSC_MASK|0x0A}, {MIN_REG, 0x60}, {HOUR_REG, 0x24}, {DAY_REG, 0x08},
+		{DATE_REG, 0x00}, {DATE_REG, 0x32}, {MONTH_REG, LP_MASK|0x00}, {YEAR_REG, 0xA0},
+	};
+
+	twi_init();
+	sei();
+	host_rtcc_set(26, 10, 17, 6, 12, 0, 0);
+
+	host_rtcc.nack = TWI_RETRIES + 1;
+	faults_test_read("NACK on every attempt", TW_MT_SLA_NACK, 0);
+	faults_test_read("after the NACKs", TWI_SUCCESS, 0);
+
+	for(uint8_t b=1; b<=1 + RTCC_TIME_LEN; b++) {					/* Address and every byte read */
+		char what[32];
+		sprintf(what, "stall at byte %u", b);
+		host_rtcc.stall = b;
+		faults_test_read(what, TWI_SUCCESS, 1);
+	}
+
+	for(uint8_t i=0; i<sizeof(invalid)/sizeof(invalid[0]); i++) {
+		char what[32];
+		uint8_t keep = host_rtcc.regs[invalid[i].reg];
+		sprintf(what, "register 0x%02X = 0x%02X", invalid[i].reg, invalid[i].value);
+		host_rtcc.regs[invalid[i].reg] = invalid[i].value;
+		faults_test_read(what, RTCC_DATA_ERROR, 0);
+		host_rtcc.regs[invalid[i].reg] = keep;
+	}
+	faults_test_read("valid registers", TWI_SUCCESS, 0);
+
+	faults_test_write();
+	faults_test_clock();
+	HOST_CHECK(!(power_holds & POWER_HOLD_TWI), "POWER_HOLD_TWI kept");
+
+	return host_result("test_faults");
+}
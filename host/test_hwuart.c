@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <string.h>
+
+/* The hardware USART backend (hwuart.c) behind the softuart API at its default of
+ * 115200 baud: every character is echoed, also from a sender which is off by
+ * HWUART_TEST_SKEW, and the output is looped back to the input. Timer0 stays off,
+ * a full ring and a wrong baud rate are counted as dropped and framing errors. */
+
+#define SOFTUART_HW
+#include "hal.h"
+#include "hwuart.c"
+
+#define HWUART_TEST_SKEW		2						/* Percent */
+
+/**
+ * @brief Waits until the last stop bit is out.
+ */
+static void hwuart_test_drain(void)
+{
+	while(softuart_transmit_busy())
+		power_idle();
+	HOST_CHECK(!(power_holds & POWER_HOLD_UART_TX), "POWER_HOLD_UART_TX kept after the frames");
+}
+
+/**
+ * @brief Sends all characters 1 to 255 at a baud rate and checks the echo.
+ * @param baud Baud rate of the sender
+ */
+static void hwuart_test_echo(uint32_t baud)
+{
+	char sent[16], *echo;
+	unsigned short dropped, framing;
+
+	for(unsigned first=1; first<256; first+=sizeof(sent)-1) {
+		for(unsigned i=0; i<sizeof(sent)-1; i++)
+			sent[i] = first + i < 256 ? first + i : '.';
+		sent[sizeof(sent)-1] = 0;
+		host_uart_send(sent, baud);
+
+		for(unsigned i=0; i<sizeof(sent)-1; i++)
+			softuart_putchar(softuart_getchar());
+		hwuart_test_drain();
+
+		echo = (char*)host_uart_output();
+		if(!HOST_CHECK(!memcmp(echo, sent, sizeof(sent)), "echo of 0x%02X.. from %lu baud differs",
+			first, (unsigned long)baud))
+			break;
+	}
+	softuart_get_rx_errors(&dropped, &framing);
+	HOST_CHECK(!dropped && !framing, "%u dropped, %u framing errors from %lu baud", dropped, framing, (unsigned long)baud);
+	HOST_CHECK(!TCCR0B && !TIMSK0, "Timer0 used by the USART backend");
+}
+
+/**
+ * @brief Loops the output back to the input.
+ */
+static void hwuart_test_loopback(void)
+{
+	static const char text[] = "Loopback through USART0\r";
+	char back[sizeof(text)];
+
+	softuart_puts(text);
+	/* Shift register and transmit buffer take the first two */
+	HOST_CHECK(softuart_tx_high_water() == sizeof(text) - 3, "high water %u", softuart_tx_high_water());
+	hwuart_test_drain();
+	host_uart_send(host_uart_output(), SOFTUART_BAUD_RATE);
+	for(unsigned i=0; i<sizeof(text)-1; i++)
+		back[i] = softuart_getchar();
+	back[sizeof(text)-1] = 0;
+	HOST_CHECK(!strcmp(back, text), "looped back \"%s\"", back);
+	HOST_CHECK(!softuart_kbhit(), "more characters than sent");
+}
+
+/**
+ * @brief Overfills the receive ring and sends at half the baud rate.
+ */
+static void hwuart_test_errors(void)
+{
+	char burst[2*SOFTUART_IN_BUF_SIZE + 1];
+	unsigned short dropped, framing;
+	unsigned n = 0;
+
+	memset(burst, 'x', sizeof(burst) - 1);
+	burst[sizeof(burst)-1] = 0;
+	host_uart_send(burst, SOFTUART_BAUD_RATE);
+	hal_delay_ms((sizeof(burst)*10*1000UL + SOFTUART_BAUD_RATE - 1)/SOFTUART_BAUD_RATE + 1);
+	while(softuart_kbhit()) {
+		softuart_getchar();
+		n++;
+	}
+	softuart_get_rx_errors(&dropped, &framing);
+	HOST_CHECK(n == SOFTUART_IN_BUF_SIZE - 1 && dropped == sizeof(burst) - SOFTUART_IN_BUF_SIZE && !framing,
+		"burst: %u read, %u dropped, %u framing errors", n, dropped, framing);
+
+	host_uart_send("\x01", SOFTUART_BAUD_RATE/2);				/* Stop bit sampled in a data bit */
+	hal_delay_ms(1);
+	softuart_get_rx_errors(&dropped, &framing);
+	HOST_CHECK(framing == 1 && !softuart_kbhit(), "%u framing errors at half the baud rate", framing);
+}
+
+int main(void)
+{
+	host_uart_baud = SOFTUART_BAUD_RATE;
+	softuart_init();
+	sei();
+
+	hwuart_test_echo(SOFTUART_BAUD_RATE);
+	hwuart_test_echo(SOFTUART_BAUD_RATE*(100 + HWUART_TEST_SKEW)/100);
+	hwuart_test_echo(SOFTUART_BAUD_RATE*(100 - HWUART_TEST_SKEW)/100);
+	hwuart_test_loopback();
+	hwuart_test_errors();
+
+	printf("%lu baud, UBRR0 %u, U2X0 %u\n", (unsigned long)SOFTUART_BAUD_RATE, UBRR0L | UBRR0H<<8,
+		(UCSR0A>>U2X0) & 1);
+
+	return host_result("test_hwuart");
+}
@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "hal.h"
+
+/* Resuming an interrupted fade: fade_resume() after every second of a replayed fade
+ * must set the level the fade had reached and end it at the same time. At boot in the
+ * middle of the sunrise the firmware (main.c) continues it from the schedule. */
+
+#define main firmware_main
+#include "main.c"
+#undef main
+
+#define RESUME_LEVEL_TOL		1						/* Levels, rounding of the stretched curve */
+#define RESUME_END_TOL			60						/* Seconds */
+#define RESUME_AFTER			240						/* Seconds into the sunrise at boot */
+
+static const uint8_t resume_cases[][3] = {				/* From, target, minutes */
+	{0, 255, 0}, {255, 0, 0}, {0, 255, 30}, {255, 0, 5}, {20, 200, 10},
+	{200, 20, 0}, {0, 128, 90}, {128, 0, 1}, {1, 254, 0}, {254, 1, 200}
+};
+
+static uint8_t resume_replay[20000];					/* Level after every second */
+
+/**
+ * @brief Runs a fade to its end.
+ * @return Duration in seconds
+ */
+static uint16_t resume_run(uint8_t* levels)
+{
+	uint16_t t = 0;
+
+	if(levels)
+		levels[0] = fade_get_level();
+	while(fade_active()) {
+		fade_tick();
+		t++;
+		if(levels)
+			levels[t] = fade_get_level();
+	}
+
+	return t;
+}
+
+static void resume_fades(void)
+{
+	uint8_t from, target, minutes, expected;
+	uint16_t duration, rest;
+
+	for(uint8_t k=0; k<sizeof(resume_cases)/sizeof(resume_cases[0]); k++) {
+		from = resume_cases[k][0];
+		target = resume_cases[k][1];
+		minutes = resume_cases[k][2];
+
+		fade_init();
+		fade_set_level(from);
+		fade_start(target, minutes);
+		duration = resume_run(resume_replay);
+		HOST_CHECK(fade_get_level() == target, "fade %u -> %u ends at %u", from, target, fade_get_level());
+		if(minutes)
+			HOST_CHECK(abs(duration - minutes*60) <= RESUME_END_TOL, "fade %u -> %u in %u min takes %u s",
+				from, target, minutes, duration);
+
+		for(uint16_t t=0; t<duration + 5; t++) {
+			expected = t < duration ? resume_replay[t] : target;
+			fade_init();
+			fade_resume(from, target, minutes, t);
+			if(!HOST_CHECK(abs(fade_get_level() - expected) <= RESUME_LEVEL_TOL,
+				"fade %u -> %u in %u min resumed after %u s at %u, expected %u",
+				from, target, minutes, t, fade_get_level(), expected))
+				break;
+			rest = resume_run(0);
+			if(!HOST_CHECK(abs(rest - (t < duration ? duration - t : 0)) <= RESUME_END_TOL,
+				"fade %u -> %u in %u min resumed after %u s ends after %u s, expected %u",
+				from, target, minutes, t, rest, t < duration ? duration - t : 0))
+				break;
+		}
+	}
+}
+
+static void resume_firmware(void)
+{
+	firmware_main();
+}
+
+/**
+ * @brief Boots the firmware RESUME_AFTER seconds into the default sunrise.
+ */
+static void resume_boot(void)
+{
+	fade_init();
+	fade_start(FADE_LEVEL_FULL, 0);
+	for(uint16_t t=0; t<RESUME_AFTER; t++)
+		fade_tick();
+	resume_replay[0] = fade_get_level();
+
+	host_ee_erase();
+	host_rtcc_set(26, 10, 17, 6, SUNRISE_HOUR, SUNRISE_MINUTE + RESUME_AFTER/60, RESUME_AFTER%60);
+	host_run_until(resume_firmware, HOST_CYCLES_PER_S/2);
+
+	HOST_CHECK(abs(fade_get_level() - resume_replay[0]) <= RESUME_LEVEL_TOL && fade_active(),
+		"boot %u s into the sunrise at level %u, expected %u", RESUME_AFTER, fade_get_level(), resume_replay[0]);
+	HOST_CHECK(host_pwm_output() == fade_get_level(), "PWM %u at level %u",
+		host_pwm_output(), fade_get_level());
+}
+
+int main(void)
+{
+	resume_fades();
+	resume_boot();
+
+	return host_result("test_resume");
+}
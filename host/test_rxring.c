@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <string.h>
+#include "hal.h"
+
+/* The receive ring of the software UART (softuart.c): the ISR fills it while the
+ * reader takes characters at different paces. A full ring drops and counts the new
+ * characters, the read ones stay in order and read + dropped equals sent, also after
+ * the indices wrapped many times. A missing stop bit is counted as framing error. */
+
+#include "softuart.c"
+
+#define RXRING_TEST_LEN			200						/* Characters per run */
+#define RXRING_TEST_CHAR_US		(10*1000000UL/SOFTUART_BAUD_RATE)
+
+ISR(PCINT2_vect)
+{
+	softuart_rx_edge();
+}
+
+/**
+ * @brief Waits for a number of character times.
+ */
+static void rxring_test_wait(uint16_t chars)
+{
+	host_run(chars*RXRING_TEST_CHAR_US*HOST_CYCLES_PER_MS/1000);
+}
+
+/**
+ * @brief Sends characters while the reader takes one every period.
+ * @param period Character times between two reads, in 1/4
+ */
+static void rxring_test_pace(uint16_t period)
+{
+	static char sent[RXRING_TEST_LEN + 1], got[RXRING_TEST_LEN];
+	unsigned short dropped, framing, before;
+	uint16_t n = 0, s = 0;
+	uint64_t next, end;
+
+	softuart_get_rx_errors(&before, &framing);
+	for(uint16_t i=0; i<RXRING_TEST_LEN; i++)
+		sent[i] = 'A' + (i*7 + period) % 58;
+	sent[RXRING_TEST_LEN] = 0;
+	host_uart_send(sent, SOFTUART_BAUD_RATE);
+
+	next = host_cycles;
+	end = next + (RXRING_TEST_LEN + 1)*RXRING_TEST_CHAR_US*HOST_CYCLES_PER_MS/1000;
+	while(n < RXRING_TEST_LEN && (host_cycles < end || softuart_kbhit())) {
+		next += period*RXRING_TEST_CHAR_US*HOST_CYCLES_PER_MS/4000;
+		host_run(next - host_cycles);							/* Busy elsewhere */
+		if(softuart_kbhit())
+			got[n++] = softuart_getchar();
+	}
+	softuart_get_rx_errors(&dropped, &framing);
+	dropped -= before;
+
+	for(uint16_t i=0; i<n; i++) {								/* Subsequence of the sent characters */
+		while(s < RXRING_TEST_LEN && sent[s] != got[i])
+			s++;
+		if(!HOST_CHECK(s++ < RXRING_TEST_LEN, "pace %u/4: character %u out of order", period, i))
+			break;
+	}
+	HOST_CHECK(n + dropped == RXRING_TEST_LEN && !framing, "pace %u/4: %u read, %u dropped, %u framing errors",
+		period, n, dropped, framing);
+	if(period <= 4)
+		HOST_CHECK(!dropped, "pace %u/4: %u dropped although the reader keeps up", period, dropped);
+	else
+		HOST_CHECK(dropped, "pace %u/4: nothing dropped although the reader is slower", period);
+}
+
+/**
+ * @brief Fills the ring without reading.
+ */
+static void rxring_test_full(void)
+{
+	char burst[SOFTUART_IN_BUF_SIZE + 9];
+	unsigned short dropped, framing, before;
+	uint16_t n = 0;
+
+	softuart_get_rx_errors(&before, &framing);
+	for(uint16_t i=0; i<sizeof(burst)-1; i++)
+		burst[i] = '0' + i % 64;
+	burst[sizeof(burst)-1] = 0;
+	host_uart_send(burst, SOFTUART_BAUD_RATE);
+	rxring_test_wait(sizeof(burst) + 1);
+
+	while(softuart_kbhit()) {
+		char ch = softuart_getchar();
+		HOST_CHECK(ch == burst[n], "character %u of the full ring: 0x%02X", n, ch);
+		n++;
+	}
+	softuart_get_rx_errors(&dropped, &framing);
+	dropped -= before;
+	HOST_CHECK(n == SOFTUART_IN_BUF_SIZE - 1 && dropped == sizeof(burst) - SOFTUART_IN_BUF_SIZE,
+		"full ring: %u read, %u dropped", n, dropped);
+}
+
+int main(void)
+{
+	unsigned short dropped, framing;
+
+	host_uart_baud = SOFTUART_BAUD_RATE;
+	softuart_init();
+	sei();
+
+	rxring_test_full();
+	for(uint16_t period=2; period<=8; period++)
+		rxring_test_pace(period);
+
+	host_uart_send("\x01", SOFTUART_BAUD_RATE/2);				/* Stop bit sampled in a data bit */
+	rxring_test_wait(3);
+	softuart_get_rx_errors(&dropped, &framing);
+	HOST_CHECK(framing == 1 && !softuart_kbhit(), "%u framing errors at half the baud rate", framing);
+
+	return host_result("test_rxring");
+}
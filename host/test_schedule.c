@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <string.h>
+#include "hal.h"
+#include "schedule.h"
+#include "fade.h"
+
+/* The daily schedule (schedule.c): a table added out of order is sorted and survives
+ * the EEPROM, then a week is stepped minute by minute and the next-event lookup is
+ * compared with a search through every event, across midnight and the weekdays.
+ * Jumps of the clock (sleep, corrections) must not repeat or lose the latest event. */
+
+#define SCHEDULE_TEST_DAY		(24*60)					/* Minutes */
+#define SCHEDULE_TEST_WEEK		(7*SCHEDULE_TEST_DAY)
+#define SCHEDULE_DAY(d)			(1<<((d) - 1))			/* Mask of day d of the RTCC (1-7) */
+
+static const schedule_event_t schedule_test_events[] = {	/* Not sorted, all different */
+	{23, 59, SCHEDULE_ALL_DAYS, 40, 0},
+	{ 7,  0, 0x1F, 200, 30},								/* Monday to Friday */
+	{ 0,  0, SCHEDULE_DAY(1), 10, 1},						/* Monday, midnight from Sunday */
+	{ 9, 30, SCHEDULE_DAY(6)|SCHEDULE_DAY(7), 180, 60},		/* Weekend */
+	{ 7,  0, SCHEDULE_DAY(3), 255, 5},						/* Same minute, added later */
+	{20, 15, SCHEDULE_ALL_DAYS, 0, 45},
+	{12,  0, SCHEDULE_DAY(7), 120, 0},						/* Sunday, last day of the week */
+};
+
+#define SCHEDULE_TEST_N			(sizeof(schedule_test_events)/sizeof(schedule_test_events[0]))
+
+/**
+ * @brief Sets a time from the minute of the week, day 1 starts at minute 0.
+ */
+static void schedule_test_time(rtcc_time_t* time, uint32_t minute)
+{
+	minute %= SCHEDULE_TEST_WEEK;
+	memset(time, 0, sizeof(*time));
+	time->day = minute/SCHEDULE_TEST_DAY + 1;
+	time->hours = minute/60 % 24;
+	time->minutes = minute % 60;
+	time->date = 1;
+	time->month = 1;
+}
+
+/**
+ * @brief Searches every event for the last one which starts at a minute of the week,
+ * equal times in the order of the table.
+ * @return Index or -1
+ */
+static int8_t schedule_test_at(uint32_t minute)
+{
+	schedule_event_t event;
+	uint8_t day;
+	int8_t found = -1;
+
+	minute %= SCHEDULE_TEST_WEEK;
+	day = minute/SCHEDULE_TEST_DAY + 1;
+	for(uint8_t i=0; i<schedule_count(); i++) {
+		schedule_get(i, &event);
+		if(event.hours*60 + event.minutes == minute % SCHEDULE_TEST_DAY && (event.days & SCHEDULE_DAY(day)))
+			found = i;
+	}
+	return found;
+}
+
+/**
+ * @brief Compares an event with the event at an index of the table.
+ */
+static uint8_t schedule_test_is(const schedule_event_t* event, int8_t index)
+{
+	schedule_event_t expected;
+
+	if(index < 0)
+		return !event;
+	schedule_get(index, &expected);
+	return event && !memcmp(event, &expected, sizeof(expected));
+}
+
+/**
+ * @brief Checks the table order and the EEPROM round trip.
+ */
+static void schedule_test_table(void)
+{
+	schedule_event_t prev, event;
+
+	host_ee_erase();
+	HOST_CHECK(!schedule_load(), "erased EEPROM loaded a schedule");
+
+	for(uint8_t i=0; i<SCHEDULE_TEST_N; i++)
+		HOST_CHECK(schedule_add(&schedule_test_events[i]), "event %u not added", i);
+	event = schedule_test_events[0];
+	event.days = 0;
+	HOST_CHECK(!schedule_add(&event), "event without days added");
+	event.days = 0x80;
+	HOST_CHECK(!schedule_add(&event), "event with day 8 added");
+
+	for(uint8_t i=1; i<schedule_count(); i++) {
+		schedule_get(i-1, &prev);
+		schedule_get(i, &event);
+		HOST_CHECK(prev.hours*60 + prev.minutes <= event.hours*60 + event.minutes, "event %u not sorted", i);
+		if(prev.hours == 7 && event.hours == 7)
+			HOST_CHECK(prev.days == 0x1F, "events at 07:00 not in the order added");
+	}
+
+	schedule_save();
+	schedule_remove(0);
+	HOST_CHECK(schedule_count() == SCHEDULE_TEST_N - 1, "event not removed");
+	HOST_CHECK(schedule_load() == SCHEDULE_TEST_N, "%u events loaded", schedule_count());
+	HOST_CHECK(!schedule_get(SCHEDULE_TEST_N, &event), "event behind the table");
+}
+
+/**
+ * @brief Checks every minute of a week and a half, starting on Sunday evening.
+ */
+static void schedule_test_minutes(void)
+{
+	uint32_t start = 6*SCHEDULE_TEST_DAY + 20*60;
+	const schedule_event_t* due;
+	rtcc_time_t time;
+	int8_t next = -1;
+
+	schedule_test_time(&time, start);
+	schedule_seek(&time);
+
+	for(uint32_t m=start + 1; m<start + SCHEDULE_TEST_WEEK*3/2; m++) {
+		int8_t expected = schedule_test_at(m);
+
+		schedule_test_time(&time, m);
+		due = schedule_check(&time);
+		if(!HOST_CHECK(schedule_test_is(due, expected), "day %u %02u:%02u: event %d expected",
+			time.day, time.hours, time.minutes, expected))
+			break;
+		HOST_CHECK(!schedule_check(&time), "day %u %02u:%02u: checked twice", time.day, time.hours, time.minutes);
+
+		/* The next event of the table, the first one tomorrow after the last one today */
+		for(next=0; next<(int8_t)schedule_count(); next++) {
+			schedule_event_t event;
+			schedule_get(next, &event);
+			if(event.hours*60 + event.minutes > m % SCHEDULE_TEST_DAY)
+				break;
+		}
+		HOST_CHECK(schedule_test_is(schedule_next(), next < (int8_t)schedule_count() ? next : 0),
+			"day %u %02u:%02u: wrong next event", time.day, time.hours, time.minutes);
+	}
+}
+
+/**
+ * @brief Checks the event in effect against a search back through the week.
+ */
+static void schedule_test_current(void)
+{
+	const schedule_event_t* current;
+	rtcc_time_t time;
+	uint16_t age;
+	uint8_t from;
+
+	for(uint32_t m=0; m<SCHEDULE_TEST_WEEK; m++) {
+		int8_t expected = -1, before = -1;
+		uint32_t back, found = 0;
+
+		for(back=0; back<=SCHEDULE_TEST_WEEK + SCHEDULE_TEST_DAY && before < 0; back++) {
+			int8_t at;
+			uint32_t minute = (m + 2*SCHEDULE_TEST_WEEK - back) % SCHEDULE_TEST_WEEK;
+			schedule_event_t event;
+
+			for(at=schedule_count() - 1; at>=0; at--) {		/* Equal times: the last one is later */
+				schedule_get(at, &event);
+				if(event.hours*60 + event.minutes != minute % SCHEDULE_TEST_DAY
+					|| !(event.days & SCHEDULE_DAY(minute/SCHEDULE_TEST_DAY + 1)))
+					continue;
+				if(expected < 0) {
+					expected = at;
+					found = back;
+				}
+				else if(before < 0)
+					before = at;
+			}
+		}
+
+		schedule_test_time(&time, m);
+		current = schedule_current(&time, &age, &from);
+		if(!HOST_CHECK(schedule_test_is(current, expected) && age == found, "day %u %02u:%02u: event in effect %d, %u min",
+			time.day, time.hours, time.minutes, expected, found))
+			break;
+		if(before >= 0) {
+			schedule_event_t event;
+			schedule_get(before, &event);
+			HOST_CHECK(from == event.level, "day %u %02u:%02u: from level %u, expected %u",
+				time.day, time.hours, time.minutes, from, event.level);
+		}
+	}
+}
+
+/**
+ * @brief Checks jumps of the clock.
+ */
+static void schedule_test_jumps(void)
+{
+	rtcc_time_t time;
+	schedule_event_t event;
+
+	/* Wednesday: asleep from 06:00 to 08:00, the later one of the two events at 07:00 */
+	schedule_test_time(&time, 2*SCHEDULE_TEST_DAY + 6*60);
+	schedule_seek(&time);
+	schedule_test_time(&time, 2*SCHEDULE_TEST_DAY + 8*60);
+	HOST_CHECK(schedule_check(&time) && schedule_check(&time) == 0, "event missed in sleep");
+	schedule_test_time(&time, 2*SCHEDULE_TEST_DAY + 6*60);
+	schedule_seek(&time);
+	schedule_test_time(&time, 2*SCHEDULE_TEST_DAY + 8*60);
+	schedule_get(schedule_test_at(2*SCHEDULE_TEST_DAY + 7*60), &event);
+	HOST_CHECK(event.level == 255 && !memcmp(schedule_check(&time), &event, sizeof(event)),
+		"not the latest event after sleep");
+
+	/* Corrected backwards across 07:00: not repeated */
+	schedule_test_time(&time, 2*SCHEDULE_TEST_DAY + 7*60 - 2);
+	HOST_CHECK(!schedule_check(&time), "correction backwards returned an event");
+	schedule_test_time(&time, 2*SCHEDULE_TEST_DAY + 7*60 + 1);
+	HOST_CHECK(!schedule_check(&time), "event repeated after a correction backwards");
+
+	/* Sunday 23:58 to Monday 00:00 in one step: only Monday counts */
+	schedule_test_time(&time, 6*SCHEDULE_TEST_DAY + 23*60 + 58);
+	schedule_seek(&time);
+	schedule_test_time(&time, SCHEDULE_TEST_WEEK);
+	HOST_CHECK(schedule_test_is(schedule_check(&time), schedule_test_at(0)), "midnight event on Monday not due");
+
+	schedule_test_time(&time, 6*SCHEDULE_TEST_DAY + 12*60);
+	schedule_seek(&time);
+	HOST_CHECK(schedule_test_is(schedule_next(), schedule_test_at(6*SCHEDULE_TEST_DAY + 12*60)),
+		"seek did not find the event at the same minute");
+}
+
+int main(void)
+{
+	schedule_test_table();
+	schedule_test_minutes();
+	schedule_test_current();
+	schedule_test_jumps();
+
+	return host_result("test_schedule");
+}
@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <string.h>
+#include "hal.h"
+#include "MCP7940M.h"
+#include "power.h"
+
+/* Setting the time of the RTCC (MCP7940M.c): the oscillator is stopped, SEC_REG to
+ * YEAR_REG are written in one burst, the oscillator is restarted and the time is read
+ * back. The call is moved across a carry of the old time in steps of 1ms, the new
+ * time must be exact and keep counting from its first second. VBATEN stays set,
+ * the 12-hour format is cleared, invalid times and a stalled burst are covered. */
+
+#define SETTIME_TEST_SWEEP		40						/* ms before the carry where the call starts */
+
+static const rtcc_time_t settime_new = {0, 30, 6, 5, 1, 1, 27};
+
+/**
+ * @brief Compares the registers of the RTCC model with a time.
+ */
+static uint8_t settime_test_regs(const rtcc_time_t* time)
+{
+	rtcc_time_t regs;
+
+	return rtcc_decode_time(host_rtcc.regs, &regs) && !memcmp(&regs, time, sizeof(regs));
+}
+
+/**
+ * @brief Sets the time with the carry of the old time at a distance.
+ * @param ms Milliseconds from the call to the carry
+ */
+static void settime_test_carry(uint8_t ms)
+{
+	uint16_t writes;
+	uint8_t ERR_CODE;
+
+	host_rtcc_set(26, 12, 31, 4, 23, 59, 59);
+	host_run(HOST_CYCLES_PER_S - ms*HOST_CYCLES_PER_MS);
+	writes = host_rtcc.writes;
+
+	ERR_CODE = rtcc_set_time(&settime_new);
+	HOST_CHECK(ERR_CODE == TWI_SUCCESS, "%u ms before the carry: 0x%02X", ms, ERR_CODE);
+	HOST_CHECK(host_rtcc.writes - writes == 1 + RTCC_TIME_LEN + 1, "%u ms before the carry: %u bytes written",
+		ms, host_rtcc.writes - writes);					/* Stop, burst, restart */
+	HOST_CHECK(settime_test_regs(&settime_new), "%u ms before the carry: registers differ", ms);
+	HOST_CHECK((host_rtcc.regs[SEC_REG] & ST_OSC_MASK) && (host_rtcc.regs[OSCON_REG] & OSCON_MASK),
+		"%u ms before the carry: oscillator not running", ms);
+	HOST_CHECK(host_rtcc.regs[DAY_REG] & 0x08, "%u ms before the carry: VBATEN cleared", ms);
+	HOST_CHECK(!(host_rtcc.regs[MONTH_REG] & LP_MASK), "%u ms before the carry: LP kept in 2027", ms);
+
+	host_run(90*HOST_CYCLES_PER_S);
+	HOST_CHECK(host_rtcc_seconds() == 6*3600L + 31*60 + 30, "%u ms before the carry: %lu s after 90 s", ms,
+		(unsigned long)host_rtcc_seconds());
+}
+
+int main(void)
+{
+	rtcc_time_t time = settime_new;
+	uint16_t writes;
+	uint8_t ERR_CODE;
+
+	twi_init();
+	sei();
+
+	for(uint8_t ms=0; ms<=SETTIME_TEST_SWEEP; ms++)
+		settime_test_carry(ms);
+
+	/* Invalid times are not written and the oscillator keeps running */
+	host_rtcc_set(26, 10, 17, 6, 12, 0, 0);
+	writes = host_rtcc.writes;
+	time.hours = 24;
+	HOST_CHECK(rtcc_set_time(&time) == RTCC_RANGE_ERROR, "hour 24 accepted");
+	time = settime_new;
+	time.date = 32;
+	HOST_CHECK(rtcc_set_time(&time) == RTCC_RANGE_ERROR, "date 32 accepted");
+	time = settime_new;
+	time.day = 0;
+	HOST_CHECK(rtcc_set_time(&time) == RTCC_RANGE_ERROR, "day 0 accepted");
+	HOST_CHECK(host_rtcc.writes == writes && (host_rtcc.regs[OSCON_REG] & OSCON_MASK), "invalid time written");
+
+	/* 12-hour format in the RTCC */
+	host_rtcc.regs[HOUR_REG] = HOUR12_MASK|0x20|0x01;		/* 1 PM */
+	HOST_CHECK(rtcc_set_time(&settime_new) == TWI_SUCCESS && settime_test_regs(&settime_new)
+		&& !(host_rtcc.regs[HOUR_REG] & HOUR12_MASK), "12-hour format kept: HOUR_REG 0x%02X", host_rtcc.regs[HOUR_REG]);
+
+	/* Leap year: LP follows the year written */
+	time = settime_new;
+	time.month = 2;
+	time.date = 29;
+	time.year = 28;
+	time.day = 2;
+	HOST_CHECK(rtcc_set_time(&time) == TWI_SUCCESS && settime_test_regs(&time), "29.02.28 not set");
+
+	/* Stalled in the middle of the burst, repeated in full */
+	host_rtcc_set(26, 10, 17, 6, 12, 0, 0);
+	host_rtcc.recoveries = 0;
+	writes = host_rtcc.writes;
+	host_rtcc.stall = 8 + 2 + 2*2 + 1 + 3;					/* Read, stop, two polls of OSCON, address, 3rd byte */
+	ERR_CODE = rtcc_set_time(&settime_new);
+	HOST_CHECK(ERR_CODE == TWI_SUCCESS && host_rtcc.recoveries == 1 && settime_test_regs(&settime_new),
+		"stalled burst: 0x%02X, %u recoveries", ERR_CODE, host_rtcc.recoveries);
+	HOST_CHECK(host_rtcc.writes - writes == 1 + 2 + RTCC_TIME_LEN + 1, "stalled burst: %u bytes written",
+		host_rtcc.writes - writes);
+	HOST_CHECK(!(power_holds & POWER_HOLD_TWI), "POWER_HOLD_TWI kept");
+
+	return host_result("test_settime");
+}
@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <string.h>
+#include "hal.h"
+#include "softuart.h"
+#include "MCP7940M.h"
+#include "clock.h"
+#include "fade.h"
+#include "power.h"
+#include "schedule.h"
+#include "shell.h"
+
+/* The command shell (shell.c) over the software UART: a script of command lines is
+ * typed and every answer, the returned flags and the effect on the RTCC, the schedule
+ * and the output are checked. A line split over several calls, backspace, a line
+ * which is too long and wrong arguments are covered. */
+
+typedef struct{
+	const char* input;
+	const char* output;									/* Expected answer, exactly */
+	uint8_t flags;										/* Returned by shell_service() */
+}shell_test_step_t;
+
+static const shell_test_step_t shell_test_script[] = {
+	{"\r",						"", 0},
+	{"help\r",					"help time cal calib list add del fade level stats temp \r", 0},
+	{"time\r",					"12:00:00 day 6 17.10.26\r", 0},
+	{"time 13 14 15\r",			"13:14:15 day 6 17.10.26\r", SHELL_TIME_CHANGED},
+	{"time 7:08:09 1 19 10 26\r", "07:08:09 day 1 19.10.26\r", SHELL_TIME_CHANGED},
+	{"time 25 0 0\r",			"?\r", 0},
+	{"time 1 2\r",				"?\r", 0},
+	{"cal 130\r",				"cal 0x82\r", 0},
+	{"cal 256\r",				"?\r", 0},
+	{"add 7 30 127 200 15\r",	"0: 07:30 days 0x7f level 200 in 15 min\r", SHELL_SCHEDULE_CHANGED},
+	{"add 6 0 1 50 0\r",		"0: 06:00 days 0x01 level 50 in 0 min\r1: 07:30 days 0x7f level 200 in 15 min\r",
+								SHELL_SCHEDULE_CHANGED},
+	{"add 24 0 1 50 0\r",		"?\r", 0},
+	{"add 6 0 128 50 0\r",		"?\r", 0},
+	{"list\r",					"0: 06:00 days 0x01 level 50 in 0 min\r1: 07:30 days 0x7f level 200 in 15 min\r", 0},
+	{"del 5\r",					"?\r", 0},
+	{"del 0\r",					"0: 07:30 days 0x7f level 200 in 15 min\r", SHELL_SCHEDULE_CHANGED},
+	{"level 77\r",				"", 0},
+	{"level 256\r",				"?\r", 0},
+	{"fade 200 1\r",			"", SHELL_FADE_STARTED},
+	{"timx\be\r",				"07:08:09 day 1 19.10.26\r", 0},
+	{"bogus\r",					"?\r", 0},
+	{"help 1\r",				"?\r", 0},
+	{"list 1\r",				"?\r", 0},
+	{"time 1 2 3 4 5 6 7 8\r",	"?\r", 0},
+	{"0123456789012345678901234567890123456789\r", "?\r", 0},
+	{"cal\r",					"cal 0x82\r", 0},
+};
+
+#define SHELL_TEST_STEPS		(sizeof(shell_test_script)/sizeof(shell_test_script[0]))
+#define SHELL_TEST_CHAR_MS		(10*1000UL/SOFTUART_BAUD_RATE + 1)
+
+ISR(PCINT2_vect)
+{
+	softuart_rx_edge();
+}
+
+/**
+ * @brief Types a line while running the shell and returns its answer.
+ * @param input Characters to type
+ * @param flags Pointer where the returned flags should be stored
+ */
+static const char* shell_test_type(const char* input, uint8_t* flags)
+{
+	host_uart_send(input, SOFTUART_BAUD_RATE);
+	*flags = 0;
+	for(size_t i=0; i<=strlen(input); i++) {				/* Served by the main loop meanwhile */
+		hal_delay_ms(SHELL_TEST_CHAR_MS);
+		*flags |= shell_service();
+	}
+	while(softuart_transmit_busy())
+		power_idle();
+	hal_delay_ms(SHELL_TEST_CHAR_MS);						/* Stop bit of the last character */
+
+	return host_uart_output();
+}
+
+int main(void)
+{
+	const char* output;
+	uint8_t flags;
+	uint64_t begin;
+	schedule_event_t event;
+
+	host_uart_baud = SOFTUART_BAUD_RATE;
+	host_ee_erase();
+	host_rtcc_set(26, 10, 17, 6, 12, 0, 0);
+	softuart_init();
+	twi_init();
+	sei();
+	fade_init();
+	clock_load();
+
+	for(uint8_t i=0; i<SHELL_TEST_STEPS; i++) {
+		const shell_test_step_t* step = &shell_test_script[i];
+
+		output = shell_test_type(step->input, &flags);
+		HOST_CHECK(!strcmp(output, step->output) && flags == step->flags, "\"%s\": \"%s\" 0x%02X, expected \"%s\" 0x%02X",
+			step->input, output, flags, step->output, step->flags);
+
+		if(!strcmp(step->input, "time 13 14 15\r"))
+			HOST_CHECK(host_rtcc_seconds() == 13*3600L + 14*60 + 15, "RTCC not set");
+		if(!strcmp(step->input, "cal 130\r"))
+			HOST_CHECK(host_rtcc.regs[CAL_REG] == 130, "CAL_REG 0x%02X", host_rtcc.regs[CAL_REG]);
+		if(!strcmp(step->input, "level 77\r"))
+			HOST_CHECK(fade_get_level() == 77 && !fade_active(), "level %u", fade_get_level());
+		if(!strcmp(step->input, "fade 200 1\r"))
+			HOST_CHECK(fade_active(), "no fade");
+	}
+
+	/* The edited schedule was saved */
+	HOST_CHECK(schedule_load() == 1 && schedule_get(0, &event) && event.hours == 7 && event.level == 200,
+		"schedule not in EEPROM");
+
+	/* A line split over calls: the first part returns without waiting for the rest */
+	host_uart_send("ti", SOFTUART_BAUD_RATE);
+	hal_delay_ms(3*SHELL_TEST_CHAR_MS);
+	begin = host_cycles;
+	HOST_CHECK(!shell_service() && host_cycles == begin, "shell_service() waited for the end of the line");
+	output = shell_test_type("me\r", &flags);
+	HOST_CHECK(!strcmp(output, "07:08:09 day 1 19.10.26\r"), "split line: \"%s\"", output);
+
+	output = shell_test_type("stats\r", &flags);
+	HOST_CHECK(strstr(output, "UART: dropped 0, framing 0,") && strstr(output, "Level: 77 fading\r"),
+		"stats: \"%s\"", output);
+
+	return host_result("test_shell");
+}
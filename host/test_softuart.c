@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include <string.h>
+#include "hal.h"
+
+/* The software UART (softuart.c) at its baud rate, built by the makefile also with
+ * -DSOFTUART_BAUD_RATE=19200 and 38400: every character is received with the start
+ * edge and echoed, also from a sender which is off by SOFTUART_TEST_SKEW. */
+
+#include "softuart.c"
+
+#define SOFTUART_TEST_SKEW		2						/* Percent */
+
+ISR(PCINT2_vect)
+{
+	softuart_rx_edge();
+}
+
+/**
+ * @brief Sends all characters 1 to 255 at a baud rate and checks the echo.
+ * @param baud Baud rate of the sender
+ */
+static void softuart_test_echo(uint32_t baud)
+{
+	char sent[16], *echo;
+	unsigned short dropped, framing;
+
+	for(unsigned first=1; first<256; first+=sizeof(sent)-1) {
+		for(unsigned i=0; i<sizeof(sent)-1; i++)
+			sent[i] = first + i < 256 ? first + i : '.';
+		sent[sizeof(sent)-1] = 0;
+		host_uart_send(sent, baud);
+
+		for(unsigned i=0; i<sizeof(sent)-1; i++)
+			softuart_putchar(softuart_getchar());
+		while(softuart_transmit_busy())
+			power_idle();
+		hal_delay_ms(1);									/* Stop bit of the last character */
+
+		echo = (char*)host_uart_output();
+		if(!HOST_CHECK(!memcmp(echo, sent, sizeof(sent)), "echo of 0x%02X.. from %lu baud at %lu baud differs",
+			first, (unsigned long)baud, (unsigned long)SOFTUART_BAUD_RATE))
+			break;
+	}
+	softuart_get_rx_errors(&dropped, &framing);
+	HOST_CHECK(!dropped && !framing, "%u dropped, %u framing errors from %lu baud", dropped, framing, (unsigned long)baud);
+	HOST_CHECK(!(TCCR0B & SOFTUART_PRESC_MASKB), "Timer0 runs after the frames");
+}
+
+int main(void)
+{
+	host_uart_baud = SOFTUART_BAUD_RATE;
+	softuart_init();
+	sei();
+
+	softuart_test_echo(SOFTUART_BAUD_RATE);
+	softuart_test_echo(SOFTUART_BAUD_RATE*(100 + SOFTUART_TEST_SKEW)/100);
+	softuart_test_echo(SOFTUART_BAUD_RATE*(100 - SOFTUART_TEST_SKEW)/100);
+
+	printf("%lu baud, Timer0 top %u, prescaler %u\n", (unsigned long)SOFTUART_BAUD_RATE,
+		SOFTUART_TIMERTOP, SOFTUART_PRESCALE);
+
+	return host_result("test_softuart");
+}
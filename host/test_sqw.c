@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <string.h>
+#include "hal.h"
+
+/* The firmware (main.c) with RTCC_SQW_CLOCK instead of RTCC_ALARM_WAKE: the software
+ * clock advances on the falling edges of the 1Hz square wave on MFP. The square wave
+ * stops for a few seconds, the clock stands still meanwhile and the next check against
+ * the RTCC counts the missed seconds as drift, which "stats" reports. The MCU sleeps in
+ * power-down between the edges once the UART timed out, also after it was woken by a key. */
+
+#define RTCC_SQW_CLOCK
+#define main firmware_main
+#include "main.c"
+#undef main
+
+#define SQW_START				(13*3600L)
+#define SQW_GAP					(13*3600L + 32*60)		/* Square wave stopped, after the calibration at boot */
+#define SQW_GAP_SECONDS			5
+#define SQW_CHECK				(13*3600L + 40*60 + 30)	/* Next check of the software clock against the RTCC */
+#define SQW_KEYS_START			(13*3600L + 42*60)
+#define SQW_KEYS				"\rstats\r"
+#define SQW_END					(13*3600L + 48*60)
+
+static uint32_t sqw_ticks;								/* Seconds of the software clock while MFP was followed */
+static uint32_t sqw_compared;
+static uint32_t sqw_differ;								/* Seconds where the software clock was not RTCC - gap */
+static uint8_t sqw_timer1;								/* Timer1 held the I/O clock in run mode */
+static uint64_t sqw_deep_before;						/* Power-down cycles in the minute before the keys */
+static uint64_t sqw_deep_awake;							/* Power-down cycles while the UART was served */
+static uint64_t sqw_deep_after;							/* Power-down cycles in a minute after the timeout */
+static const char* sqw_output;
+
+/**
+ * @brief Returns the time of the software clock in seconds since midnight.
+ */
+static uint32_t sqw_clock(void)
+{
+	rtcc_time_t time;
+	uint8_t sreg_tmp = SREG;
+
+	clock_get(&time);
+	SREG = sreg_tmp;
+
+	return time.hours*3600L + time.minutes*60 + time.seconds;
+}
+
+/**
+ * @brief Stops and restarts the square wave, compares the software clock with the
+ * RTCC and types the keys, after every second of the RTCC.
+ */
+static void sqw_second(void)
+{
+	static uint32_t last;
+	static char key[2];
+	uint32_t now = host_rtcc_seconds();
+	uint32_t clock = sqw_clock();
+
+	if(now == SQW_GAP)
+		host_rtcc.regs[CTRL_REG] &= ~(1<<SQWE);
+	if(now == SQW_GAP + SQW_GAP_SECONDS)
+		host_rtcc.regs[CTRL_REG] |= 1<<SQWE;
+
+	if(now > SQW_START + 60 && mode == MODE_RUN) {
+		if(power_holds & POWER_HOLD_CLOCK)
+			sqw_timer1 = 1;
+		if(clock != last)
+			sqw_ticks++;
+		if(now < SQW_GAP || now > SQW_CHECK + SQW_GAP_SECONDS + 1)
+			sqw_differ += clock != now && clock != now - 1;	/* Before or after the edge of this second */
+		else if(now > SQW_GAP + SQW_GAP_SECONDS && now < SQW_CHECK + SQW_GAP_SECONDS)
+			sqw_differ += clock != now - SQW_GAP_SECONDS && clock != now - SQW_GAP_SECONDS - 1;
+		sqw_compared++;
+	}
+	last = clock;
+
+	if(now == SQW_KEYS_START - 60)
+		sqw_deep_before = host_residency[POWER_DEEP];
+	if(now == SQW_KEYS_START) {
+		sqw_deep_before = host_residency[POWER_DEEP] - sqw_deep_before;
+		host_uart_output();								/* Drop the report of the calibration */
+	}
+	if(now == SQW_KEYS_START + 1)						/* Woken by the first key */
+		sqw_deep_awake = host_residency[POWER_DEEP];
+	if(now >= SQW_KEYS_START && now < SQW_KEYS_START + sizeof(SQW_KEYS) - 1) {
+		key[0] = SQW_KEYS[now - SQW_KEYS_START];
+		host_uart_pause(HOST_CYCLES_PER_S/4);			/* Between the edges of the square wave */
+		host_uart_send(key, SOFTUART_BAUD_RATE);
+	}
+	if(now == SQW_KEYS_START + 30) {
+		sqw_deep_awake = host_residency[POWER_DEEP] - sqw_deep_awake;
+		sqw_output = strdup(host_uart_output());
+	}
+	if(now == SQW_KEYS_START + UART_AWAKE_SECONDS + 60)
+		sqw_deep_after = host_residency[POWER_DEEP];
+	if(now == SQW_KEYS_START + UART_AWAKE_SECONDS + 120)
+		sqw_deep_after = host_residency[POWER_DEEP] - sqw_deep_after;
+}
+
+static void sqw_firmware(void)
+{
+	firmware_main();
+}
+
+int main(void)
+{
+	uint64_t minute = 60*HOST_CYCLES_PER_S;
+	clock_drift_t drift;
+
+	host_ee_erase();
+	host_rtcc_set(26, 10, 17, 6, SQW_START/3600, 0, 0);
+	host_second_hook = sqw_second;
+
+	host_run_until(sqw_firmware, (SQW_END - SQW_START)*HOST_CYCLES_PER_S);
+
+	/* The clock follows MFP: it stood still while the square wave was stopped */
+	HOST_CHECK(mode == MODE_RUN && !sqw_timer1, "Timer1 running after the calibration");
+	HOST_CHECK(sqw_compared > 40*60 && !sqw_differ, "software clock differs in %u of %u seconds",
+		sqw_differ, sqw_compared);
+	HOST_CHECK(sqw_ticks == sqw_compared - SQW_GAP_SECONDS, "%u ticks in %u seconds", sqw_ticks, sqw_compared);
+
+	/* The missed seconds are drift */
+	clock_get_drift(&drift);
+	HOST_CHECK(drift.drift == SQW_GAP_SECONDS && drift.last == SQW_GAP_SECONDS && drift.max == SQW_GAP_SECONDS,
+		"drift: last %d s, max %u s, total %ld s", drift.last, drift.max, (long)drift.drift);
+	HOST_CHECK(sqw_output && strstr(sqw_output, "Drift: last 5 s, max 5 s, total 5 s in "),
+		"no drift in \"%s\"", sqw_output);
+
+	/* Power-down between the edges, also after the UART was served */
+	HOST_CHECK(sqw_deep_before > minute*99/100, "no power-down before the keys");
+	HOST_CHECK(sqw_deep_awake <= 2*HOST_CYCLES_PER_MS, "power-down while the UART is served");	/* Only the start-up */
+	HOST_CHECK(sqw_deep_after > minute*99/100, "no power-down after the UART timed out");
+
+	return host_result("test_sqw");
+}
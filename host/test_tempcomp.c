@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <math.h>
+#include "hal.h"
+#include "MCP7940M.h"
+#include "trim.h"
+#include "tempcomp.h"
+
+/* The temperature compensation (tempcomp.c) on a synthetic trace of a shed: three days
+ * which swing between frost and summer heat, a cold snap beyond the range of CAL_REG
+ * and a stable spell. The internal sensor reads the trace through the ADC, the trim
+ * follows the parabola of the crystal and CAL_REG is only written when it changes. */
+
+#define TEMPCOMP_TEST_PPM		549						/* Deviation at the calibration in 0.1ppm (32766.2Hz) */
+#define TEMPCOMP_TEST_MINUTES	10						/* Between two updates */
+#define TEMPCOMP_TEST_UPDATES	(4*24*60/TEMPCOMP_TEST_MINUTES)
+#define TEMPCOMP_TEST_LSB		(275.0/256)				/* degC per LSB of the ADC */
+
+/**
+ * @brief Temperature of the trace after a number of updates.
+ */
+static double tempcomp_test_trace(uint16_t update)
+{
+	double hours = (double)update*TEMPCOMP_TEST_MINUTES/60;
+
+	if(hours < 72)											/* Days and nights */
+		return 14 + 24*sin(2*M_PI*(hours - 9)/24) + 4*sin(2*M_PI*hours/7.3);
+	if(hours < 84)											/* Cold snap */
+		return -27 + (hours - 78)*(hours - 78)/4;
+	return 18;												/* Stable */
+}
+
+/**
+ * @brief Trim of the crystal model at a temperature, calibrated at TRIM_T0.
+ */
+static int16_t tempcomp_test_steps(int8_t t)
+{
+	double dt = t - TRIM_T0;
+	double ppm = lround(TEMPCOMP_TEST_PPM + dt*dt*TRIM_K/100.0 + 1e-9)/10.0;	/* 0.1ppm as stored */
+	long steps = lround(ppm*TRIM_CLOCKS/1e6);
+
+	return steps > TRIM_MAX ? TRIM_MAX : steps;
+}
+
+int main(void)
+{
+	int16_t prev = 0, steps, fixed;
+	uint16_t writes = 0, changes = 0, clamped = 0;
+	int32_t clocks = 0;
+	int8_t low = 127, high = -128;
+	uint8_t written;
+
+	host_ee_erase();
+	host_rtcc_set(26, 10, 17, 6, 12, 0, 0);
+	twi_init();
+	sei();
+
+	host_adc = TEMPCOMP_ADC_25C;
+	HOST_CHECK(!tempcomp_update(TEMPCOMP_TEST_MINUTES), "CAL_REG written without calibration");
+	tempcomp_set_offset(TEMPCOMP_TEST_PPM);
+	tempcomp_init();
+	fixed = tempcomp_test_steps(TRIM_T0);
+
+	for(uint16_t u=0; u<TEMPCOMP_TEST_UPDATES; u++) {
+		double t = tempcomp_test_trace(u);
+		uint16_t transactions = host_rtcc.transactions;
+
+		host_adc = lround(TEMPCOMP_ADC_25C + (t - TRIM_T0)/TEMPCOMP_TEST_LSB);
+		written = tempcomp_update(TEMPCOMP_TEST_MINUTES);
+
+		/* The sensor reads the trace to within one LSB and the truncation */
+		t = TRIM_T0 + ((double)host_adc - TEMPCOMP_ADC_25C)*TEMPCOMP_TEST_LSB;
+		if(!HOST_CHECK(fabs(tempcomp_temperature() - t) < 1 + TEMPCOMP_TEST_LSB, "update %u: %d C read at %.1f C",
+			u, tempcomp_temperature(), t))
+			break;
+		if(tempcomp_temperature() < low)
+			low = tempcomp_temperature();
+		if(tempcomp_temperature() > high)
+			high = tempcomp_temperature();
+
+		steps = tempcomp_test_steps(tempcomp_temperature());
+		if(u)
+			clocks += (int32_t)(prev - fixed)*2*TEMPCOMP_TEST_MINUTES;
+		HOST_CHECK(tempcomp_trim() == steps && host_rtcc.regs[CAL_REG] == trim_cal(steps),
+			"update %u at %d C: trim %d, CAL_REG 0x%02X, expected %d", u, tempcomp_temperature(),
+			tempcomp_trim(), host_rtcc.regs[CAL_REG], steps);
+		HOST_CHECK(written == (!u || steps != prev) && host_rtcc.transactions - transactions == written,
+			"update %u: CAL_REG written %u times for a trim %d after %d", u, host_rtcc.transactions - transactions,
+			steps, prev);
+		HOST_CHECK(tempcomp_correction() == clocks, "update %u: correction %ld, expected %ld", u,
+			(long)tempcomp_correction(), (long)clocks);
+
+		writes += written;
+		changes += u && steps != prev;
+		clamped += steps == TRIM_MAX;
+		prev = steps;
+	}
+
+	HOST_CHECK(low <= -25 && high >= 40 && clamped, "trace from %d to %d C, %u updates at TRIM_MAX", low, high, clamped);
+	HOST_CHECK(writes == changes + 1, "%u writes of CAL_REG for %u changes", writes, changes);
+	printf("%d to %d C: %u writes of CAL_REG in %u updates, correction %ld clocks\n", low, high, writes,
+		TEMPCOMP_TEST_UPDATES, (long)tempcomp_correction());
+
+	return host_result("test_tempcomp");
+}
@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "hal.h"
+#include "trim.h"
+
+/* The trim value from the counts of the reference against rounding in double:
+ * trim_steps() over a grid of deviations and spans, trim_compute() for the steps,
+ * the deviation in ppm, the uncertainty and the stability of the estimate. */
+
+/**
+ * @brief Trim steps of a deviation in double, rounded half away from zero and limited.
+ */
+static long trim_test_steps(long diff, unsigned seconds)
+{
+	long steps = lround((double)diff*TRIM_CLOCKS/((double)seconds*TRIM_TICKS));
+
+	if(steps > TRIM_MAX)
+		return TRIM_MAX + 1;
+	if(steps < -TRIM_MAX)
+		return -(TRIM_MAX + 1);
+
+	return steps;
+}
+
+/**
+ * @brief Measures a crystal over a span and checks the result of trim_compute().
+ * @param hz Frequency of the crystal
+ * @param seconds Span in seconds of the RTCC
+ * @param cal Expected value for CAL_REG, -1 if out of range
+ */
+static void trim_test_crystal(double hz, unsigned seconds, int cal)
+{
+	uint32_t counts = floor(seconds*32768.0/hz*TRIM_TICKS);
+	trim_t trim;
+	uint8_t ok = trim_compute(seconds, counts, &trim);
+
+	HOST_CHECK(ok == (cal >= 0) && (cal < 0 || trim.cal == cal), "%.3f Hz over %u s: ok %u cal 0x%02X, expected 0x%02X",
+		hz, seconds, ok, trim.cal, cal);
+	printf("%.3f Hz %5u s: ppm %ld.%ld +-%u.%u steps %d cal 0x%02X stable %u\n", hz, seconds,
+		(long)trim.ppm/10, labs(trim.ppm)%10, trim.uncertainty/10, trim.uncertainty%10, trim.steps, trim.cal, trim.stable);
+}
+
+int main(void)
+{
+	trim_t trim;
+	long diff, steps, ppm;
+	unsigned uncertainty;
+	uint8_t ok;
+
+	trim_test_crystal(32766.2, 600, 0xB6);					/* 54.9ppm slow, adds 54 steps */
+	trim_test_crystal(32766.2, 43200, 0xB6);
+	trim_test_crystal(32768, 600, 0x00);
+	trim_test_crystal(32769, 600, 0x1E);					/* 30.6ppm fast, removes 30 steps */
+	trim_test_crystal(32768*(1 - 129.2e-6), 3600, 0xFF);	/* Edge of the range */
+	trim_test_crystal(32768*(1 - 131e-6), 600, -1);
+	trim_test_crystal(32768*(1 + 128e-6), 600, 0x7E);
+	trim_test_crystal(32768*(1 + 131e-6), 600, -1);
+	trim_test_crystal(32768*(1 + 500e-6), 60, -1);
+
+	for(unsigned s=1; s<65535; s+=97) {
+		for(diff=-(long)s*5; diff<=(long)s*5; diff+=1 + s/50) {
+			double exact = (double)diff*TRIM_CLOCKS/((double)s*TRIM_TICKS);
+
+			if(fabs(fabs(exact - trunc(exact)) - 0.5) < 1e-9)	/* Ties of the rounding */
+				continue;
+			steps = trim_test_steps(diff, s);
+			if(!HOST_CHECK(trim_steps(diff, s) == steps, "trim_steps(%ld, %u) = %d, expected %ld",
+				diff, s, trim_steps(diff, s), steps))
+				break;
+
+			ok = trim_compute(s, s*TRIM_TICKS + diff, &trim);
+			ppm = diff*(long)TRIM_PPM/(long)s;
+			uncertainty = (TRIM_JITTER*TRIM_PPM + s - 1)/s;
+			if(!HOST_CHECK(ok == (labs(steps) <= TRIM_MAX) && trim.steps == steps && trim.ppm == ppm &&
+				trim.uncertainty == uncertainty, "trim_compute(%u, %ld): ok %u steps %d ppm %ld +-%u, expected %ld %ld +-%u",
+				s, diff, ok, trim.steps, (long)trim.ppm, trim.uncertainty, steps, ppm, uncertainty))
+				break;
+			if(ok && !HOST_CHECK(trim.stable == (trim_test_steps(diff - TRIM_JITTER, s) == trim_test_steps(diff + TRIM_JITTER, s)),
+				"trim_compute(%u, %ld): stable %u", s, diff, trim.stable))
+				break;
+		}
+	}
+
+	return host_result("test_trim");
+}
@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <string.h>
+#include "hal.h"
+#include "MCP7940M.h"
+#include "clock.h"
+#include "power.h"
+
+/* The TWI engine (MCP7940M.c) against the faults of the simulated bus: a NACKed SLA
+ * and a lost arbitration are repeated, a hung slave is aborted after the watchdog
+ * period and clocked free, a full queue is waited for within the same bound. The
+ * periodic check of the software clock (clock.c) reads the RTCC asynchronously. */
+
+#define TWI_TEST_PERIODS		(TWI_RETRIES + 2)		/* Watchdog periods of 32ms for a hung bus */
+
+/**
+ * @brief Reads the time and checks the result, the START conditions and the duration.
+ * @param what Name of the fault
+ * @param expected Error code
+ * @param starts START conditions which completed
+ * @param recoveries Calls of hal_twi_recover()
+ */
+static void twi_test_read(const char* what, uint8_t expected, uint16_t starts, uint16_t recoveries)
+{
+	rtcc_time_t time;
+	uint64_t begin = host_cycles;
+	uint8_t ERR_CODE;
+
+	host_rtcc.starts = 0;
+	host_rtcc.recoveries = 0;
+	ERR_CODE = rtcc_get_time(&time);
+	HOST_CHECK(ERR_CODE == expected, "%s: 0x%02X, expected 0x%02X", what, ERR_CODE, expected);
+	HOST_CHECK(host_rtcc.starts == starts && host_rtcc.recoveries == recoveries,
+		"%s: %u starts, %u recoveries, expected %u, %u", what, host_rtcc.starts, host_rtcc.recoveries, starts, recoveries);
+	HOST_CHECK(host_cycles - begin < TWI_TEST_PERIODS*32*HOST_CYCLES_PER_MS, "%s: took %lu ms", what,
+		(unsigned long)((host_cycles - begin)/HOST_CYCLES_PER_MS));
+	HOST_CHECK(!(power_holds & POWER_HOLD_TWI), "%s: POWER_HOLD_TWI kept", what);
+}
+
+/**
+ * @brief Fills the queue while the bus hangs, a waiting read must still finish.
+ */
+static void twi_test_queue_full(void)
+{
+	twi_trans_t queued[TWI_QUEUE_SIZE - 1];
+	uint8_t bufs[TWI_QUEUE_SIZE - 1][RTCC_TIME_LEN];
+	uint8_t i;
+
+	host_rtcc.hang = 1;
+	host_rtcc.stuck = 3;
+	for(i=0; i<TWI_QUEUE_SIZE - 1; i++) {
+		queued[i].callback = 0;
+		HOST_CHECK(rtcc_get_time_async(&queued[i], bufs[i]) == TWI_SUCCESS, "async read %u not queued", i);
+	}
+	HOST_CHECK(rtcc_get_time_async(&queued[0], bufs[0]) == TWI_QUEUE_FULL, "full queue took another read");
+
+	twi_test_read("queue full", TWI_SUCCESS, 2*(TWI_QUEUE_SIZE - 1), 1);
+	HOST_CHECK(queued[0].status == TWI_TIMEOUT, "hung read: 0x%02X", queued[0].status);
+	for(i=1; i<TWI_QUEUE_SIZE - 1; i++)
+		HOST_CHECK(queued[i].status == TWI_SUCCESS && !memcmp(bufs[i], host_rtcc.regs, RTCC_TIME_LEN),
+			"queued read %u: 0x%02X", i, queued[i].status);
+}
+
+/**
+ * @brief Runs the check of the software clock against an RTCC which is ahead.
+ */
+static void twi_test_clock(void)
+{
+	rtcc_time_t time;
+	clock_drift_t drift;
+
+	host_rtcc_set(26, 10, 17, 6, 12, 0, 0);
+	HOST_CHECK(clock_load() == TWI_SUCCESS, "clock_load() failed");
+	host_rtcc_set(26, 10, 17, 6, 12, 0, 3);
+
+	HOST_CHECK(!clock_sync(), "clock_sync() did not queue the read");
+	HOST_CHECK(power_holds & POWER_HOLD_TWI, "no POWER_HOLD_TWI while the read is queued");
+	while(power_holds & POWER_HOLD_TWI)					/* Until the TWI interrupt finished it */
+		power_idle();
+	HOST_CHECK(clock_sync(), "clock_sync() did not compare");
+
+	clock_get(&time);
+	clock_get_drift(&drift);
+	HOST_CHECK(time.seconds == 3 && drift.last == 3 && drift.checks == 1, "clock at %u s, drift %d s in %u checks",
+		time.seconds, drift.last, drift.checks);
+
+	/* A NACK fails the asynchronous read, the check is not repeated at once */
+	host_rtcc.nack = 1;
+	clock_sync();
+	hal_delay_ms(1);
+	HOST_CHECK(!clock_sync(), "clock_sync() of a NACK succeeded");
+	clock_service();
+	HOST_CHECK(!(power_holds & POWER_HOLD_TWI), "clock_service() repeated the failed check at once");
+	clock_tick();
+	clock_service();
+	hal_delay_ms(1);
+	clock_service();
+	clock_get_drift(&drift);
+	HOST_CHECK(drift.checks == 2, "check not repeated after the next second");
+}
+
+int main(void)
+{
+	twi_init();
+	sei();
+	host_rtcc_set(26, 10, 17, 6, 12, 0, 0);
+
+	twi_test_read("no fault", TWI_SUCCESS, 2, 0);
+
+	host_rtcc.nack = 1;
+	twi_test_read("NACK", TWI_SUCCESS, 3, 0);
+	host_rtcc.nack = TWI_RETRIES + 1;
+	twi_test_read("NACK on every attempt", TW_MT_SLA_NACK, TWI_RETRIES + 1, 0);
+
+	host_rtcc.arb = 1;
+	twi_test_read("arbitration lost", TWI_SUCCESS, 3, 0);
+
+	host_rtcc.hang = 1;
+	host_rtcc.stuck = 3;
+	twi_test_read("hung slave", TWI_SUCCESS, 2, 1);
+
+	host_rtcc.hang = 1;
+	host_rtcc.stuck = 10;										/* Never releases SDA */
+	twi_test_read("stuck slave", TWI_TIMEOUT, 0, TWI_RETRIES + 1);
+	host_rtcc.stuck = 0;
+	twi_test_read("released slave", TWI_SUCCESS, 2, 1);
+
+	twi_test_queue_full();
+	twi_test_clock();
+
+	return host_result("test_twi");
+}
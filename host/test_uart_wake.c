@@ -0,0 +1,69 @@
+#include <stdio.h>
+#include <string.h>
+#include "hal.h"
+
+/* The shell of the firmware (main.c) with RTCC_ALARM_WAKE: a command typed one key
+ * per second after the MCU went to power-down. The first key wakes it (the oscillator
+ * needs 1ms to start, the frame is lost), the UART is then served for UART_AWAKE_SECONDS. */
+
+#define main firmware_main
+#include "main.c"
+#undef main
+
+#define WAKE_START				(13*3600L + 20*60)		/* First key, after the calibration at boot */
+#define WAKE_KEYS				"\rtime\r"
+
+static uint64_t wake_deep_before;						/* Power-down cycles before WAKE_START */
+static uint64_t wake_deep_awake;						/* Power-down cycles while the keys were typed */
+static uint64_t wake_deep_after;						/* Power-down cycles after the UART timed out */
+static const char* wake_output;
+
+static void wake_second(void)
+{
+	uint32_t now = host_rtcc_seconds();
+	static char key[2];
+
+	if(now == WAKE_START - 60)
+		wake_deep_before = host_residency[POWER_DEEP];
+	if(now == WAKE_START) {
+		wake_deep_before = host_residency[POWER_DEEP] - wake_deep_before;
+		wake_deep_awake = host_residency[POWER_DEEP];
+		host_uart_output();								/* Drop the report of the calibration */
+	}
+	if(now >= WAKE_START && now < WAKE_START + sizeof(WAKE_KEYS) - 1) {
+		key[0] = WAKE_KEYS[now - WAKE_START];
+		host_uart_send(key, SOFTUART_BAUD_RATE);
+	}
+	if(now == WAKE_START + 30) {
+		wake_deep_awake = host_residency[POWER_DEEP] - wake_deep_awake;
+		wake_output = strdup(host_uart_output());
+	}
+	if(now == WAKE_START + UART_AWAKE_SECONDS + 60)
+		wake_deep_after = host_residency[POWER_DEEP];
+	if(now == WAKE_START + UART_AWAKE_SECONDS + 120)
+		wake_deep_after = host_residency[POWER_DEEP] - wake_deep_after;
+}
+
+static void wake_firmware(void)
+{
+	firmware_main();
+}
+
+int main(void)
+{
+	uint64_t minute = 60*HOST_CYCLES_PER_S;
+
+	host_ee_erase();
+	host_rtcc_set(26, 10, 17, 6, 13, 0, 0);
+	host_second_hook = wake_second;
+
+	host_run_until(wake_firmware, (WAKE_START - 13*3600L + UART_AWAKE_SECONDS + 180)*HOST_CYCLES_PER_S);
+
+	HOST_CHECK(wake_deep_before > minute*99/100, "no power-down before the keys");
+	HOST_CHECK(wake_output && (strstr(wake_output, "13:20:04 day 6 17.10.26\r") || strstr(wake_output, "13:20:05 day 6 17.10.26\r")),
+		"no answer to time: \"%s\"", wake_output);
+	HOST_CHECK(wake_deep_awake <= 2*HOST_CYCLES_PER_MS, "power-down while the UART is served");	/* Only the start-up */
+	HOST_CHECK(wake_deep_after > minute*99/100, "no power-down after the UART timed out");
+
+	return host_result("test_uart_wake");
+}
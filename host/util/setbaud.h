@@ -0,0 +1,20 @@
+/* Baud rate of the USART for the host build, as in avr-libc (no include guard, like the original) */
+
+#ifndef BAUD
+	#error "BAUD is not defined"
+#endif
+
+#define UBRR_VALUE				(((F_CPU) + 8UL*(BAUD)) / (16UL*(BAUD)) - 1UL)
+#if 100 * (F_CPU) > (16 * ((UBRR_VALUE) + 1)) * (100 * (BAUD) + (BAUD) * 2)
+	#define USE_2X				1
+#elif 100 * (F_CPU) < (16 * ((UBRR_VALUE) + 1)) * (100 * (BAUD) - (BAUD) * 2)
+	#define USE_2X				1
+#else
+	#define USE_2X				0
+#endif
+#if USE_2X
+	#undef UBRR_VALUE
+	#define UBRR_VALUE			(((F_CPU) + 4UL*(BAUD)) / (8UL*(BAUD)) - 1UL)
+#endif
+#define UBRRL_VALUE				(UBRR_VALUE & 0xff)
+#define UBRRH_VALUE				(UBRR_VALUE >> 8)
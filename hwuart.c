@@ -0,0 +1,239 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+#include "softuart.h"
+#include "power.h"
+#include "instr.h"
+
+#define BAUD SOFTUART_BAUD_RATE
+#include <util/setbaud.h>
+
+#define HWUART_IN_MASK		(SOFTUART_IN_BUF_SIZE - 1)
+#define HWUART_OUT_MASK		(SOFTUART_OUT_BUF_SIZE - 1)
+
+#if (SOFTUART_IN_BUF_SIZE & HWUART_IN_MASK) || (SOFTUART_OUT_BUF_SIZE & HWUART_OUT_MASK)
+	#error "UART buffer sizes must be powers of two"
+#endif
+
+/* Receive ring, written by the RX interrupt */
+volatile static char inbuf[SOFTUART_IN_BUF_SIZE];
+volatile static uint8_t qin;
+volatile static uint8_t qout;
+volatile static uint16_t rx_dropped;				/* Lost, buffer full or overrun */
+volatile static uint16_t rx_framing;				/* Lost, stop bit missing */
+
+/* Transmit ring, drained by the UDRE interrupt */
+volatile static char outbuf[SOFTUART_OUT_BUF_SIZE];
+volatile static uint8_t tx_in;
+volatile static uint8_t tx_out;
+volatile static uint8_t flag_tx_busy;			/* Set until the last stop bit is out */
+static uint8_t tx_high_water;						/* Max. number of queued characters */
+
+ISR(USART_RX_vect)
+{
+	uint8_t status = UCSR0A;
+	char ch = UDR0;									/* Read in any case to clear RXC0 */
+	uint8_t next = (qin + 1) & HWUART_IN_MASK;
+
+	if(status & (1<<FE0))							/* Framing error */
+		rx_framing++;
+	else {
+		if(status & (1<<DOR0)) {					/* Overrun, characters lost in hardware */
+			rx_dropped++;
+			INSTR_COUNT(INSTR_UART_OVERRUN);
+		}
+		if(next == qout)							/* Buffer full -> drop */
+			rx_dropped++;
+		else {
+			inbuf[qin] = ch;
+			qin = next;
+			POWER_WAKE(POWER_WAKE_UART);
+		}
+	}
+}
+
+ISR(USART_UDRE_vect)
+{
+	uint8_t out = tx_out;
+
+	UDR0 = outbuf[out];
+	out = (out + 1) & HWUART_OUT_MASK;
+	tx_out = out;
+	if(out == tx_in)
+		UCSR0B &= ~(1<<UDRIE0);						/* Buffer empty */
+}
+
+ISR(USART_TX_vect)
+{
+	if(tx_out == tx_in) {							/* Frame and buffer done */
+		flag_tx_busy = 0;
+		POWER_RELEASE(POWER_HOLD_UART_TX);
+	}
+}
+
+void softuart_init( void )
+{
+	uint8_t sreg_tmp = SREG;
+	cli();
+
+	qin = qout = 0;
+	tx_in = tx_out = 0;
+	flag_tx_busy = 0;
+
+	UBRR0H = UBRRH_VALUE;
+	UBRR0L = UBRRL_VALUE;
+	#if USE_2X
+		UCSR0A = (1<<U2X0);
+	#else
+		UCSR0A = 0;
+	#endif
+	UCSR0C = (1<<UCSZ01)|(1<<UCSZ00);				/* 8N1 */
+	UCSR0B = (1<<RXEN0)|(1<<TXEN0)|(1<<RXCIE0)|(1<<TXCIE0);
+
+	SREG = sreg_tmp;
+}
+
+void softuart_rx_edge( void )
+{
+	if(!(SOFTUART_RX_PCMSK & (1<<SOFTUART_RX_PCINT)))
+		return;
+	SOFTUART_RX_PCMSK &= ~(1<<SOFTUART_RX_PCINT);	/* One-shot, the USART receives while awake */
+	POWER_WAKE(POWER_WAKE_UART);
+}
+
+void softuart_rx_wake( void )
+{
+	uint8_t sreg_tmp = SREG;
+	cli();
+
+	SOFTUART_RX_PCMSK |= (1<<SOFTUART_RX_PCINT);	/* RXD pin change wakes from power-down */
+	SOFTUART_RX_PCICR |= (1<<SOFTUART_RX_PCIE);
+
+	SREG = sreg_tmp;
+}
+
+void softuart_turn_rx_on( void )
+{
+	UCSR0B |= (1<<RXEN0)|(1<<RXCIE0);
+}
+
+void softuart_turn_rx_off( void )
+{
+	UCSR0B &= ~((1<<RXEN0)|(1<<RXCIE0));
+}
+
+char softuart_getchar( void )
+{
+	char ch;
+
+	cli();
+	while(qout == qin) {							/* Sleep until the RX interrupt stored a character */
+		power_idle();
+		cli();
+	}
+	sei();
+
+	ch = inbuf[qout];
+	qout = (qout + 1) & HWUART_IN_MASK;
+
+	return ch;
+}
+
+unsigned char softuart_kbhit( void )
+{
+	return qin != qout;
+}
+
+void softuart_flush_input_buffer( void )
+{
+	qout = qin;
+}
+
+void softuart_get_rx_errors( unsigned short *dropped, unsigned short *framing )
+{
+	uint8_t sreg_tmp = SREG;
+	cli();
+
+	*dropped = rx_dropped;
+	*framing = rx_framing;
+
+	SREG = sreg_tmp;
+}
+
+unsigned char softuart_transmit_busy( void )
+{
+	return flag_tx_busy;
+}
+
+unsigned char softuart_tx_high_water( void )
+{
+	return tx_high_water;
+}
+
+/**
+ * @brief Queues a character. Call with interrupts disabled and free space in the buffer.
+ * @param ch Character
+ */
+static void tx_enqueue(char ch)
+{
+	uint8_t used;
+
+	outbuf[tx_in] = ch;
+	tx_in = (tx_in + 1) & HWUART_OUT_MASK;
+	used = (tx_in - tx_out) & HWUART_OUT_MASK;
+	if(used > tx_high_water)
+		tx_high_water = used;
+
+	flag_tx_busy = 1;
+	power_hold(POWER_HOLD_UART_TX);					/* The USART runs from the I/O clock */
+	UCSR0B |= (1<<UDRIE0);
+}
+
+/**
+ * @brief Checks if the transmit buffer is full.
+ * @return 1 if full, 0 otherwise
+ */
+static uint8_t tx_full(void)
+{
+	return ((tx_in + 1) & HWUART_OUT_MASK) == tx_out;
+}
+
+void softuart_putchar( const char ch )
+{
+	cli();
+	while(tx_full()) {								/* Buffer full -> wait for the UDRE interrupt */
+		power_idle();
+		cli();
+	}
+	tx_enqueue(ch);
+	sei();
+}
+
+unsigned char softuart_try_write( const char *buf, unsigned char len )
+{
+	uint8_t n;
+	uint8_t sreg_tmp = SREG;
+	cli();
+
+	for(n=0; n<len && !tx_full(); n++)
+		tx_enqueue(buf[n]);
+
+	SREG = sreg_tmp;
+
+	return n;
+}
+
+void softuart_puts( const char *s )
+{
+	while(*s)
+		softuart_putchar(*s++);
+}
+
+void softuart_puts_p( const char *prg_s )
+{
+	char c;
+
+	while((c = pgm_read_byte(prg_s++)))
+		softuart_putchar(c);
+}
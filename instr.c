@@ -0,0 +1,75 @@
+#include <string.h>
+#include <avr/interrupt.h>
+#include "instr.h"
+#include "softuart.h"
+#include "hal.h"
+
+volatile uint16_t instr_counters[INSTR_COUNTERS];
+static instr_timer_t instr_timers[INSTR_TIMERS];
+
+void instr_time(uint8_t timer, uint16_t begin)
+{
+	instr_timer_t* t = &instr_timers[timer];
+	uint16_t now = hal_timer1_count();
+	uint16_t ticks;
+	
+	if(now >= begin)
+		ticks = now - begin;
+	else
+		ticks = now + hal_timer1_top() + 1 - begin;	/* CTC, one wrap at most */
+	
+	if(!t->count || ticks < t->min)
+		t->min = ticks;
+	if(ticks > t->max)
+		t->max = ticks;
+	if(t->count != 0xFFFF)
+		t->count++;
+}
+
+/**
+ * @brief Sends a 16-bit value, low byte first, and adds it to the checksum.
+ * @param value Value
+ * @param sum Checksum
+ */
+static void instr_put_word(uint16_t value, uint8_t* sum)
+{
+	softuart_putchar(value & 0xFF);
+	softuart_putchar(value >> 8);
+	*sum += (value & 0xFF) + (value >> 8);
+}
+
+void instr_dump(uint8_t clear)
+{
+	uint16_t counters[INSTR_COUNTERS];
+	instr_timer_t timers[INSTR_TIMERS];
+	unsigned short dropped, framing;
+	uint8_t sum;
+	
+	cli();
+	memcpy(counters, (const void*)instr_counters, sizeof(counters));
+	memcpy(timers, instr_timers, sizeof(timers));
+	if(clear) {
+		memset((void*)instr_counters, 0, sizeof(instr_counters));
+		memset(instr_timers, 0, sizeof(instr_timers));
+	}
+	sei();
+	
+	softuart_get_rx_errors(&dropped, &framing);
+	counters[INSTR_UART_DROPPED] = dropped;
+	counters[INSTR_UART_FRAMING] = framing;
+	
+	softuart_putchar(INSTR_DUMP_MAGIC);
+	softuart_putchar(INSTR_DUMP_VERSION);
+	softuart_putchar(INSTR_COUNTERS);
+	softuart_putchar(INSTR_TIMERS);
+	sum = INSTR_DUMP_MAGIC + INSTR_DUMP_VERSION + INSTR_COUNTERS + INSTR_TIMERS;
+	
+	for(uint8_t i=0; i<INSTR_COUNTERS; i++)
+		instr_put_word(counters[i], &sum);
+	for(uint8_t i=0; i<INSTR_TIMERS; i++) {
+		instr_put_word(timers[i].count, &sum);
+		instr_put_word(timers[i].min, &sum);
+		instr_put_word(timers[i].max, &sum);
+	}
+	softuart_putchar(sum);
+}
@@ -0,0 +1,73 @@
+#ifndef INSTR_H
+#define INSTR_H
+
+#include <stdint.h>
+
+/* Instrumentation of the interrupts and TWI transactions, built with INSTR_ENABLE
+ * (make INSTR=1). Without it the macros are empty and nothing is allocated.
+ *
+ * The interrupts are only counted, their paths of a few us are shorter than one tick of
+ * Timer1 (64us, prescaling 1024) and Timer0/2 serve the UART and the PWM. The TWI transactions
+ * span several ticks and are timed. Timer1 stops with RTCC_SQW_CLOCK outside of a calibration. */
+
+/* Event counters */
+#define INSTR_TWI_ERROR			0				/* Transaction failed (NACK, bus error) */
+#define INSTR_TWI_ARB_LOST		1				/* Arbitration lost, transaction restarted */
+#define INSTR_TWI_QUEUE_FULL	2				/* Submit rejected */
+#define INSTR_TIMER1_OVERRUN	3				/* Compare match again before the interrupt ended */
+#define INSTR_UART_OVERRUN		4				/* Timer0 tick or USART character missed */
+#define INSTR_UART_DROPPED		5				/* Received characters dropped, copied by instr_dump() */
+#define INSTR_UART_FRAMING		6				/* Frames without stop bit, copied by instr_dump() */
+#define INSTR_TWI_TIMEOUT		7				/* Bus hung, recovered */
+#define INSTR_TWI_RETRY			8				/* Failed transaction repeated */
+#define INSTR_COUNTERS			9
+
+/* Timers */
+#define INSTR_RTCC				0				/* TWI transaction from the start to its completion */
+#define INSTR_TIMERS			1
+
+#define INSTR_DUMP_MAGIC		'I'				/* First byte of the dump */
+#define INSTR_DUMP_VERSION		2
+
+typedef struct{
+	uint16_t count;								/* Saturates at 0xFFFF */
+	uint16_t min;								/* Timer1 ticks */
+	uint16_t max;
+}instr_timer_t;
+
+#ifdef INSTR_ENABLE
+	#include "hal.h"
+	
+	extern volatile uint16_t instr_counters[INSTR_COUNTERS];
+	
+	/* Counts an event */
+	#define INSTR_COUNT(counter)		(instr_counters[counter]++)
+	/* Counts an event if the condition is true, the condition is not evaluated if disabled */
+	#define INSTR_CHECK(cond, counter)	do { if(cond) instr_counters[counter]++; } while(0)
+	/* Stores the start in a variable, ended by INSTR_SINCE() */
+	#define INSTR_MARK(stamp)			((stamp) = hal_timer1_count())
+	#define INSTR_SINCE(timer, stamp)	instr_time(timer, stamp)
+#else
+	#define INSTR_COUNT(counter)		((void)0)
+	#define INSTR_CHECK(cond, counter)	((void)0)
+	#define INSTR_MARK(stamp)			((void)0)
+	#define INSTR_SINCE(timer, stamp)	((void)0)
+#endif
+
+/**
+ * @brief Adds a duration to a timer. Call with interrupts disabled (from an interrupt).
+ * @param timer INSTR_RTCC
+ * @param begin Timer1 count at the start
+ */
+void instr_time(uint8_t, uint16_t);
+
+/**
+ * @brief Sends the counters and timers as binary frame over UART:
+ * INSTR_DUMP_MAGIC, INSTR_DUMP_VERSION, INSTR_COUNTERS, INSTR_TIMERS,
+ * the counters and the timers (count, min, max) as 16-bit little endian,
+ * and the 8-bit sum of all bytes before.
+ * @param clear 1 to clear the counters and timers afterwards (UART errors are kept)
+ */
+void instr_dump(uint8_t);
+
+#endif
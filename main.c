@@ -1,127 +1,152 @@
-#define F_CPU 16000000UL
-
 #include <stdio.h>
 #include <avr/io.h>	
 #include <avr/interrupt.h>
-#include <avr/eeprom.h>
-#include <util/twi.h>
-#include <util/delay.h>
 #include <stdint.h>
-#include <math.h>
 #include "softuart.h"
 #include "MCP7940M.h"	
+#include "fade.h"
+#include "power.h"
+#include "clock.h"
+#include "schedule.h"
+#include "shell.h"
+#include "calibrate.h"
+#include "tempcomp.h"
+#include "hal.h"
+#include "instr.h"
+
+#define SUNRISE_HOUR			14						/* Default schedule, used if the EEPROM holds none */
+#define SUNRISE_MINUTE			26
+#define SUNSET_HOUR				14
+#define SUNSET_MINUTE			36
+
+#ifndef RTCC_SQW_CLOCK									/* Also set by -DRTCC_SQW_CLOCK (host/test_sqw.c) */
+#define RTCC_ALARM_WAKE									/* Comment out to check the schedule every minute */
+														/* The RTCC alarms wake the MCU from power-down over MFP (INT0, PD2)
+														 * for the next transition. A key on the UART wakes it as well (its
+														 * frame is lost), the UART is then served for UART_AWAKE_SECONDS. */
+#endif
+#define UART_AWAKE_SECONDS		60						/* Seconds the UART is served after boot and the last character */
+//#define RTCC_SQW_CLOCK								/* Uncomment to run the clock from the 1Hz square wave on MFP */
+														/* (PD2, PCINT18) instead of Timer1, which is then free. The MCU
+														 * is in power-down between the edges, the UART is served for
+														 * UART_AWAKE_SECONDS as with RTCC_ALARM_WAKE.
+														 * Can not be used together with RTCC_ALARM_WAKE. */
+//#define RTCC_TEMP_COMP								/* Uncomment to trim the RTCC by the temperature of the MCU */
+														/* Needs the sensor on ADC8 (ATmega168A/PA, 328P) and a calibration.
+														 * Updated every minute, with RTCC_ALARM_WAKE every hour on alarm 1. */
+#define TEMP_COMP_MINUTE		30						/* Minute of alarm 1 */
+
+#if defined RTCC_ALARM_WAKE && defined RTCC_SQW_CLOCK
+	#error "MFP can either output the alarms or the square wave!"
+#endif
 
-#define CALIBRATE										/* 	Uncomment for Calibration of the RTCC */
-														/* 	This should be done before the intial start-up at a new place.
-														 * 	!PWM can not be used during initial calibration! 
-													 	 * 	Estimated calibration value will be sent over UART (Binary output!).
-														 * 	Recomment, set value to RTCC_CALIBRATION_VALUE and reflash!
-														 * 	However the frequency of the crystal at room temperature was measured
-														 * 	to be 32766.2Hz instead of 32768Hz. This means minus 108 cycles per minute,
-														 *	which gives a calibration value of 0b10110110 */
-//#define SET_TIME										/* Uncomment to set the current time to the RTCC */
-														/* This should be done after a reset of the RTCC. For example when the power supply failed. 
-														 * Recomment and reflash! */
-
-#ifdef CALIBRATE
-
-	#define RTCC_CALIBRATION_TIME	10UL				/* Time in minutes over which the RTCC shall be calibrated (24 hours is recommended) */
-	
-#elif defined SET_TIME
-
-	#define RTCC_CALIBRATION_VALUE 	0b10110110			/* Initial calibration value; !Set after intial calibration is done! */
-	#define CURRENT_SECOND			0
-	#define CURRENT_MINUTE			26						
-	#define CURRENT_HOUR			0
-	#define CURRENT_DAY				7
-	#define CURRENT_DATE			30
-	#define CURRENT_MONTH			11
-	#define CURRENT_YEAR			16
-	
-#else
+#if defined RTCC_ALARM_WAKE || defined RTCC_SQW_CLOCK
+	#define UART_AWAKE									/* Timer1 does not hold the I/O clock, the UART only for a while */
+#endif
 
-	#define PWM_RESOLUTION			255
-	#define SUNRISE_HOUR			14
-	#define SUNRISE_MINUTE			26
-	#define SUNSET_HOUR				14
-	#define SUNSET_MINUTE			36
-	
+#define MODE_RUN				0						/* Schedule and fades */
+#define MODE_CALIBRATE			1						/* Calibration of the RTCC, fades keep running */
+
+static uint8_t mode = MODE_RUN;
+#ifdef UART_AWAKE
+	static uint8_t uart_awake = UART_AWAKE_SECONDS;	/* Seconds until the UART may stop in power-down */
 #endif
+static uint8_t sqw_on;									/* MFP outputs the square wave on PCINT18 */
+static uint8_t sqw_level = HAL_PIN_MFP;				/* Level of MFP at the last pin change */
 
 
 
-#ifdef CALIBRATE
-	/**
-	 * @brief Starts the RTCC with cleared register values. Initializes the 16-bit timer,
-	 * which triggers an interrupt after every millisecond.
-	 */
-	void rtcc_start_calibration(void);
-	
-	/**
-	 * @brief Calculates the calibration value from estimated times on MCU and RTCC.
-	 */
-	void rtcc_get_calibration_value(void);
-	
-	volatile static rtcc_time_t rtcc_cal_time;			/* Stores the elapsed time of the RTCC for calibration */
-	volatile static int rtcc_calibration_flag = 0;		/* Flag for calibration of the RTCC */
-	volatile static uint8_t rtcc_cal_value;				/* Will hold the estimated value after calibration */
-	volatile static int rtcc_cal_error = 0;				/* Will be 1, if oscillator can not be calibrated */
-	
-#elif defined SET_TIME
+/**
+ * @brief Enables the 1Hz square wave of the RTCC and the pin change interrupt on MFP. 
+ */
+void sqw_init(void);
 
-	/**
-	 * @brief Loads the given time into the registers of the RTCC.
-	 */
-	void set_current_time(void);
-	
-#else
-	
-	/**
-	 * @brief Initializes the 16-bit timer for onboard timing. 
-	 */
-	void timer_init(void);
-	
-	void timer_start(void);
-	
-	void timer_stop(void);
+/**
+ * @brief Disables the square wave and its pin change interrupt.
+ */
+void sqw_stop(void);
 
-	/**
-	 * @brief Initializes Timer2 for PWM. 
-	 */
-	void pwm_init(void);
+/**
+ * @brief Checks if the pending pin change of port D is the square wave on MFP.
+ * @return 1 if MFP changed since the last pin change
+ */
+static uint8_t sqw_changed(void);
 
-	/**
-	 * @brief Calculates the delay time in seconds for every step. 
-	 */
-	void pwm_calculate_delay_times(void);
+/**
+ * @brief Timestamps the falling edge of the square wave for calibration and
+ * advances the clock with RTCC_SQW_CLOCK. Called from the pin change interrupt of port D.
+ */
+static void sqw_edge(void);
+
+/**
+ * @brief Initializes the 16-bit timer for onboard timing. 
+ */
+void timer_init(void);
+
+/**
+ * @brief Starts the 16-bit timer. Without RTCC_SQW_CLOCK it is never stopped,
+ * so timekeeping does not pause.
+ */
+void timer_start(void);
 
+/**
+ * @brief Stops the 16-bit timer.
+ */
+void timer_stop(void);
+
+/**
+ * @brief Advances the clock and the fade engine by one second.
+ */
+static void second_tick(void);
+
+/**
+ * @brief Loads the schedule from EEPROM, or stores the default sunrise/sunset
+ * if there is none, and looks up the next event. A fade which was in progress
+ * at the power loss is resumed at the level it should have reached.
+ */
+void schedule_init(void);
+
+/**
+ * @brief Starts the fade of a due event of the schedule.
+ */
+void schedule_service(void);
+
+#if defined RTCC_TEMP_COMP && !defined RTCC_ALARM_WAKE
 	/**
-	 * @brief Starts Timer2.
+	 * @brief Updates the trim of the RTCC at the start of every minute.
 	 */
-	void pwm_start(void);
+	static void temp_service(void);
+#endif
 
+#ifdef RTCC_ALARM_WAKE
 	/**
-	 * @brief Stops Timer2.
+	 * @brief Sets alarm 0 of the RTCC to the next event and enables INT0 for MFP.
+	 * Alarm 1 is used for the temperature compensation.
 	 */
-	void pwm_stop(void);
-
+	void alarm_init(void);
+	
 	/**
-	 * @brief Simulates sunrise.
+	 * @brief Synchronizes the clock with the RTCC, clears the alarms,
+	 * runs the schedule and sets the alarm to the next event.
 	 */
-	void sunrise(void);
-
+	void alarm_service(void);
+	
 	/**
-	 * @brief Simulates sunset.
+	 * @brief Sets alarm 0 to the next event of the schedule.
 	 */
-	void sunset(void);
+	static void alarm_set_next(void);
+#endif
 
+/**
+ * @brief Starts a requested calibration. MFP outputs the square wave instead of
+ * the alarms, Timer1 runs for the timestamps. LED on PD7 is lit.
+ */
+static void mode_calibrate(void);
 
-	volatile static uint16_t pwm_delay_times[PWM_RESOLUTION];		/* Holds the delay values in seconds. */
-	static rtcc_time_t current_time;						/* Stores the current time */
-	volatile static uint8_t sunrise_flag = 0;
-	volatile static uint8_t sunset_flag = 0;
-	
-#endif
+/**
+ * @brief Ends the calibration and returns MFP and Timer1 to the configured clock source.
+ */
+static void mode_run(void);
 
 /**
  * @brief Initializes the software UART interface.
@@ -131,129 +156,105 @@ void uart_init(void);
 
 int main (void)										
 {
-	uint8_t data;
-	
-	DDRD |= (1<<DDD7)|(1<<DDD3);						/* Set Output */
+	hal_gpio_output(HAL_PIN_LED|HAL_PIN_PWM);			/* Set Output */
 	
 	uart_init();
 	twi_init();
 	rtcc_start_osc();
 	
-	#ifdef CALIBRATE
-		
-		//data = 0x00;
-		data = 0b11101100;
-		rtcc_byte_write(CAL_REG, &data);				/* Reset calibration value */
-		rtcc_start_calibration();						/* Initiate calibration */
-		while(rtcc_calibration_flag);					/* Wait until flag is cleared */
-		rtcc_get_calibration_value();					/* Load value into variable */
-	
-	#elif defined SET_TIME
-	
-		set_current_time();								/* Send current time to RTCC */
-		data = RTCC_CALIBRATION_VALUE;	
-		rtcc_byte_write(CAL_REG, &data);				/* Set calibration value */
-	
+	fade_init();
+	calibrate_init();									/* Requests a calibration if none is stored */
+	#ifdef RTCC_TEMP_COMP
+		tempcomp_init();
+		tempcomp_update(0);
+	#endif
+	clock_load();
+	schedule_init();									/* Resumes a fade interrupted by a power loss */
+	#ifdef RTCC_SQW_CLOCK
+		sqw_init();
 	#else
-	
 		timer_init();
-		pwm_init();
-		pwm_calculate_delay_times();
-		rtcc_get_time(&current_time);
-		//Check if sunrise or sunset should already be in progress, set output
 		timer_start();
-		
+	#endif
+	#ifdef RTCC_ALARM_WAKE
+		alarm_init();
 	#endif
 	
 	while(1)			
 	{
+		uint8_t wake, result;
 		
-		#ifdef CALIBRATE
+		if(mode == MODE_RUN && calibrate_pending())
+			mode_calibrate();
 		
-			char softuart_out[80];
-			uint8_t buffer = rtcc_cal_value;
-			
-			/* Calibration finished, blink LED and send calibration value over UART */
-			_delay_ms(500);
-			PIND |= (1<<PIND7);
+		/* The clock and the fades run in the timer interrupt, sleep in between */
+		wake = power_sleep();
+		
+		if(wake & POWER_WAKE_UART) {
+			uint8_t changed;
 			
-			if(!rtcc_cal_error) {
-				softuart_puts("Calculated calibration value: 0b");
-				
-				for(int i=0; i<8; i++) {
-					if(buffer & 0x80)
-						softuart_putchar(0x31);
-					else
-						softuart_putchar(0x30);
-						
-					buffer <<= 1;
+			#ifdef UART_AWAKE
+				if(!uart_awake) {						/* Woken from power-down by the start bit */
+					#ifdef RTCC_ALARM_WAKE
+						clock_load();					/* The clock stood still */
+					#endif
+					power_hold(POWER_HOLD_UART);
 				}
-			}
-			else {
-				softuart_puts("Crystal could not be calibrated! Deviation to much!!!");
-			}
+				uart_awake = UART_AWAKE_SECONDS;
+			#endif
 			
-			softuart_puts("; Elapsed Time was: ");
-			sprintf(softuart_out, "%i Stunden, %i Minuten und %i Sekunden!", 
-			rtcc_cal_time.hours,
-			rtcc_cal_time.minutes,
-			rtcc_cal_time.seconds);
-			softuart_puts(softuart_out);
-			softuart_puts("\r");
-		
-		#elif defined SET_TIME
+			changed = shell_service();					/* Commands over UART */
 			
-			/* Time was set -> blink LED */
-			_delay_ms(500);
-			PIND = (1<<PIND7);
+			#ifdef RTCC_ALARM_WAKE
+				if(mode == MODE_RUN && (changed & (SHELL_TIME_CHANGED|SHELL_SCHEDULE_CHANGED)))
+					alarm_set_next();
+				if(changed & SHELL_FADE_STARTED)
+					power_hold(POWER_HOLD_CLOCK);		/* Timer1 advances the fade */
+			#else
+				(void)changed;
+			#endif
+		}
 		
+		if(mode == MODE_CALIBRATE && (result = calibrate_service()) != CALIBRATE_IDLE) {
+			mode_run();
+			#ifdef RTCC_TEMP_COMP
+				if(result == CALIBRATE_DONE) {
+					tempcomp_set_offset(calibrate_ppm());
+					tempcomp_update(0);
+				}
+			#endif
+			calibrate_report();
+		}
+		
+		clock_service();
+		
+		#ifndef RTCC_ALARM_WAKE
+			if(wake & POWER_WAKE_TIMER) {
+				schedule_service();
+				#ifdef RTCC_TEMP_COMP
+					if(mode == MODE_RUN)				/* CAL_REG is cleared while calibrating */
+						temp_service();
+				#endif
+			}
 		#else
-			/*
-			if(sunrise_flag) {
-				timer_stop();
-				sunrise();
-				sunrise_flag = 0;
-				PORTD |= (1<<PD3);
-				rtcc_get_time(&current_time);
-				timer_start();
+			if(mode == MODE_CALIBRATE) {				/* No alarms, the clock runs from Timer1 */
+				if(wake & POWER_WAKE_TIMER)
+					schedule_service();
 			}
-			if(sunset_flag) {
-				timer_stop();
-				sunset();
-				sunset_flag = 0;
-				PORTD &= 0xF7;
-				rtcc_get_time(&current_time);
-				timer_start();
+			else {
+				if(wake & POWER_WAKE_RTCC)
+					alarm_service();
+				if(!fade_active())						/* Power-down until the next alarm */
+					power_release(POWER_HOLD_CLOCK);
 			}
-			PORTD = (1<<PD7);*/
 		#endif
-		/*
-		char softuart_out[80];
-		rtcc_time_t time;
 		
-		rtcc_get_time(&time);
-		softuart_puts("Time: ");
-			
-			sprintf(softuart_out, "%i:%i:%iUhr am %i.%i.%i!\r", 
-			time.hours,
-			time.minutes,
-			time.seconds,
-			time.date,
-			time.month,
-			time.year+2000);
-			softuart_puts(softuart_out);
-		
-		//rtcc_byte_read(DATE_REG, &data);
-		//softuart_puts("RTCC lauft seit: ")
-		//if(ERR_CODE != TWI_SUCCESS) {
-		//	sprintf(softuart_out, "::Fehler -> 0x%x::\n", ERR_CODE);
-		//	softuart_puts(softuart_out);
-		//}
-		//else {
-			//softuart_putchar(((data & 0x70)>>4) + 0x30);
-			//softuart_putchar((data & 0x0F) + 0x30);
-			//softuart_puts("Sekunden\n");
-		//}*/
+		#ifdef UART_AWAKE
+			if((wake & POWER_WAKE_TIMER) && uart_awake && !--uart_awake) {
+				softuart_rx_wake();						/* The next start bit wakes from power-down */
+				power_release(POWER_HOLD_UART);
+			}
+		#endif
 	}				
 	return 0;			
 }	
@@ -261,228 +262,249 @@ int main (void)
 void uart_init() 
 {
 	softuart_init();
+	power_hold(POWER_HOLD_UART);						/* Timer0 or the USART run from the I/O clock */
 	sei();
 }
 
-#ifdef CALIBRATE
+void sqw_init()
+{
+	hal_gpio_input_pullup(HAL_PIN_MFP);				/* MFP is open drain */
+	
+	rtcc_enable_sqw(RTCC_SQW_1HZ);
+	
+	hal_mfp_edge_enable();
+	sqw_on = 1;
+}
+
+void sqw_stop()
+{
+	sqw_on = 0;
+	hal_mfp_edge_disable();
+	rtcc_disable_sqw();
+}
 
-	void rtcc_start_calibration() 
-	{
-		uint8_t data;
-		
-		/* Stop oscillator and reset registers */
-		data = 0x00;
-		rtcc_byte_write(SEC_REG, &data);
-		rtcc_byte_write(MIN_REG, &data);
-		rtcc_byte_write(HOUR_REG, &data);
-		rtcc_oscon_flag = 0;
-		
-		/* Initialize 16-bit timer */
-		cli();											/* Disable global interrupts */
-		/* May stop the 8-bit timer for softuart application while calibrating! */
-		
-		OCR1A = 15999;									/* Interrupt every 1ms (no prescaling) */
-		TIMSK1 = (1<<OCIE1A);							/* Enable interrupt on compare match OCR1A */
-		TCCR1B = (1<<WGM12);							/* Enable CTC */
-		TCCR1B |= (1<<CS10);							/* Start timer (no prescaling) */
-		
-		rtcc_calibration_flag = 1;						/* Set flag */
-		
-		sei();											/* Enable global interrupts */
+static uint8_t sqw_changed()
+{
+	return sqw_on && hal_gpio_read(HAL_PIN_MFP) != sqw_level;
+}
+
+static void sqw_edge()
+{
+	uint8_t now = hal_gpio_read(HAL_PIN_MFP);
+	
+	if(sqw_level && !now) {							/* A new second of the RTCC starts with the falling edge */
+		calibrate_edge();
+		#ifdef RTCC_SQW_CLOCK
+			second_tick();
+		#endif
 	}
+	sqw_level = now;								/* The vector is shared, only count changes of MFP */
+}
+
+void timer_init()
+{
+	/* Initialize 16-bit timer */
+	cli();											/* Disable global interrupts */
 	
-	void rtcc_get_calibration_value()
-	{
-		uint32_t mcu_seconds, rtcc_seconds;					/* Elapsed seconds */
-		uint32_t ppm;										/* Deviation in parts per million */	
-		uint8_t cal_value;
-		
-		mcu_seconds = RTCC_CALIBRATION_TIME * 60;
-		rtcc_seconds 	= (uint32_t)rtcc_cal_time.seconds + 
-						(uint32_t)rtcc_cal_time.minutes*60 +
-						(uint32_t)rtcc_cal_time.hours*3600;
-		
-		if(mcu_seconds>rtcc_seconds)
-			ppm = (mcu_seconds-rtcc_seconds)*1000000/ mcu_seconds;
-		else
-			ppm = (rtcc_seconds-mcu_seconds)*1000000/ mcu_seconds;
+	hal_timer1_init();								/* Interrupt every 1s */
+	
+	sei();											/* Enable global interrupts */
+}
 
-		cal_value = (ppm*32768*60)/ 2000000;
+void timer_start()
+{
+	hal_timer1_start();
+	power_hold(POWER_HOLD_CLOCK);					/* Timer1 stops in power-save */
+}
 
-		if(cal_value > 127) {
-			//Crystal can not be calibrated!
-			rtcc_cal_error = 1;
-			cal_value = 0;
-		}
-		else
-			cal_value |= mcu_seconds>rtcc_seconds ? 0x80 : 0x00;
-		
-		rtcc_cal_value = cal_value;
-		//rtcc_byte_write(CAL_REG, &cal_value);
-	}
+void timer_stop()
+{
+	hal_timer1_stop();
+	power_release(POWER_HOLD_CLOCK);
+}
+
+/**
+ * @brief Interrupt service for the 16-Bit timer. Its periods are the time base
+ * of the calibration.
+ */
+ISR(TIMER1_COMPA_vect)
+{
+	calibrate_timer();
+	#ifndef RTCC_SQW_CLOCK
+		second_tick();
+	#endif
 	
-	/**
-	 * @brief Interrupt service for the 16-Bit timer. On first run
-	 * the RTCC oscillator will be started. Counts the milliseconds,
-	 * seconds and minutes elapsed on the MCU. If RTCC_CALIBRATION_TIME
-	 * is reached, it will read the time from the RTCC, clear the flag 
-	 * and stop the timer.
-	 */
-	ISR(TIMER1_COMPA_vect) 
-	{
-		volatile static int millis = -1;
-		volatile static int seconds;
-		volatile static int minutes;
-		uint8_t data;
-		
-		if(millis < 0) {								/* Check if calibration is in progress */
-			millis++;
-			data = (1<<ST_OSC);
-			rtcc_byte_write(ST_OSC_REG, &data);			/* Start oscillator of the RTCC */
-			rtcc_oscon_flag = 1;
-			return;
-		}
-		else {
-			if(++millis == 1000) {						/* Iterate millis, seconds and minutes */
-				millis = 0;
-				if(++seconds == 60) {
-					seconds = 0;
-					if(++minutes == RTCC_CALIBRATION_TIME) {
-						minutes = 0;
-						/* Read elapsed time from the RTCC, reset flag and stop timer */
-						rtcc_cal_time.seconds = rtcc_get_seconds();
-						rtcc_cal_time.minutes = rtcc_get_minutes();
-						rtcc_cal_time.hours = rtcc_get_hours();
-						rtcc_calibration_flag = 0;
-						TCCR1B = 0;
-					}
-				}
-			}
-		}
+	INSTR_CHECK(hal_timer1_pending(), INSTR_TIMER1_OVERRUN);
+}
+
+static void second_tick()
+{
+	POWER_WAKE(POWER_WAKE_TIMER);
+	clock_tick();
+	fade_tick();
+}
+
+void schedule_init()
+{
+	schedule_event_t event;
+	const schedule_event_t* event_current;
+	rtcc_time_t time;
+	uint16_t age;
+	uint8_t from;
+	
+	if(!schedule_load()) {
+		event.days = SCHEDULE_ALL_DAYS;
+		event.duration = 0;
+		event.hours = SUNRISE_HOUR;
+		event.minutes = SUNRISE_MINUTE;
+		event.level = FADE_LEVEL_FULL;
+		schedule_add(&event);
+		event.hours = SUNSET_HOUR;
+		event.minutes = SUNSET_MINUTE;
+		event.level = FADE_LEVEL_OFF;
+		schedule_add(&event);
+		schedule_save();
 	}
 	
-#elif defined SET_TIME
+	clock_get(&time);
+	schedule_seek(&time);
+	
+	/* Continue the fade of the event in effect, the output starts at
+	 * the level it would have reached without the power loss */
+	event_current = schedule_current(&time, &age, &from);
+	if(event_current)
+		fade_resume(from, event_current->level, event_current->duration, (uint32_t)age*60 + time.seconds);
+}
 
-	void set_current_time()
+void schedule_service()
+{
+	const schedule_event_t* event;
+	rtcc_time_t time;
+	
+	clock_get(&time);
+	event = schedule_check(&time);
+	if(event) {
+		#ifdef RTCC_ALARM_WAKE
+			power_hold(POWER_HOLD_CLOCK);			/* Stay awake for the fade */
+		#endif
+		fade_start(event->level, event->duration);
+	}
+}
+
+#if defined RTCC_TEMP_COMP && !defined RTCC_ALARM_WAKE
+
+	static void temp_service()
 	{
 		rtcc_time_t time;
 		
-		time.seconds 	= CURRENT_SECOND;
-		time.minutes 	= CURRENT_MINUTE;
-		time.hours 		= CURRENT_HOUR;
-		time.day		= CURRENT_DAY;
-		time.date		= CURRENT_DATE;
-		time.month		= CURRENT_MONTH;
-		time.year 		= CURRENT_YEAR;
-		
-		rtcc_set_time(&time);
+		clock_get(&time);
+		if(!time.seconds)
+			tempcomp_update(1);
 	}
 	
-#else
+#endif
+
+#ifdef RTCC_ALARM_WAKE
 
-	void timer_init()
+	static void alarm_set_next()
 	{
-		/* Initialize 16-bit timer */
-		cli();											/* Disable global interrupts */
-		
-		OCR1A = 15624;									/* Interrupt every 1s (prescaling 1024) */
-		TCCR1B = (1<<WGM12);							/* Enable CTC */
-		TIMSK1 = (1<<OCIE1A);							/* Enable interrupt on compare match OCR1A */
+		const schedule_event_t* event = schedule_next();
 		
-		sei();											/* Enable global interrupts */
-	}
-	
-	void timer_start()
-	{
-		TCCR1B |= (1<<CS12)|(1<<CS10);					/* Start timer (prescaling 1024) */
+		if(event)
+			rtcc_set_alarm(RTCC_ALM0, event->hours, event->minutes);
+		else
+			rtcc_disable_alarm(RTCC_ALM0);
 	}
 	
-	void timer_stop()
+	void alarm_init()
 	{
-		TCCR1B = (1<<WGM12);
+		hal_gpio_input_pullup(HAL_PIN_MFP);			/* MFP is open drain */
+		
+		#ifdef RTCC_TEMP_COMP
+			rtcc_set_alarm(RTCC_ALM1, 0, TEMP_COMP_MINUTE);	/* Matches the minute every hour */
+		#else
+			rtcc_disable_alarm(RTCC_ALM1);
+		#endif
+		alarm_set_next();
+		
+		hal_mfp_alarm_init();
+		hal_mfp_alarm_enable();
 	}
 	
-	void pwm_init()
+	void alarm_service()
 	{
-		cli();
+		clock_load();								/* The clock stood still in power-down */
+		rtcc_clear_alarm(RTCC_ALM0);
+		#ifdef RTCC_TEMP_COMP
+			if(rtcc_clear_alarm(RTCC_ALM1))
+				tempcomp_update(60);
+		#endif
 		
-		TCCR2A 	= (1<<WGM21)|(1<<WGM20);					/* Fast PWM -> TOP = 0xFF */
-		TCCR2A 	|= (1<<COM2B1)|(1<<COM2B0);					/* Inverting mode -> Set OC2B on Compare Match */
-
-		sei();
+		/* The alarm matches minutes only, the schedule compares the full time */
+		schedule_service();
+		alarm_set_next();
+		
+		hal_mfp_alarm_enable();						/* MFP is released again */
 	}
 	
-	void pwm_calculate_delay_times()
+	/**
+	 * @brief Interrupt service for MFP of the RTCC. The level stays low until
+	 * the alarm flag is cleared, so INT0 is disabled until alarm_service() ran.
+	 */
+	ISR(INT0_vect)
 	{
-		double time_n, time_m;
-		double illuminance_n, illuminance_m;
-		int pos = 0xFF - 1;
-
-		for(int i=pos; i>0; i--) {
-			illuminance_n = (double)(255 - i)/256;
-			illuminance_m = (double)(255 - i + 1)/256;
-			time_n = 1.52*log10(illuminance_n/0.063)/ log10(1.15);
-			time_m = 1.52*log10(illuminance_m/0.063)/ log10(1.15);
-			pwm_delay_times[i] = (time_m-time_n)*60;
-		}
-		pwm_delay_times[0] = 2;	
+		hal_mfp_alarm_disable();
+		POWER_WAKE(POWER_WAKE_RTCC);
 	}
 	
-	void pwm_start()
-	{
-		TCCR2B 	= (1<<CS22)|(1<<CS21);						/* Start timer (prescaling 256 -> 244Hz) */
-	}
+#endif
 
-	void pwm_stop()
-	{
-		TCCR2B = 0;											/* Stop timer */
-	}
+static void mode_calibrate()
+{
+	#ifdef RTCC_ALARM_WAKE
+		hal_mfp_alarm_disable();					/* MFP outputs the square wave */
+		power_hold(POWER_HOLD_CLOCK);				/* Timer1 advances the clock meanwhile */
+	#endif
+	#ifdef RTCC_SQW_CLOCK
+		timer_init();
+		timer_start();
+	#else
+		sqw_init();
+	#endif
+	hal_gpio_set(HAL_PIN_LED);						/* LED on while calibrating */
 	
-	void sunrise()
-	{
-		OCR2B = 0xFF - 1;
-		pwm_start();
-		
-		while(OCR2B > 0) {
-			for(int i=0; i<pwm_delay_times[OCR2B]; i++)
-				_delay_ms(1000);
-			OCR2B--;
-		}
-		_delay_ms(2000);
-			
-		pwm_stop();
-	}
-
-	void sunset()
-	{
-		OCR2B = 0;
-		pwm_start();
-		
-		while(OCR2B < PWM_RESOLUTION) {
-			for(int i=0; i<pwm_delay_times[OCR2B]; i++)
-				_delay_ms(1000);
-			OCR2B++;
-		}
-		
-		pwm_stop();
-	}
+	calibrate_start();
+	mode = MODE_CALIBRATE;
+}
 
-	ISR(TIMER1_COMPA_vect)
-	{
-		if(++current_time.seconds == 60) {
-			current_time.seconds = 0;
-			if(++current_time.minutes == 60) {
-				current_time.minutes = 0;
-				if(++current_time.hours == 24) {
-					current_time.hours = 0;
-				}
-			}
-		}
-		
-		if(current_time.hours == SUNRISE_HOUR && current_time.minutes == SUNRISE_MINUTE)
-			sunrise_flag = 1;
-		else if(current_time.hours == SUNSET_HOUR && current_time.minutes == SUNSET_MINUTE)
-			sunset_flag = 1;
-	}
+static void mode_run()
+{
+	#ifdef RTCC_SQW_CLOCK
+		timer_stop();
+	#else
+		sqw_stop();
+	#endif
+	#ifdef RTCC_ALARM_WAKE
+		rtcc_clear_alarm(RTCC_ALM0);				/* May have fired behind the square wave */
+		alarm_set_next();
+		hal_mfp_alarm_enable();
+	#endif
+	
+	hal_gpio_clear(HAL_PIN_LED);
+	mode = MODE_RUN;
+}
 
-#endif
\ No newline at end of file
+/**
+ * @brief Interrupt service for the pin changes on port D: start bits
+ * on RXD and the square wave on MFP.
+ */
+ISR(PCINT2_vect)
+{
+	#if defined SOFTUART_EDGE_START || defined SOFTUART_HW
+		/* An edge of the square wave with RXD idle is no activity on RX. A late
+		 * start bit at the same time is lost, like the one after power-down. */
+		if(!sqw_changed() || !(SOFTUART_RXPIN & (1<<SOFTUART_RXBIT)))
+			softuart_rx_edge();
+	#endif
+	sqw_edge();
+}
\ No newline at end of file
@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include "power.h"
+#include "softuart.h"
+#include "hal.h"
+
+volatile uint8_t power_wake_reasons;			/* Pending wake reasons */
+volatile uint8_t power_holds;					/* Modules which need the I/O clock */
+static power_stats_t power_stats;
+static uint16_t power_last;						/* TCNT1 at the last mode change */
+
+/**
+ * @brief Adds the Timer1 ticks since the last mode change to a residency counter.
+ * Timer1 runs in CTC mode with TOP = OCR1A, longer periods than one timer cycle are lost.
+ * @param mode Index of the counter
+ */
+static void power_account(uint8_t mode)
+{
+	uint16_t now = hal_timer1_count();
+	
+	if(now >= power_last)
+		power_stats.ticks[mode] += now - power_last;
+	else
+		power_stats.ticks[mode] += now + hal_timer1_top() + 1 - power_last;
+	power_last = now;
+}
+
+void power_hold(uint8_t hold)
+{
+	uint8_t sreg_tmp = SREG;
+	cli();
+	
+	power_holds |= hold;
+	
+	SREG = sreg_tmp;
+}
+
+void power_release(uint8_t hold)
+{
+	uint8_t sreg_tmp = SREG;
+	cli();
+	
+	power_holds &= ~hold;
+	
+	SREG = sreg_tmp;
+}
+
+uint8_t power_sleep()
+{
+	uint8_t mode, reasons;
+	
+	cli();
+	power_account(POWER_RUN);
+	if(!power_wake_reasons) {
+		if(power_holds) {
+			mode = POWER_IDLE;
+			set_sleep_mode(SLEEP_MODE_IDLE);
+		}
+		else {
+			mode = POWER_DEEP;
+			if(hal_pwm_async())						/* Keep an asynchronous Timer2 running */
+				set_sleep_mode(SLEEP_MODE_PWR_SAVE);
+			else
+				set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+		}
+		power_stats.sleeps[mode]++;
+		sleep_enable();
+		sei();											/* Sleep is entered before any pending interrupt */
+		sleep_cpu();
+		sleep_disable();
+		cli();
+		power_account(mode);
+	}
+	reasons = power_wake_reasons;
+	power_wake_reasons = 0;
+	power_stats.wake_reasons |= reasons;
+	sei();
+	
+	return reasons;
+}
+
+void power_idle()
+{
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	sleep_enable();
+	sei();												/* Sleep is entered before any pending interrupt */
+	sleep_cpu();
+	sleep_disable();
+}
+
+void power_get_stats(power_stats_t* stats)
+{
+	cli();
+	*stats = power_stats;
+	sei();
+}
+
+void power_report()
+{
+	char softuart_out[80];
+	power_stats_t stats;
+	
+	power_get_stats(&stats);
+	sprintf(softuart_out, "Run: %lu, Idle: %lu (%lux), Deep: %lux; Wake: 0x%02x\r",
+		stats.ticks[POWER_RUN],
+		stats.ticks[POWER_IDLE], stats.sleeps[POWER_IDLE],
+		stats.sleeps[POWER_DEEP],
+		stats.wake_reasons);
+	softuart_puts(softuart_out);
+}
@@ -0,0 +1,81 @@
+#ifndef POWER_H
+#define POWER_H
+
+#include <stdint.h>
+
+/* Wake reasons, set by the interrupts which should end a sleep */
+#define POWER_WAKE_TIMER	0x01			/* Timer1 second tick */
+#define POWER_WAKE_TWI		0x02			/* TWI transaction finished */
+#define POWER_WAKE_UART		0x04			/* Character received */
+#define POWER_WAKE_RTCC		0x08			/* Interrupt from the MFP pin of the RTCC */
+
+/* Holds, set by modules which need the I/O clock (prevent deep sleep) */
+#define POWER_HOLD_CLOCK	0x01			/* Software clock and fades on Timer1 */
+#define POWER_HOLD_PWM		0x02			/* PWM on Timer2 */
+#define POWER_HOLD_UART		0x04			/* UART receiver (Timer0 or USART) */
+#define POWER_HOLD_TWI		0x08			/* TWI transaction pending */
+#define POWER_HOLD_UART_TX	0x10			/* Characters in the UART transmit buffer */
+#define POWER_HOLD_UART_RX	0x20			/* Frame being received by the software UART */
+
+#define POWER_RUN			0				/* Index of the residency counters */
+#define POWER_IDLE			1
+#define POWER_DEEP			2				/* Power-save, power-down if Timer2 is not asynchronous */
+#define POWER_MODES			3
+
+typedef struct{								/* Residency statistics */
+	uint32_t ticks[POWER_MODES];			/* Time spent per mode in Timer1 ticks (64us) */
+	uint32_t sleeps[POWER_MODES];			/* Number of times a mode was entered */
+	uint8_t wake_reasons;					/* All wake reasons seen since the last reset */
+}power_stats_t;
+
+extern volatile uint8_t power_wake_reasons;
+extern volatile uint8_t power_holds;
+
+/**
+ * @brief Marks a wake reason. Call from the interrupt that should end the sleep.
+ */
+#define POWER_WAKE(reason)	(power_wake_reasons |= (reason))
+
+/**
+ * @brief Releases a hold from an interrupt, without the call of power_release().
+ */
+#define POWER_RELEASE(hold)	(power_holds &= ~(hold))
+
+/**
+ * @brief Sets a hold. As long as any hold is set, only IDLE sleep is used.
+ * @param hold POWER_HOLD_* bits
+ */
+void power_hold(uint8_t);
+
+/**
+ * @brief Releases a hold.
+ * @param hold POWER_HOLD_* bits
+ */
+void power_release(uint8_t);
+
+/**
+ * @brief Sleeps until a wake reason is marked. Drops to IDLE if any hold is set,
+ * to power-save (Timer2 asynchronous) or power-down otherwise. Returns right away if a wake reason is already pending.
+ * @return Wake reasons (cleared)
+ */
+uint8_t power_sleep(void);
+
+/**
+ * @brief Sleeps in IDLE until the next interrupt. Used by blocking waits:
+ * call with interrupts disabled after checking the wait condition,
+ * returns with interrupts enabled.
+ */
+void power_idle(void);
+
+/**
+ * @brief Copies the residency statistics.
+ * @param stats Pointer where statistics should be stored
+ */
+void power_get_stats(power_stats_t*);
+
+/**
+ * @brief Sends the residency statistics over UART.
+ */
+void power_report(void);
+
+#endif
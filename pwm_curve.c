@@ -0,0 +1,22 @@
+#include <avr/pgmspace.h>
+#include "pwm_curve.h"
+#include "pwm_table.h"								/* Generated by the makefile (pwm_table_gen.c) */
+
+#if PWM_TABLE_SIZE != PWM_RESOLUTION
+	#error "pwm_table.h does not match PWM_RESOLUTION, regenerate it!"
+#endif
+
+uint16_t pwm_curve_sum(uint8_t n)
+{
+	uint8_t block = n / PWM_TABLE_BLOCK;
+	uint8_t step = n & ~(PWM_TABLE_BLOCK - 1);			/* First step of the block */
+	uint16_t sum = pgm_read_word(&pwm_delay_block_sum[block]);
+	uint16_t delay = pgm_read_word(&pwm_delay_base[block]);
+	
+	for(; step < n; step++) {							/* Add the steps before n within the block */
+		delay += pgm_read_byte(&pwm_delay_delta[step]);	/* 0 at the start of a block */
+		sum += delay;
+	}
+	
+	return sum;
+}
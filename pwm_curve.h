@@ -0,0 +1,17 @@
+#ifndef PWM_CURVE_H
+#define PWM_CURVE_H
+
+#include <stdint.h>
+
+#define PWM_RESOLUTION			255				/* Number of PWM steps of a fade */
+
+/**
+ * @brief Returns the summed delay of the steps 0 to n-1 of sunrise/sunset, the time
+ * the PWM output stays at step n is pwm_curve_sum(n+1) - pwm_curve_sum(n).
+ * The table is generated at build time and only lives in flash.
+ * @param n Number of steps (0 to PWM_RESOLUTION)
+ * @return Time in seconds
+ */
+uint16_t pwm_curve_sum(uint8_t);
+
+#endif
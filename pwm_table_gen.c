@@ -0,0 +1,83 @@
+/* Host-side generator for the sunrise/sunset delay table.
+ * Built and run by the makefile with the native compiler, writes pwm_table.h to stdout.
+ *
+ * The illuminance E is approached in minutes by t = A*log10(E/B)/log10(C).
+ * The delay of every PWM step is the time difference between two adjacent
+ * illuminance values in seconds. It is stored as 8-bit delta to the previous
+ * step. The running sum, from which the position within a fade is looked up,
+ * is stored once per block and completed from the deltas, see pwm_curve.c.
+ *
+ * Usage: pwm_table_gen A B C
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#define PWM_RESOLUTION	255
+#define PWM_TABLE_BLOCK	16				/* Steps per stored full value */
+
+int main(int argc, char** argv)
+{
+	double a, b, c;
+	double time_n, time_m;
+	double illuminance_n, illuminance_m;
+	unsigned delay_times[PWM_RESOLUTION+1];
+	
+	if(argc != 4) {
+		fprintf(stderr, "Usage: %s A B C\n", argv[0]);
+		return 1;
+	}
+	a = atof(argv[1]);
+	b = atof(argv[2]);
+	c = atof(argv[3]);
+	
+	for(int i=PWM_RESOLUTION-1; i>0; i--) {
+		illuminance_n = (double)(255 - i)/256;
+		illuminance_m = (double)(255 - i + 1)/256;
+		time_n = a*log10(illuminance_n/b)/ log10(c);
+		time_m = a*log10(illuminance_m/b)/ log10(c);
+		delay_times[i] = (time_m-time_n)*60;
+	}
+	delay_times[0] = 2;
+	delay_times[PWM_RESOLUTION] = 0;
+	
+	/* Delays rise monotonic with the step, so the difference to the previous
+	 * step fits into one byte. Every PWM_TABLE_BLOCK steps the full value is stored. */
+	for(int i=1; i<PWM_RESOLUTION; i++) {
+		if(delay_times[i] < delay_times[i-1] || delay_times[i] - delay_times[i-1] > 0xFF) {
+			fprintf(stderr, "Delay of step %d does not fit into an 8-bit delta!\n", i);
+			return 1;
+		}
+	}
+	
+	printf("/* Generated by pwm_table_gen %s %s %s - do not edit! */\n", argv[1], argv[2], argv[3]);
+	printf("#ifndef PWM_TABLE_H\n#define PWM_TABLE_H\n\n");
+	printf("#include <stdint.h>\n#include <avr/pgmspace.h>\n\n");
+	printf("#define PWM_TABLE_SIZE\t%d\n", PWM_RESOLUTION);
+	printf("#define PWM_TABLE_BLOCK\t%d\n", PWM_TABLE_BLOCK);
+	printf("#define PWM_TABLE_A\t\t%s\t\t/* Parameters of the curve */\n", argv[1]);
+	printf("#define PWM_TABLE_B\t\t%s\n", argv[2]);
+	printf("#define PWM_TABLE_C\t\t%s\n\n", argv[3]);
+	
+	printf("/* Delay in seconds of the first step of every block */\n");
+	printf("static const uint16_t pwm_delay_base[(PWM_TABLE_SIZE+PWM_TABLE_BLOCK-1)/PWM_TABLE_BLOCK] PROGMEM = {");
+	for(int i=0; i<PWM_RESOLUTION; i+=PWM_TABLE_BLOCK)
+		printf("%s%u%s", i ? " " : "\n\t", delay_times[i], i+PWM_TABLE_BLOCK<PWM_RESOLUTION ? "," : "");
+	printf("\n};\n\n");
+	
+	printf("/* Delay in seconds of step n minus the delay of step n-1 (0 at the start of a block) */\n");
+	printf("static const uint8_t pwm_delay_delta[PWM_TABLE_SIZE] PROGMEM = {");
+	for(int i=0; i<PWM_RESOLUTION; i++)
+		printf("%s%u%s", i%16 ? " " : "\n\t", i%PWM_TABLE_BLOCK ? delay_times[i]-delay_times[i-1] : 0,
+			i<PWM_RESOLUTION-1 ? "," : "");
+	printf("\n};\n\n");
+	
+	printf("/* Sum of the delays in seconds of the steps before every block */\n");
+	printf("static const uint16_t pwm_delay_block_sum[(PWM_TABLE_SIZE+PWM_TABLE_BLOCK-1)/PWM_TABLE_BLOCK] PROGMEM = {");
+	for(int i=0, sum=0; i<PWM_RESOLUTION; sum+=delay_times[i], i++)
+		if(i%PWM_TABLE_BLOCK == 0)
+			printf("%s%u%s", i ? " " : "\n\t", sum, i+PWM_TABLE_BLOCK<PWM_RESOLUTION ? "," : "");
+	printf("\n};\n\n#endif\n");
+	
+	return 0;
+}
@@ -0,0 +1,182 @@
+#include "hal.h"
+#include "schedule.h"
+#include "fade.h"
+
+static uint8_t HAL_EEMEM schedule_ee_count;						/* Number of events in EEPROM (0xFF if erased) */
+static schedule_event_t HAL_EEMEM schedule_ee_events[SCHEDULE_SIZE];
+
+static schedule_event_t schedule_events[SCHEDULE_SIZE];		/* Sorted by time of day */
+static uint8_t schedule_n;									/* Number of events */
+static uint8_t schedule_idx;								/* Next event of today */
+static uint16_t schedule_last = 0xFFFF;						/* Minute of the day of the last check */
+
+/**
+ * @brief Returns the minute of the day of an event.
+ * @param event Event
+ * @return Minutes since midnight
+ */
+static uint16_t schedule_minute(const schedule_event_t* event)
+{
+	return (uint16_t)event->hours*60 + event->minutes;
+}
+
+/**
+ * @brief Checks if an event holds valid values.
+ * @param event Event
+ * @return 1 if valid, 0 otherwise
+ */
+static uint8_t schedule_valid(const schedule_event_t* event)
+{
+	return event->hours < 24 && event->minutes < 60 && event->days && !(event->days & ~SCHEDULE_ALL_DAYS);
+}
+
+uint8_t schedule_load()
+{
+	schedule_event_t event;
+	uint8_t n;
+	
+	schedule_n = 0;
+	n = hal_ee_read_byte(&schedule_ee_count);
+	if(n > SCHEDULE_SIZE)									/* Erased or invalid */
+		return 0;
+	
+	for(uint8_t i=0; i<n; i++) {							/* Insertion sort */
+		hal_ee_read_block(&event, &schedule_ee_events[i], sizeof(event));
+		schedule_add(&event);
+	}
+	
+	return schedule_n;
+}
+
+void schedule_save()
+{
+	hal_ee_update_block(schedule_events, schedule_ee_events, schedule_n * sizeof(schedule_event_t));
+	hal_ee_update_byte(&schedule_ee_count, schedule_n);
+}
+
+uint8_t schedule_count()
+{
+	return schedule_n;
+}
+
+uint8_t schedule_get(uint8_t index, schedule_event_t* event)
+{
+	if(index >= schedule_n)
+		return 0;
+	
+	*event = schedule_events[index];
+	
+	return 1;
+}
+
+uint8_t schedule_add(const schedule_event_t* event)
+{
+	uint8_t i;
+	
+	if(schedule_n == SCHEDULE_SIZE || !schedule_valid(event))
+		return 0;
+	
+	/* Move later events up, equal times keep their order */
+	for(i=schedule_n; i>0 && schedule_minute(&schedule_events[i-1]) > schedule_minute(event); i--)
+		schedule_events[i] = schedule_events[i-1];
+	schedule_events[i] = *event;
+	schedule_n++;
+	
+	return 1;
+}
+
+uint8_t schedule_remove(uint8_t index)
+{
+	if(index >= schedule_n)
+		return 0;
+	
+	schedule_n--;
+	for(uint8_t i=index; i<schedule_n; i++)
+		schedule_events[i] = schedule_events[i+1];
+	
+	return 1;
+}
+
+void schedule_seek(const rtcc_time_t* time)
+{
+	uint16_t now = time->hours*60 + time->minutes;
+	uint8_t low = 0, high = schedule_n;
+	
+	while(low < high) {										/* First event with minute >= now */
+		uint8_t mid = (low + high) / 2;
+		if(schedule_minute(&schedule_events[mid]) < now)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	schedule_idx = low;
+	schedule_last = now;
+}
+
+const schedule_event_t* schedule_check(const rtcc_time_t* time)
+{
+	uint16_t now = time->hours*60 + time->minutes;
+	const schedule_event_t* due = 0;
+	uint8_t day = 1 << ((time->day - 1) & 0x07);
+	
+	if(now == schedule_last)								/* Once per minute */
+		return 0;
+	if(now < schedule_last) {
+		if(schedule_last - now > 12*60)						/* Midnight passed */
+			schedule_idx = 0;
+		else {												/* Clock was corrected backwards */
+			schedule_last = now;
+			return 0;
+		}
+	}
+	schedule_last = now;
+	
+	while(schedule_idx < schedule_n && schedule_minute(&schedule_events[schedule_idx]) <= now) {
+		if(schedule_events[schedule_idx].days & day)
+			due = &schedule_events[schedule_idx];
+		schedule_idx++;
+	}
+	
+	return due;
+}
+
+const schedule_event_t* schedule_current(const rtcc_time_t* time, uint16_t* age, uint8_t* from)
+{
+	uint16_t now = time->hours*60 + time->minutes;
+	const schedule_event_t* current = 0;
+	uint8_t weekday = (time->day - 1) % 7;					/* 0-6 */
+	uint8_t i = schedule_n;
+	
+	*from = FADE_LEVEL_OFF;
+	
+	/* Walk back in time through today and the previous days, the first
+	 * matching event is in effect and the second one sets its start level */
+	for(uint8_t d=0; d<8; d++) {
+		for(; i>0; i--) {
+			const schedule_event_t* event = &schedule_events[i-1];
+			
+			if(d == 0 && schedule_minute(event) > now)		/* Later today */
+				continue;
+			if(!(event->days & (1 << weekday)))
+				continue;
+			if(current) {
+				*from = event->level;
+				return current;
+			}
+			current = event;
+			*age = (uint16_t)d*24*60 + now - schedule_minute(event);
+		}
+		i = schedule_n;
+		weekday = weekday ? weekday - 1 : 6;
+	}
+	
+	return current;
+}
+
+const schedule_event_t* schedule_next()
+{
+	if(!schedule_n)
+		return 0;
+	
+	return &schedule_events[schedule_idx < schedule_n ? schedule_idx : 0];
+}
@@ -0,0 +1,89 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include <stdint.h>
+#include "MCP7940M.h"
+
+#define SCHEDULE_SIZE			8				/* Max. number of events per day */
+#define SCHEDULE_ALL_DAYS		0x7F			/* Day mask for every day of the week */
+
+typedef struct{									/* One event of the daily schedule */
+	uint8_t hours;								/* Start time (0-23) */
+	uint8_t minutes;							/* Start time (0-59) */
+	uint8_t days;								/* Day-of-week mask, bit n-1 for day n of the RTCC (1-7) */
+	uint8_t level;								/* Brightness to fade to */
+	uint8_t duration;							/* Fade duration in minutes (0 -> curve timing) */
+}schedule_event_t;
+
+/**
+ * @brief Loads the schedule from EEPROM and sorts it by time.
+ * @return Number of events, 0 if the EEPROM holds no valid schedule
+ */
+uint8_t schedule_load(void);
+
+/**
+ * @brief Writes the schedule to EEPROM.
+ */
+void schedule_save(void);
+
+/**
+ * @brief Returns the number of events.
+ * @return Number of events
+ */
+uint8_t schedule_count(void);
+
+/**
+ * @brief Copies an event. Events are sorted by time.
+ * @param index Index of the event
+ * @param event Pointer where the event should be stored
+ * @return 1 on success, 0 if the index is invalid
+ */
+uint8_t schedule_get(uint8_t, schedule_event_t*);
+
+/**
+ * @brief Inserts an event at its place in time. Call schedule_seek() afterwards.
+ * @param event Event to insert
+ * @return 1 on success, 0 if the table is full or the event is invalid
+ */
+uint8_t schedule_add(const schedule_event_t*);
+
+/**
+ * @brief Removes an event. Call schedule_seek() afterwards.
+ * @param index Index of the event
+ * @return 1 on success, 0 if the index is invalid
+ */
+uint8_t schedule_remove(uint8_t);
+
+/**
+ * @brief Finds the first event at or after the given time (binary search),
+ * events before are treated as done for today.
+ * @param time Current time
+ */
+void schedule_seek(const rtcc_time_t*);
+
+/**
+ * @brief Returns the event which is due at the given time. Only the next event
+ * is compared, so this is O(1) per call. If several events were passed (e.g. in sleep),
+ * the latest one is returned. Call at least once per minute.
+ * @param time Current time
+ * @return Due event or 0
+ */
+const schedule_event_t* schedule_check(const rtcc_time_t*);
+
+/**
+ * @brief Finds the event in effect at the given time, the latest one which started
+ * within the last week, and the level before it started.
+ * @param time Current time
+ * @param age Pointer where the minutes since the start of the event should be stored
+ * @param from Pointer where the level of the event before should be stored (FADE_LEVEL_OFF if none)
+ * @return Event in effect or 0 if no event started within a week
+ */
+const schedule_event_t* schedule_current(const rtcc_time_t*, uint16_t*, uint8_t*);
+
+/**
+ * @brief Returns the next event which will become due, possibly tomorrow.
+ * @return Next event or 0 if the schedule is empty
+ */
+const schedule_event_t* schedule_next(void);
+
+#endif
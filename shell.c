@@ -0,0 +1,386 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <avr/pgmspace.h>
+#include "shell.h"
+#include "softuart.h"
+#include "MCP7940M.h"
+#include "clock.h"
+#include "fade.h"
+#include "power.h"
+#include "schedule.h"
+#include "calibrate.h"
+#include "tempcomp.h"
+#include "instr.h"
+
+#define SHELL_ERROR				0x80			/* Returned by a handler on invalid arguments */
+
+typedef uint8_t (*shell_handler_t)(uint8_t, const uint16_t*);
+
+typedef struct{									/* Entry of the command table (PROGMEM) */
+	char name[6];
+	uint8_t min_args;
+	uint8_t max_args;
+	shell_handler_t handler;
+}shell_cmd_t;
+
+static char shell_line[SHELL_LINE_SIZE];		/* Line being received */
+static uint8_t shell_len;
+static uint8_t shell_overflow;					/* Line too long, discarded at its end */
+
+/**
+ * @brief Sends formatted output, the format string is read from flash.
+ * @param format Format string (PSTR)
+ */
+static void shell_printf(const char* format, ...)
+{
+	char softuart_out[48];
+	va_list args;
+
+	va_start(args, format);
+	vsnprintf_P(softuart_out, sizeof(softuart_out), format, args);
+	va_end(args);
+	softuart_puts(softuart_out);
+}
+
+/**
+ * @brief Sends the time of the software clock.
+ */
+static void shell_print_time(void)
+{
+	rtcc_time_t time;
+
+	clock_get(&time);
+	shell_printf(PSTR("%02u:%02u:%02u day %u %02u.%02u.%02u\r"),
+		time.hours, time.minutes, time.seconds, time.day, time.date, time.month, time.year);
+}
+
+static uint8_t shell_help(uint8_t, const uint16_t*);
+
+/**
+ * @brief time [h m s [day date month year]]: shows or sets the time of the RTCC.
+ */
+static uint8_t shell_time(uint8_t argc, const uint16_t* argv)
+{
+	rtcc_time_t time;
+
+	if(argc) {
+		if(argc != 3 && argc != 7)
+			return SHELL_ERROR;
+
+		clock_get(&time);								/* Keeps the date if only the time is given */
+		time.hours = argv[0];
+		time.minutes = argv[1];
+		time.seconds = argv[2];
+		if(argc == 7) {
+			time.day = argv[3];
+			time.date = argv[4];
+			time.month = argv[5];
+			time.year = argv[6];
+		}
+		if(rtcc_set_time(&time) != TWI_SUCCESS || clock_load() != TWI_SUCCESS)	/* Range checked by the RTCC driver */
+			return SHELL_ERROR;
+		clock_get(&time);
+		schedule_seek(&time);
+	}
+	shell_print_time();
+
+	return argc ? SHELL_TIME_CHANGED : 0;
+}
+
+/**
+ * @brief cal [value]: shows or sets the calibration register of the RTCC.
+ */
+static uint8_t shell_cal(uint8_t argc, const uint16_t* argv)
+{
+	uint8_t data;
+
+	if(argc) {
+		if(argv[0] > 0xFF || calibrate_active())
+			return SHELL_ERROR;
+		data = argv[0];
+		rtcc_byte_write(CAL_REG, &data);
+	}
+	if(rtcc_byte_read(CAL_REG, &data) != TWI_SUCCESS)
+		return SHELL_ERROR;
+	shell_printf(PSTR("cal 0x%02x\r"), data);
+
+	return 0;
+}
+
+/**
+ * @brief calib [minutes]: calibrates the RTCC against the MCU clock, the result
+ * is stored in EEPROM and sent when the estimate is stable or at the latest after minutes.
+ */
+static uint8_t shell_calib(uint8_t argc, const uint16_t* argv)
+{
+	uint8_t minutes = CALIBRATE_MINUTES;
+
+	if(argc) {
+		if(!argv[0] || argv[0] > 0xFF)
+			return SHELL_ERROR;
+		minutes = argv[0];
+	}
+	if(calibrate_active())
+		return SHELL_ERROR;
+
+	calibrate_request(minutes);
+	shell_printf(PSTR("calibrating %u min\r"), minutes);
+
+	return 0;
+}
+
+/**
+ * @brief list: shows the schedule.
+ */
+static uint8_t shell_list(uint8_t argc, const uint16_t* argv)
+{
+	schedule_event_t event;
+
+	for(uint8_t i=0; schedule_get(i, &event); i++)
+		shell_printf(PSTR("%u: %02u:%02u days 0x%02x level %u in %u min\r"),
+			i, event.hours, event.minutes, event.days, event.level, event.duration);
+
+	return 0;
+}
+
+/**
+ * @brief Saves the schedule and looks up the next event.
+ * @return SHELL_SCHEDULE_CHANGED
+ */
+static uint8_t shell_schedule_changed(void)
+{
+	rtcc_time_t time;
+
+	schedule_save();
+	clock_get(&time);
+	schedule_seek(&time);
+
+	return SHELL_SCHEDULE_CHANGED;
+}
+
+/**
+ * @brief add h m days level minutes: inserts an event into the schedule.
+ */
+static uint8_t shell_add(uint8_t argc, const uint16_t* argv)
+{
+	schedule_event_t event;
+
+	for(uint8_t i=0; i<argc; i++)
+		if(argv[i] > 0xFF)
+			return SHELL_ERROR;
+
+	event.hours = argv[0];
+	event.minutes = argv[1];
+	event.days = argv[2];
+	event.level = argv[3];
+	event.duration = argv[4];
+	if(!schedule_add(&event))
+		return SHELL_ERROR;
+
+	shell_list(0, 0);
+
+	return shell_schedule_changed();
+}
+
+/**
+ * @brief del index: removes an event from the schedule.
+ */
+static uint8_t shell_del(uint8_t argc, const uint16_t* argv)
+{
+	if(argv[0] > 0xFF || !schedule_remove(argv[0]))
+		return SHELL_ERROR;
+
+	shell_list(0, 0);
+
+	return shell_schedule_changed();
+}
+
+/**
+ * @brief fade level [minutes]: fades from the current level.
+ */
+static uint8_t shell_fade(uint8_t argc, const uint16_t* argv)
+{
+	if(argv[0] > FADE_LEVEL_FULL || (argc > 1 && argv[1] > 0xFF))
+		return SHELL_ERROR;
+
+	fade_start(argv[0], argc > 1 ? argv[1] : 0);
+
+	return SHELL_FADE_STARTED;
+}
+
+/**
+ * @brief level value: sets the output right away.
+ */
+static uint8_t shell_level(uint8_t argc, const uint16_t* argv)
+{
+	if(argv[0] > FADE_LEVEL_FULL)
+		return SHELL_ERROR;
+
+	fade_set_level(argv[0]);
+
+	return 0;
+}
+
+/**
+ * @brief stats: sends the power, clock and UART statistics.
+ */
+static uint8_t shell_stats(uint8_t argc, const uint16_t* argv)
+{
+	unsigned short dropped, framing;
+
+	power_report();
+	clock_report();
+	softuart_get_rx_errors(&dropped, &framing);
+	shell_printf(PSTR("UART: dropped %u, framing %u, tx max %u\r"),
+		dropped, framing, softuart_tx_high_water());
+	shell_printf(PSTR("Level: %u%s\r"), fade_get_level(), fade_active() ? " fading" : "");
+
+	return 0;
+}
+
+/**
+ * @brief temp: sends the temperature, the trim of the RTCC and the correction by the temperature.
+ */
+static uint8_t shell_temp(uint8_t argc, const uint16_t* argv)
+{
+	tempcomp_report();
+
+	return 0;
+}
+
+#ifdef INSTR_ENABLE
+/**
+ * @brief dump [clear]: sends the instrumentation as binary frame, clears it with 1.
+ */
+static uint8_t shell_dump(uint8_t argc, const uint16_t* argv)
+{
+	instr_dump(argc && argv[0]);
+
+	return 0;
+}
+#endif
+
+static const shell_cmd_t shell_cmds[] PROGMEM = {
+	{"help",	0, 0, shell_help},
+	{"time",	0, 7, shell_time},
+	{"cal",		0, 1, shell_cal},
+	{"calib",	0, 1, shell_calib},
+	{"list",	0, 0, shell_list},
+	{"add",		5, 5, shell_add},
+	{"del",		1, 1, shell_del},
+	{"fade",	1, 2, shell_fade},
+	{"level",	1, 1, shell_level},
+	{"stats",	0, 0, shell_stats},
+	{"temp",	0, 0, shell_temp},
+#ifdef INSTR_ENABLE
+	{"dump",	0, 1, shell_dump},
+#endif
+};
+
+#define SHELL_CMDS	(sizeof(shell_cmds) / sizeof(shell_cmds[0]))
+
+/**
+ * @brief help: lists the commands.
+ */
+static uint8_t shell_help(uint8_t argc, const uint16_t* argv)
+{
+	for(uint8_t i=0; i<SHELL_CMDS; i++) {
+		softuart_puts_p(shell_cmds[i].name);
+		softuart_putchar(' ');
+	}
+	softuart_putchar('\r');
+
+	return 0;
+}
+
+/**
+ * @brief Splits the line into the command and its numeric arguments and runs it.
+ * Arguments are separated by any characters other than digits.
+ * @return SHELL_* flags of the command
+ */
+static uint8_t shell_execute(void)
+{
+	uint16_t argv[SHELL_MAX_ARGS];
+	uint8_t argc = 0;
+	char* p = shell_line;
+	char* name;
+	shell_cmd_t cmd;
+	uint8_t result;
+
+	while(*p == ' ')
+		p++;
+	if(!*p)												/* Empty line */
+		return 0;
+	name = p;
+	while(*p && *p != ' ')
+		p++;
+	if(*p)
+		*p++ = '\0';
+
+	while(*p) {
+		if(*p < '0' || *p > '9') {
+			p++;
+			continue;
+		}
+		if(argc == SHELL_MAX_ARGS)
+			break;
+		argv[argc] = 0;
+		while(*p >= '0' && *p <= '9') {
+			if(argv[argc] < 6553)						/* Saturates, checked by the handlers */
+				argv[argc] = argv[argc]*10 + (*p - '0');
+			else
+				argv[argc] = 0xFFFF;
+			p++;
+		}
+		argc++;
+	}
+
+	for(uint8_t i=0; i<SHELL_CMDS; i++) {
+		if(strcmp_P(name, shell_cmds[i].name))
+			continue;
+
+		memcpy_P(&cmd, &shell_cmds[i], sizeof(cmd));
+		if(*p || argc < cmd.min_args || argc > cmd.max_args)
+			break;
+		result = cmd.handler(argc, argv);
+		if(result & SHELL_ERROR)
+			break;
+
+		return result;
+	}
+
+	softuart_puts_P("?\r");
+
+	return 0;
+}
+
+uint8_t shell_service()
+{
+	uint8_t result = 0;
+	char ch;
+
+	while(softuart_kbhit()) {
+		ch = softuart_getchar();
+
+		if(ch == '\r' || ch == '\n') {
+			shell_line[shell_len] = '\0';
+			if(shell_overflow)
+				softuart_puts_P("?\r");
+			else
+				result |= shell_execute();
+			shell_len = 0;
+			shell_overflow = 0;
+		}
+		else if(ch == '\b' || ch == 0x7F) {				/* Backspace */
+			if(shell_len)
+				shell_len--;
+		}
+		else if(shell_len < SHELL_LINE_SIZE - 1)
+			shell_line[shell_len++] = ch;
+		else
+			shell_overflow = 1;
+	}
+
+	return result;
+}
@@ -0,0 +1,23 @@
+#ifndef SHELL_H
+#define SHELL_H
+
+#include <stdint.h>
+
+#define SHELL_LINE_SIZE			32				/* Max. length of a command line */
+#define SHELL_MAX_ARGS			7				/* Max. number of numeric arguments */
+
+/* Returned by shell_service(), the application follows up on these */
+#define SHELL_TIME_CHANGED		0x01			/* RTCC was set and the clock reloaded */
+#define SHELL_SCHEDULE_CHANGED	0x02			/* Schedule was edited and saved */
+#define SHELL_FADE_STARTED		0x04			/* Fade was started by a command */
+
+/**
+ * @brief Reads the received characters and executes a command for every complete line
+ * (terminated by CR or LF). Returns right away if no line is complete.
+ * Commands: help, time, cal, calib, list, add, del, fade, level, stats, temp
+ * and dump with INSTR_ENABLE.
+ * @return SHELL_* flags of the executed commands
+ */
+uint8_t shell_service(void);
+
+#endif
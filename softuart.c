@@ -138,43 +138,86 @@ V0.4 (10/2010)
 #include <avr/pgmspace.h>
 
 #include "softuart.h"
+#include "power.h"
+#include "instr.h"
 
-#define SU_TRUE    1
-#define SU_FALSE   0
+// ISR state lives in the general purpose I/O registers: the flags are
+// tested and changed with single bit instructions (sbis/sbi/cbi), the
+// counters are read with in/out instead of lds/sts. The ATmega168 has
+// only these three, the shift registers stay in SRAM. They carry a
+// sentinel bit instead of a bit counter, which saves the counters and
+// the receive mask.
+#define su_flags           GPIOR0
+#define SU_TX_BUSY         0
+#define SU_RX_READY        1    // frame being received
+#define SU_RX_STOP         2    // waiting for the stop bit
+#define SU_RX_OFF          3
+#define timer_tx_ctr       GPIOR1
+#define timer_rx_ctr       GPIOR2
 
-// startbit and stopbit parsed internally (see ISR)
-#define RX_NUM_OF_BITS (8)
+#define flag_set( f )      ( su_flags |=  ( 1 << ( f ) ) )
+#define flag_clear( f )    ( su_flags &= ~( 1 << ( f ) ) )
+#define flag_is_set( f )   ( su_flags &   ( 1 << ( f ) ) )
+
+// Receive ring: qin is only written by the ISR, qout only by the reader,
+// so no locking is needed. One place stays free to tell full from empty.
+#define RX_BUF_MASK (SOFTUART_IN_BUF_SIZE - 1)
+#if ( SOFTUART_IN_BUF_SIZE & RX_BUF_MASK )
+    #error "SOFTUART_IN_BUF_SIZE must be a power of two"
+#endif
 volatile static char           inbuf[SOFTUART_IN_BUF_SIZE];
 volatile static unsigned char  qin;
-static unsigned char           qout;
-volatile static unsigned char  flag_rx_off;
-volatile static unsigned char  flag_rx_ready;
-
-// 1 Startbit, 8 Databits, 1 Stopbit = 10 Bits/Frame
-#define TX_NUM_OF_BITS (10)
-volatile static unsigned char  flag_tx_busy;
-volatile static unsigned char  timer_tx_ctr;
-volatile static unsigned char  bits_left_in_tx;
+volatile static unsigned char  qout;
+volatile static unsigned short rx_dropped;      // characters lost, buffer full
+volatile static unsigned short rx_framing;      // characters lost, stop bit low
+// Data bits enter at bit 7, the sentinel of rx_start() leaves at bit 0
+// when the last one is in
+#define RX_SENTINEL (0x80)
+static unsigned char           internal_rx_buffer;
+
+// 1 Startbit, 8 Databits, 1 Stopbit = 10 Bits/Frame, the sentinel above
+// the stop bit is left when the frame is out
+#define TX_FRAME( ch )  ( ( (unsigned short)(unsigned char)( ch ) << 1 ) | 0x600 )
+#define TX_SENTINEL     (1)
 volatile static unsigned short internal_tx_buffer; /* ! mt: was type uchar - this was wrong */
 
+// Transmit ring, the ISR loads the next frame when the stop bit is out
+#define TX_BUF_MASK (SOFTUART_OUT_BUF_SIZE - 1)
+#if ( SOFTUART_OUT_BUF_SIZE & TX_BUF_MASK )
+    #error "SOFTUART_OUT_BUF_SIZE must be a power of two"
+#endif
+volatile static char           outbuf[SOFTUART_OUT_BUF_SIZE];
+volatile static unsigned char  tx_in;
+volatile static unsigned char  tx_out;
+static unsigned char           tx_high_water;
+
 #define set_tx_pin_high()      ( SOFTUART_TXPORT |=  ( 1 << SOFTUART_TXBIT ) )
 #define set_tx_pin_low()       ( SOFTUART_TXPORT &= ~( 1 << SOFTUART_TXBIT ) )
 #define get_rx_pin_status()    ( SOFTUART_RXPIN  &   ( 1 << SOFTUART_RXBIT ) )
 
+#ifdef SOFTUART_EDGE_START
+    // Timer runs only while a frame is sent or received
+    #define timer_run()        ( SOFTUART_T_CONTR_REGB |=  SOFTUART_PRESC_MASKB )
+    #define timer_halt()       ( SOFTUART_T_CONTR_REGB &= ~SOFTUART_PRESC_MASKB )
+    #define timer_stopped()    ( !( SOFTUART_T_CONTR_REGB & SOFTUART_PRESC_MASKB ) )
+    #define timer_idle()       ( !( su_flags & ( ( 1 << SU_TX_BUSY ) | ( 1 << SU_RX_READY ) | ( 1 << SU_RX_STOP ) ) ) )
+    #define start_edge_on()    ( SOFTUART_RX_PCMSK |=  ( 1 << SOFTUART_RX_PCINT ) )
+    #define start_edge_off()   ( SOFTUART_RX_PCMSK &= ~( 1 << SOFTUART_RX_PCINT ) )
+#endif
+
+// Prepares the receiver for a frame after the start bit was seen.
+#define rx_start( ticks_to_bit0 ) do { \
+		flag_set( SU_RX_READY );         \
+		timer_rx_ctr       = ( ticks_to_bit0 ); \
+		internal_rx_buffer = RX_SENTINEL; \
+	} while ( 0 )
+
 ISR(SOFTUART_T_COMP_LABEL)
 {
-	static unsigned char flag_rx_waiting_for_stop_bit = SU_FALSE;
-	static unsigned char rx_mask;
-	
-	static unsigned char timer_rx_ctr;
-	static unsigned char bits_left_in_rx;
-	static unsigned char internal_rx_buffer;
-	
-	unsigned char start_bit, flag_in;
 	unsigned char tmp;
 	
 	// Transmitter Section
-	if ( flag_tx_busy == SU_TRUE ) {
+	if ( flag_is_set( SU_TX_BUSY ) ) {
 		tmp = timer_tx_ctr;
 		if ( --tmp == 0 ) { // if ( --timer_tx_ctr <= 0 )
 			if ( internal_tx_buffer & 0x01 ) {
@@ -185,56 +228,110 @@ ISR(SOFTUART_T_COMP_LABEL)
 			}
 			internal_tx_buffer >>= 1;
 			tmp = 3; // timer_tx_ctr = 3;
-			if ( --bits_left_in_tx == 0 ) {
-				flag_tx_busy = SU_FALSE;
+			if ( internal_tx_buffer == TX_SENTINEL ) {
+				if ( tx_out != tx_in ) {
+					// next frame from the buffer, stop bit lasts until tmp runs out
+					internal_tx_buffer = TX_FRAME( outbuf[tx_out] );
+					tx_out = ( tx_out + 1 ) & TX_BUF_MASK;
+				}
+				else {
+					flag_clear( SU_TX_BUSY );
+					POWER_RELEASE( POWER_HOLD_UART_TX );
+				}
 			}
 		}
 		timer_tx_ctr = tmp;
 	}
 
 	// Receiver Section
-	if ( flag_rx_off == SU_FALSE ) {
-		if ( flag_rx_waiting_for_stop_bit ) {
-			if ( --timer_rx_ctr == 0 ) {
-				flag_rx_waiting_for_stop_bit = SU_FALSE;
-				flag_rx_ready = SU_FALSE;
+	if ( flag_is_set( SU_RX_STOP ) ) {
+		if ( --timer_rx_ctr == 0 ) {
+			flag_clear( SU_RX_STOP );
+			flag_clear( SU_RX_READY );
+			tmp = ( qin + 1 ) & RX_BUF_MASK;
+			if ( !get_rx_pin_status() ) {
+				// stop bit missing
+				rx_framing++;
+			}
+			else if ( tmp == qout ) {
+				// overflow - drop instead of overwriting unread data
+				rx_dropped++;
+			}
+			else {
 				inbuf[qin] = internal_rx_buffer;
-				if ( ++qin >= SOFTUART_IN_BUF_SIZE ) {
-					// overflow - reset inbuf-index
-					qin = 0;
-				}
+				qin = tmp;
+				POWER_WAKE( POWER_WAKE_UART );
+			}
+#ifdef SOFTUART_EDGE_START
+			POWER_RELEASE( POWER_HOLD_UART_RX );
+			if ( !flag_is_set( SU_RX_OFF ) ) {
+				start_edge_on();
 			}
+#endif
 		}
-		else {  // rx_test_busy
-			if ( flag_rx_ready == SU_FALSE ) {
-				start_bit = get_rx_pin_status();
-				// test for start bit
-				if ( start_bit == 0 ) {
-					flag_rx_ready      = SU_TRUE;
-					internal_rx_buffer = 0;
-					timer_rx_ctr       = 4;
-					bits_left_in_rx    = RX_NUM_OF_BITS;
-					rx_mask            = 1;
-				}
+	}
+	else if ( flag_is_set( SU_RX_READY ) ) {  // rx_busy
+		tmp = timer_rx_ctr;
+		if ( --tmp == 0 ) { // if ( --timer_rx_ctr == 0 ) {
+			// rcv, LSB first
+			tmp = internal_rx_buffer;
+			if ( tmp & 1 ) {
+				flag_set( SU_RX_STOP );  // sentinel out, last data bit
 			}
-			else {  // rx_busy
-				tmp = timer_rx_ctr;
-				if ( --tmp == 0 ) { // if ( --timer_rx_ctr == 0 ) {
-					// rcv
-					tmp = 3;
-					flag_in = get_rx_pin_status();
-					if ( flag_in ) {
-						internal_rx_buffer |= rx_mask;
-					}
-					rx_mask <<= 1;
-					if ( --bits_left_in_rx == 0 ) {
-						flag_rx_waiting_for_stop_bit = SU_TRUE;
-					}
-				}
-				timer_rx_ctr = tmp;
+			tmp >>= 1;
+			if ( get_rx_pin_status() ) {
+				tmp |= 0x80;
 			}
+			internal_rx_buffer = tmp;
+			tmp = 3;
+		}
+		timer_rx_ctr = tmp;
+	}
+#ifndef SOFTUART_EDGE_START
+	else if ( !flag_is_set( SU_RX_OFF ) ) {  // rx_test_busy
+		// test for start bit, sample 4 ticks later
+		if ( !get_rx_pin_status() ) {
+			rx_start( 4 );
 		}
 	}
+#else
+	if ( timer_idle() ) {
+		timer_halt();
+	}
+#endif
+
+	// The next tick is already due -> one was lost
+	INSTR_CHECK( SOFTUART_T_FLAG_REG & SOFTUART_T_FLAG_MASK, INSTR_UART_OVERRUN );
+}
+
+#ifdef SOFTUART_EDGE_START
+void softuart_rx_edge( void )
+{
+	if ( !( SOFTUART_RX_PCMSK & ( 1 << SOFTUART_RX_PCINT ) ) ) {
+		return;
+	}
+	// activity on RX, also if the edge was late after power-down
+	POWER_WAKE( POWER_WAKE_UART );
+	// falling edge of the start bit, data bit 0 is sampled 1.5 bits later
+	if ( get_rx_pin_status() ) {
+		return;
+	}
+	start_edge_off();
+	power_hold( POWER_HOLD_UART_RX );
+	rx_start( 5 );
+	if ( timer_stopped() ) {
+		// first compare match half a tick after the edge
+		SOFTUART_T_CNT_REG = SOFTUART_TIMERTOP / 2;
+		SOFTUART_T_FLAG_REG = SOFTUART_T_FLAG_MASK;
+		timer_run();
+	}
+}
+#endif
+
+void softuart_rx_wake( void )
+{
+	// the start edge is armed whenever the receiver is idle (SOFTUART_EDGE_START),
+	// without it the timer polls RX and stops in power-down
 }
 
 static void io_init(void)
@@ -255,7 +352,13 @@ static void timer_init(void)
 	SOFTUART_T_COMP_REG = SOFTUART_TIMERTOP;     /* set top */
 
 	SOFTUART_T_CONTR_REGA = SOFTUART_CTC_MASKA | SOFTUART_PRESC_MASKA;
+#ifdef SOFTUART_EDGE_START
+	SOFTUART_T_CONTR_REGB = SOFTUART_CTC_MASKB;  /* stopped until a frame starts */
+	start_edge_on();
+	SOFTUART_RX_PCICR |= ( 1 << SOFTUART_RX_PCIE );
+#else
 	SOFTUART_T_CONTR_REGB = SOFTUART_CTC_MASKB | SOFTUART_PRESC_MASKB;
+#endif
 
 	SOFTUART_T_INTCTL_REG |= SOFTUART_CMPINT_EN_MASK;
 
@@ -266,9 +369,9 @@ static void timer_init(void)
 
 void softuart_init( void )
 {
-	flag_tx_busy  = SU_FALSE;
-	flag_rx_ready = SU_FALSE;
-	flag_rx_off   = SU_FALSE;
+	su_flags      = 0;
+	tx_in         = 0;
+	tx_out        = 0;
 	
 	set_tx_pin_high(); /* mt: set to high to avoid garbage on init */
 
@@ -276,34 +379,46 @@ void softuart_init( void )
 	timer_init();
 }
 
-static void idle(void)
-{
-	// timeout handling goes here 
-	// - but there is a "softuart_kbhit" in this code...
-	// add watchdog-reset here if needed
-}
-
 void softuart_turn_rx_on( void )
 {
-	flag_rx_off = SU_FALSE;
+	unsigned char sreg_tmp = SREG;
+	cli();
+	
+	flag_clear( SU_RX_OFF );
+#ifdef SOFTUART_EDGE_START
+	if ( !flag_is_set( SU_RX_READY ) ) {
+		start_edge_on();
+	}
+#endif
+	
+	SREG = sreg_tmp;
 }
 
 void softuart_turn_rx_off( void )
 {
-	flag_rx_off = SU_TRUE;
+	unsigned char sreg_tmp = SREG;
+	cli();
+	
+	flag_set( SU_RX_OFF );
+#ifdef SOFTUART_EDGE_START
+	start_edge_off();
+#endif
+	
+	SREG = sreg_tmp;
 }
 
 char softuart_getchar( void )
 {
 	char ch;
 
+	cli();
 	while ( qout == qin ) {
-		idle();
+		power_idle(); // sleep until the next interrupt
+		cli();
 	}
+	sei();
 	ch = inbuf[qout];
-	if ( ++qout >= SOFTUART_IN_BUF_SIZE ) {
-		qout = 0;
-	}
+	qout = ( qout + 1 ) & RX_BUF_MASK;
 	
 	return( ch );
 }
@@ -315,27 +430,83 @@ unsigned char softuart_kbhit( void )
 
 void softuart_flush_input_buffer( void )
 {
-	qin  = 0;
-	qout = 0;
+	qout = qin;
+}
+
+void softuart_get_rx_errors( unsigned short *dropped, unsigned short *framing )
+{
+	unsigned char sreg_tmp = SREG;
+	cli();
+	
+	*dropped = rx_dropped;
+	*framing = rx_framing;
+	
+	SREG = sreg_tmp;
 }
 	
 unsigned char softuart_transmit_busy( void ) 
 {
-	return ( flag_tx_busy == SU_TRUE ) ? 1 : 0;
+	return flag_is_set( SU_TX_BUSY ) ? 1 : 0;
+}
+
+unsigned char softuart_tx_high_water( void )
+{
+	return tx_high_water;
+}
+
+// Queues a character, call with interrupts disabled and free space in the buffer.
+static void tx_enqueue( const char ch )
+{
+	unsigned char used;
+
+	if ( !flag_is_set( SU_TX_BUSY ) ) {
+		// invoke_UART_transmit
+		timer_tx_ctr       = 3;
+		internal_tx_buffer = TX_FRAME( ch );	//add Start bit(0), Stopp bit(1) and the sentinel
+		flag_set( SU_TX_BUSY );
+		power_hold( POWER_HOLD_UART_TX );	// Timer0 must not stop in deep sleep
+#ifdef SOFTUART_EDGE_START
+		timer_run();
+#endif
+	}
+	else {
+		outbuf[tx_in] = ch;
+		tx_in = ( tx_in + 1 ) & TX_BUF_MASK;
+		used = ( tx_in - tx_out ) & TX_BUF_MASK;
+		if ( used > tx_high_water ) {
+			tx_high_water = used;
+		}
+	}
+}
+
+static unsigned char tx_full( void )
+{
+	return flag_is_set( SU_TX_BUSY ) && ( ( tx_in + 1 ) & TX_BUF_MASK ) == tx_out;
 }
 
 void softuart_putchar( const char ch )
 {
-	while ( flag_tx_busy == SU_TRUE ) {
-		; // wait for transmitter ready
-		  // add watchdog-reset here if needed;
+	cli();
+	while ( tx_full() ) {
+		power_idle(); // wait for a free place in the buffer
+		cli();
 	}
+	tx_enqueue( ch );
+	sei();
+}
 
-	// invoke_UART_transmit
-	timer_tx_ctr       = 3;
-	bits_left_in_tx    = TX_NUM_OF_BITS;
-	internal_tx_buffer = ( ch << 1 ) | 0x200;	//add Start bit(0) and Stopp bit(1)
-	flag_tx_busy       = SU_TRUE;
+unsigned char softuart_try_write( const char *buf, unsigned char len )
+{
+	unsigned char n;
+	unsigned char sreg_tmp = SREG;
+	cli();
+
+	for ( n = 0; n < len && !tx_full(); n++ ) {
+		tx_enqueue( buf[n] );
+	}
+
+	SREG = sreg_tmp;
+	return n;
 }
 	
 void softuart_puts( const char *s )
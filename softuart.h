@@ -6,7 +6,16 @@
     #define F_CPU 16000000UL
 #endif
 
-#define SOFTUART_BAUD_RATE      9600
+// Backend: software UART on Timer0 (default) or the hardware USART
+// on the same pins, selected in the makefile (UART = hw -> SOFTUART_HW).
+// The baud rate can be given with -DSOFTUART_BAUD_RATE.
+#ifndef SOFTUART_BAUD_RATE
+    #ifdef SOFTUART_HW
+        #define SOFTUART_BAUD_RATE      115200
+    #else
+        #define SOFTUART_BAUD_RATE      9600      // up to 38400 at 16MHz
+    #endif
+#endif
 
 #if defined (__AVR_ATtiny25__) || defined (__AVR_ATtiny45__) || defined (__AVR_ATtiny85__)
     #define SOFTUART_RXPIN   PINB
@@ -66,11 +75,26 @@
     #define SOFTUART_CMPINT_EN_MASK    (1 << OCIE0A)	//Enable interrupts on compare match A
     #define SOFTUART_CTC_MASKA         (1 << WGM01)		//Enable CTC
     #define SOFTUART_CTC_MASKB         (0)
+    #define SOFTUART_T_FLAG_REG        TIFR0
+    #define SOFTUART_T_FLAG_MASK       (1 << OCF0A)
+
+    #if defined (__AVR_ATmega168__) || defined (__AVR_ATmega328P__) || defined (__AVR_ATmega328PA__)
+        // Pin change interrupt of the RX pin (PD0 = PCINT16)
+        #define SOFTUART_RX_PCMSK      PCMSK2
+        #define SOFTUART_RX_PCINT      PCINT16
+        #define SOFTUART_RX_PCICR      PCICR
+        #define SOFTUART_RX_PCIE       PCIE2
+    #endif
 
     /* "A timer interrupt must be set to interrupt at three times 
-       the required baud rate." */
-    #define SOFTUART_PRESCALE (8)
-    // #define SOFTUART_PRESCALE (1)
+       the required baud rate."
+       Without prescaler if 8 bits are enough, this keeps the baud rate
+       error small at 38400 (16MHz: 139 ticks, -0.1%) */
+    #if ( F_CPU / SOFTUART_BAUD_RATE / 3 <= 256 )
+        #define SOFTUART_PRESCALE (1)
+    #else
+        #define SOFTUART_PRESCALE (8)
+    #endif
 
     #if (SOFTUART_PRESCALE == 8)
         #define SOFTUART_PRESC_MASKA         (0)
@@ -85,20 +109,43 @@
     #error "no defintions available for this AVR"
 #endif
 
-#define SOFTUART_TIMERTOP ( F_CPU/SOFTUART_PRESCALE/SOFTUART_BAUD_RATE/3 - 1)
+// rounded, 16MHz: 9600 -> +0.6%, 19200 -> -0.8%, 38400 -> -0.1%
+#define SOFTUART_TIMERTOP ( ( F_CPU/SOFTUART_PRESCALE + SOFTUART_BAUD_RATE*3/2 ) / ( SOFTUART_BAUD_RATE*3 ) - 1 )
 
-#if (SOFTUART_TIMERTOP > 0xff)
+// Optimised mode: start bits are detected by the pin change interrupt of
+// the RX pin and the timer only runs while a frame is sent or received.
+// The pin change vector is shared with the other pins of the port, so the
+// application's ISR must call softuart_rx_edge().
+#if defined (SOFTUART_RX_PCMSK) && !defined (SOFTUART_HW)
+    #define SOFTUART_EDGE_START
+#endif
+
+#if (SOFTUART_TIMERTOP > 0xff) && !defined(SOFTUART_HW)
     #warning "Check SOFTUART_TIMERTOP: increase prescaler, lower F_CPU or use a 16 bit timer"
 #endif
 
-#define SOFTUART_IN_BUF_SIZE     32
+#define SOFTUART_IN_BUF_SIZE     32     // power of two, one place stays free
+#define SOFTUART_OUT_BUF_SIZE    32     // power of two, one place stays free
 
 // Init the Software Uart
 void softuart_init(void);
 
+// Starts the receiver on the falling edge of a start bit (SOFTUART_EDGE_START)
+// and marks POWER_WAKE_UART. With SOFTUART_HW it only marks the wake-up
+// armed by softuart_rx_wake(). Call from the pin change interrupt of the RX pin.
+void softuart_rx_edge( void );
+
+// Lets the next start bit wake the MCU from power-down, where the UART
+// clock stops. That frame is lost. Call before POWER_HOLD_UART is released.
+void softuart_rx_wake( void );
+
 // Clears the contents of the input buffer.
 void softuart_flush_input_buffer( void );
 
+// Copies the number of received characters which were lost because
+// the input buffer was full or the stop bit was missing.
+void softuart_get_rx_errors( unsigned short *dropped, unsigned short *framing );
+
 // Tests whether an input character has been received.
 unsigned char softuart_kbhit( void );
 
@@ -109,8 +156,17 @@ char softuart_getchar( void );
 unsigned char softuart_transmit_busy( void );
 
 // Writes a character to the serial port.
+// Queues it and only waits if the transmit buffer is full.
 void softuart_putchar( const char );
 
+// Queues as many characters as fit into the transmit buffer without waiting.
+// Returns the number of characters accepted.
+unsigned char softuart_try_write( const char *buf, unsigned char len );
+
+// Returns the highest number of characters waiting in the transmit buffer
+// (for sizing SOFTUART_OUT_BUF_SIZE).
+unsigned char softuart_tx_high_water( void );
+
 // Turns on the receive function.
 void softuart_turn_rx_on( void );
 
@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include "tempcomp.h"
+#include "trim.h"
+#include "MCP7940M.h"
+#include "softuart.h"
+#include "hal.h"
+
+#define TEMPCOMP_EE_VALID		0xA5			/* Marker of a stored deviation */
+#define TEMPCOMP_NONE			(TRIM_MAX + 1)	/* CAL_REG not written yet */
+
+static uint8_t HAL_EEMEM tempcomp_ee_valid;
+static int16_t HAL_EEMEM tempcomp_ee_ppm;
+static int8_t HAL_EEMEM tempcomp_ee_temp;
+
+static uint8_t tempcomp_valid;					/* Deviation known */
+static int16_t tempcomp_ppm;					/* Deviation without trimming in 0.1ppm */
+static int8_t tempcomp_t_cal;					/* Temperature of the calibration */
+static int8_t tempcomp_temp;					/* Temperature of the last update */
+static int16_t tempcomp_steps = TEMPCOMP_NONE;	/* Trim in CAL_REG */
+static int32_t tempcomp_clocks;					/* Accumulated correction by the temperature */
+
+void tempcomp_init()
+{
+	if(hal_ee_read_byte(&tempcomp_ee_valid) != TEMPCOMP_EE_VALID)
+		return;
+
+	tempcomp_ppm = hal_ee_read_word((uint16_t*)&tempcomp_ee_ppm);
+	tempcomp_t_cal = hal_ee_read_byte((uint8_t*)&tempcomp_ee_temp);
+	tempcomp_valid = 1;
+}
+
+int8_t tempcomp_read()
+{
+	uint16_t sum = 0;
+
+	hal_adc_temp_enable();
+
+	for(uint8_t i=0; i<=TEMPCOMP_SAMPLES; i++) {
+		uint16_t value = hal_adc_convert();
+		if(i)											/* The first conversion settles the reference */
+			sum += value;
+	}
+
+	hal_adc_disable();
+
+	/* About 1mV/degC, one LSB is 1.074mV (275/256) */
+	return TRIM_T0 + ((int32_t)(sum/TEMPCOMP_SAMPLES) - TEMPCOMP_ADC_25C)*275/256;
+}
+
+void tempcomp_set_offset(int32_t ppm)
+{
+	tempcomp_ppm = ppm;
+	tempcomp_t_cal = tempcomp_read();
+	tempcomp_valid = 1;
+
+	hal_ee_update_word((uint16_t*)&tempcomp_ee_ppm, tempcomp_ppm);
+	hal_ee_update_byte((uint8_t*)&tempcomp_ee_temp, tempcomp_t_cal);
+	hal_ee_update_byte(&tempcomp_ee_valid, TEMPCOMP_EE_VALID);
+}
+
+uint8_t tempcomp_update(uint8_t minutes)
+{
+	int16_t steps;
+	uint8_t data;
+
+	if(!tempcomp_valid)
+		return 0;
+
+	/* The RTCC trims once per minute by 2 clocks per step */
+	if(tempcomp_steps != TEMPCOMP_NONE)
+		tempcomp_clocks += (int32_t)(tempcomp_steps - trim_ppm_steps(tempcomp_ppm))*2*minutes;
+
+	tempcomp_temp = tempcomp_read();
+	steps = trim_ppm_steps(trim_temperature(tempcomp_ppm, tempcomp_t_cal, tempcomp_temp));
+	if(steps == tempcomp_steps)
+		return 0;
+
+	data = trim_cal(steps);
+	rtcc_byte_write(CAL_REG, &data);
+	tempcomp_steps = steps;
+
+	return 1;
+}
+
+int8_t tempcomp_temperature()
+{
+	return tempcomp_temp;
+}
+
+int16_t tempcomp_trim()
+{
+	return tempcomp_steps == TEMPCOMP_NONE ? 0 : tempcomp_steps;
+}
+
+int32_t tempcomp_correction()
+{
+	return tempcomp_clocks;
+}
+
+void tempcomp_report()
+{
+	char softuart_out[64];
+
+	if(!tempcomp_valid) {
+		sprintf(softuart_out, "Temp: %d C, not compensated\r", tempcomp_read());
+		softuart_puts(softuart_out);
+		return;
+	}
+
+	sprintf(softuart_out, "Temp: %d C (cal %d C), trim %d, correction %ld ms\r",
+		tempcomp_temp, tempcomp_t_cal, tempcomp_trim(),
+		tempcomp_clocks/32768*1000 + tempcomp_clocks%32768*1000/32768);
+	softuart_puts(softuart_out);
+}
@@ -0,0 +1,58 @@
+#ifndef TEMPCOMP_H
+#define TEMPCOMP_H
+
+#include <stdint.h>
+
+#define TEMPCOMP_ADC_25C		292				/* ADC value of the sensor at 25degC (314mV), differs per chip */
+#define TEMPCOMP_SAMPLES		8				/* Conversions averaged per measurement */
+
+/**
+ * @brief Loads the deviation of the crystal and the temperature it was measured at
+ * from EEPROM. Without a calibration the trim is left to the RTCC.
+ */
+void tempcomp_init(void);
+
+/**
+ * @brief Measures the temperature with the internal sensor (ADC8, 1.1V reference).
+ * Needs a chip with the sensor (ATmega168A/PA, 328P). The ADC is off afterwards.
+ * @return Temperature in degC
+ */
+int8_t tempcomp_read(void);
+
+/**
+ * @brief Stores the deviation measured by a calibration together with the current temperature.
+ * @param ppm Deviation of the crystal without trimming in 0.1ppm, positive if the RTCC is slow
+ */
+void tempcomp_set_offset(int32_t);
+
+/**
+ * @brief Measures the temperature and rewrites CAL_REG if the trim changed.
+ * @param minutes Time since the last update, the correction meanwhile is accumulated
+ * @return 1 if CAL_REG was written, 0 otherwise
+ */
+uint8_t tempcomp_update(uint8_t);
+
+/**
+ * @brief Returns the temperature of the last update.
+ * @return Temperature in degC
+ */
+int8_t tempcomp_temperature(void);
+
+/**
+ * @brief Returns the trim in CAL_REG.
+ * @return Steps, positive if clocks are added
+ */
+int16_t tempcomp_trim(void);
+
+/**
+ * @brief Returns the correction by the temperature, beyond the trim of the static deviation.
+ * @return Accumulated correction in clocks of the RTCC (32768 per second), positive if added
+ */
+int32_t tempcomp_correction(void);
+
+/**
+ * @brief Sends the temperature, the trim and the accumulated correction over UART.
+ */
+void tempcomp_report(void);
+
+#endif
@@ -0,0 +1,145 @@
+#include "trim.h"
+
+/* 2*TRIM_CLOCKS/TRIM_TICKS = TRIM_STEP_NUM*2^TRIM_STEP_BITS/TRIM_STEP_DEN, reduced so that the
+ * remainder of the division stays within 32 bits for up to 4 counts per second */
+#define TRIM_STEP_NUM			768UL
+#define TRIM_STEP_DEN			3125UL
+#define TRIM_STEP_BITS			9
+#define TRIM_STEP_RANGE			4				/* Max. deviation in counts per second (251 steps) */
+
+#if TRIM_PPM != 5UL<<7
+	#error "The division of the deviation in 0.1ppm expects TRIM_PPM = 640!"
+#endif
+
+#if TRIM_STEP_NUM*(1UL<<TRIM_STEP_BITS)*TRIM_TICKS != 2*TRIM_CLOCKS*TRIM_STEP_DEN
+	#error "TRIM_STEP_NUM/TRIM_STEP_DEN does not match TRIM_CLOCKS/TRIM_TICKS!"
+#endif
+
+/**
+ * @brief Shift and subtract division with a short quotient, rest*2^bits/den.
+ * @param rest Dividend (< den), returns the remainder
+ * @param den Divisor (< 2^31)
+ * @param bits Bits of the quotient
+ * @return Quotient
+ */
+static uint16_t trim_divide(uint32_t* rest, uint32_t den, uint8_t bits)
+{
+	uint32_t r = *rest;
+	uint16_t q = 0;
+
+	while(bits--) {
+		r <<= 1;
+		q <<= 1;
+		if(r >= den) {
+			r -= den;
+			q |= 1;
+		}
+	}
+	*rest = r;
+
+	return q;
+}
+
+/**
+ * @brief Divides the magnitude of a deviation by the counts of one trim step, rounded.
+ * @param count Magnitude of the deviation (< TRIM_STEP_RANGE*seconds)
+ * @param seconds Elapsed seconds of the RTCC (> 0)
+ * @param rest Returns the distance from the lower rounding boundary, below 2*seconds*TRIM_STEP_DEN
+ * @return Steps (0 to 256)
+ */
+static uint16_t trim_round(uint32_t count, uint16_t seconds, uint32_t* rest)
+{
+	uint32_t den = seconds*TRIM_STEP_DEN;
+	uint16_t twice;
+
+	*rest = count*TRIM_STEP_NUM;
+	twice = trim_divide(rest, den, TRIM_STEP_BITS);			/* Twice the steps, truncated */
+	if(!(twice & 1))
+		*rest += den;
+
+	return (twice + 1) >> 1;
+}
+
+int16_t trim_steps(int32_t diff, uint16_t seconds)
+{
+	uint32_t count = diff < 0 ? -(uint32_t)diff : (uint32_t)diff;
+	uint32_t rest;
+	uint16_t steps = TRIM_MAX + 1;
+
+	if(count < (uint32_t)seconds*TRIM_STEP_RANGE)
+		steps = trim_round(count, seconds, &rest);
+	if(steps > TRIM_MAX)
+		steps = TRIM_MAX + 1;
+
+	return diff < 0 ? -(int16_t)steps : (int16_t)steps;
+}
+
+uint8_t trim_compute(uint16_t seconds, uint32_t counts, trim_t* trim)
+{
+	int32_t diff = counts - seconds*TRIM_TICKS;
+	uint32_t count = diff < 0 ? -(uint32_t)diff : (uint32_t)diff;
+	uint32_t rest, jitter = TRIM_JITTER*TRIM_STEP_NUM<<TRIM_STEP_BITS;
+	uint16_t steps;
+
+	/* ceil(TRIM_JITTER*TRIM_PPM/seconds), a 16 bit division */
+	trim->uncertainty = seconds >= TRIM_JITTER*TRIM_PPM ? 1 : (uint16_t)(TRIM_JITTER*TRIM_PPM - 1 + seconds)/seconds;
+
+	if(count >= (uint32_t)seconds*TRIM_STEP_RANGE) {		/* Far out of range, crystal fault */
+		trim->ppm = diff*(int32_t)TRIM_PPM/seconds;
+		trim->steps = diff < 0 ? -(TRIM_MAX + 1) : TRIM_MAX + 1;
+		trim->stable = 1;
+		trim->cal = 0;
+		return 0;
+	}
+
+	/* count*TRIM_PPM/seconds with TRIM_PPM = 5*2^7, the quotient is below 5*TRIM_STEP_RANGE*2^7 */
+	rest = count*5;
+	trim->ppm = trim_divide(&rest, (uint32_t)seconds << 5, 12);
+	if(diff < 0)
+		trim->ppm = -trim->ppm;
+
+	/* One division for the steps, the remainder tells if diff +-TRIM_JITTER
+	 * would round to the same steps */
+	steps = trim_round(count, seconds, &rest);
+	trim->stable = rest >= jitter && rest + jitter < 2*TRIM_STEP_DEN*seconds;
+	if(steps > TRIM_MAX) {
+		trim->steps = diff < 0 ? -(TRIM_MAX + 1) : TRIM_MAX + 1;
+		trim->cal = 0;
+		return 0;
+	}
+	trim->steps = diff < 0 ? -(int16_t)steps : (int16_t)steps;
+	trim->cal = trim_cal(trim->steps);
+
+	return 1;
+}
+
+int16_t trim_ppm_steps(int32_t ppm)
+{
+	int32_t steps;
+
+	/* ppm*TRIM_CLOCKS/10^7 = ppm*1536/15625, rounded */
+	steps = ppm < 0 ? (ppm*1536 - 15625/2)/15625 : (ppm*1536 + 15625/2)/15625;
+	if(steps > TRIM_MAX)
+		return TRIM_MAX;
+	if(steps < -TRIM_MAX)
+		return -TRIM_MAX;
+
+	return steps;
+}
+
+uint8_t trim_cal(int16_t steps)
+{
+	return steps > 0 ? TRIM_SIGN|steps : -steps;
+}
+
+int32_t trim_temperature(int32_t ppm, int8_t t_cal, int8_t t)
+{
+	int16_t dt = t - TRIM_T0;
+	int16_t dt_cal = t_cal - TRIM_T0;
+	int32_t slow;
+
+	/* The crystal is slower by k*(T-T0)^2 at t than at t_cal, in 0.001ppm */
+	slow = (int32_t)(dt*dt - dt_cal*dt_cal)*TRIM_K;
+
+	return ppm + (slow < 0 ? slow - 50 : slow + 50)/100;
+}
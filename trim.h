@@ -0,0 +1,77 @@
+#ifndef TRIM_H
+#define TRIM_H
+
+#include <stdint.h>
+
+/* Digital trimming of the MCP7940M (CAL_REG, sign and magnitude):
+ * once per minute 2*TRIMVAL clocks of the 32768Hz oscillator are added (SIGN = 1,
+ * RTCC slow) or subtracted (SIGN = 0, RTCC fast). One step is 2/(32768*60) = 1.0173ppm,
+ * the range is +-127 steps = +-129.2ppm. */
+#define TRIM_MAX				127				/* Max. TRIMVAL */
+#define TRIM_SIGN				0x80			/* SIGN bit of CAL_REG */
+#define TRIM_CLOCKS				983040UL		/* 32768*60/2, steps per unit of deviation */
+
+#define TRIM_TICKS				15625UL			/* Counts of the reference per second (16MHz, prescaling 1024) */
+#define TRIM_JITTER				2				/* Max. error of the elapsed counts (resolution, latency) */
+#define TRIM_PPM				(10000000UL/TRIM_TICKS)	/* 0.1ppm of one count per second */
+
+#define TRIM_T0					25				/* Turnover temperature of the crystal in degC */
+#define TRIM_K					34				/* Parabolic coefficient in 0.001ppm/degC^2 (typ. 0.034) */
+
+#if TRIM_PPM*TRIM_TICKS != 10000000UL
+	#error "TRIM_TICKS must divide 10^7!"
+#endif
+
+typedef struct{									/* Result of a measurement */
+	int32_t ppm;								/* Deviation in 0.1ppm, positive if the RTCC is slow */
+	uint16_t uncertainty;						/* Half width of the interval in 0.1ppm */
+	int16_t steps;								/* Rounded trim steps, positive adds clocks */
+	uint8_t cal;								/* Value for CAL_REG */
+	uint8_t stable;								/* 1 if both ends of the interval round to the same steps */
+}trim_t;
+
+/**
+ * @brief Rounds a deviation to the nearest trim step. Exact, the quotient is
+ * found by 9 steps of shift and subtract on 32 bits instead of a division.
+ * @param diff Counts of the reference minus seconds*TRIM_TICKS
+ * @param seconds Elapsed seconds of the RTCC (> 0)
+ * @return Steps, positive if clocks must be added; +-(TRIM_MAX+1) if out of range
+ */
+int16_t trim_steps(int32_t, uint16_t);
+
+/**
+ * @brief Calculates the trim value from the counts of the reference over whole seconds of the RTCC.
+ * The elapsed counts are off by less than TRIM_JITTER, which gives the uncertainty. The steps
+ * and their stability come from one short division, the deviation in ppm from another.
+ * @param seconds Elapsed seconds of the RTCC (> 0)
+ * @param counts Elapsed counts of the reference
+ * @param trim Pointer where the result should be stored
+ * @return 1 if the deviation is within the trim range, 0 otherwise (cal is 0)
+ */
+uint8_t trim_compute(uint16_t, uint32_t, trim_t*);
+
+/**
+ * @brief Rounds a deviation to the nearest trim step, limited to the trim range.
+ * @param ppm Deviation in 0.1ppm, positive if the RTCC is slow
+ * @return Steps, positive if clocks must be added
+ */
+int16_t trim_ppm_steps(int32_t);
+
+/**
+ * @brief Converts trim steps into the value of CAL_REG.
+ * @param steps Steps (-TRIM_MAX to TRIM_MAX), positive if clocks must be added
+ * @return Value for CAL_REG
+ */
+uint8_t trim_cal(int16_t);
+
+/**
+ * @brief Applies the parabolic model of a tuning fork crystal, f = f0*(1 - k*(T-T0)^2),
+ * to a deviation measured at another temperature.
+ * @param ppm Deviation measured at t_cal in 0.1ppm, positive if the RTCC is slow
+ * @param t_cal Temperature of the measurement in degC
+ * @param t Temperature in degC
+ * @return Deviation at t in 0.1ppm
+ */
+int32_t trim_temperature(int32_t, int8_t, int8_t);
+
+#endif